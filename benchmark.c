@@ -0,0 +1,537 @@
+// benchmark.c - Random number generator throughput benchmark and statistical smoke tests.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+
+#include "config.h"
+#include "sm.h"
+#include "bits.h"
+#include "random.h"
+#include "thread.h"
+#include "chacha.h"
+#include "vector_rand.h"
+#include "compatibility/gettimeofday.h"
+#include "benchmark.h"
+
+
+// Precursor generators, see precursors/ran.c.
+
+extern void callconv ran_a_seed(void *restrict s, uint64_t seed);
+extern uint64_t callconv ran_a_rand(void *restrict s);
+extern void callconv ran_b_seed(void *restrict s, uint64_t seed);
+extern uint64_t callconv ran_b_rand(void *restrict s);
+extern void callconv ran_c_seed(void *restrict s, uint64_t seed);
+extern uint64_t callconv ran_c_rand(void *restrict s);
+extern void callconv ran_d_seed(void *restrict s, uint64_t seed);
+extern uint64_t callconv ran_d_rand(void *restrict s);
+extern void callconv ran_e_seed(void *restrict s, uint64_t seed);
+extern uint64_t callconv ran_e_rand(void *restrict s);
+extern void callconv ran_f_seed(void *restrict s, uint64_t seed);
+extern uint64_t callconv ran_f_rand(void *restrict s);
+extern void callconv ran_g_seed(void *restrict s, uint64_t seed);
+extern uint64_t callconv ran_g_rand(void *restrict s);
+
+
+// The count of values in the monobit and runs tests.
+#define SM_BENCHMARK_BITS_VALUES 0x100000U
+
+// The count of birthdays per sample, and of samples, in the birthday spacings test. With 2^32 days, the count of repeated
+// spacings per sample is Poisson distributed with mean m^3 / 4n = 4.
+#define SM_BENCHMARK_BIRTHDAYS 0x1000U
+#define SM_BENCHMARK_BIRTHDAY_SAMPLES 0x100U
+
+// The length of each block, and the count of blocks, in the linear complexity test.
+#define SM_BENCHMARK_LINEAR_BITS 500U
+#define SM_BENCHMARK_LINEAR_BLOCKS 500U
+
+
+// Seeds the state at s of a generator. Context generators keep the context in their state.
+typedef void (*sm_benchmark_seed_f)(sm_t sm, void* s, uint64_t seed);
+
+// Generates n values, one call each, and returns their XOR so that the calls are not optimized away.
+typedef uint64_t (*sm_benchmark_scalar_f)(void* s, uint64_t n);
+
+// Generates n values at p.
+typedef void (*sm_benchmark_bulk_f)(void* s, uint64_t* p, size_t n);
+
+
+// A built-in generator.
+typedef struct sm_benchmark_generator_s
+{
+	const char* name; // The name reported.
+	size_t state; // The size of the state in bytes.
+	sm_benchmark_seed_f seed; // Seeds the state.
+	sm_benchmark_scalar_f scalar; // One value per call.
+	sm_benchmark_bulk_f bulk; // Many values per call, yielding the same sequence as scalar calls.
+}
+sm_benchmark_generator_t;
+
+
+// One thread of a throughput measurement.
+typedef struct sm_benchmark_worker_s
+{
+	const sm_benchmark_generator_t* generator; // The generator measured.
+	uint8_t bulk; // Set to measure bulk calls.
+	uint64_t deadline; // The time to stop at, in microseconds.
+	uint64_t values; // The count of values generated.
+	uint64_t sink; // Scalar output, kept so that it is not optimized away.
+	void* state; // The generator state.
+	uint64_t* buffer; // The bulk output buffer.
+	sm_thread_t thread; // The thread, unless the worker runs on the caller.
+}
+sm_benchmark_worker_t;
+
+
+// Defines the seed function of generator N, which seeds the state s from seed (and context sm) by the statement S.
+#define sm_benchmark_define_seed(N, S) \
+	static void sm_benchmark_##N##_seed(sm_t sm, void* s, uint64_t seed) \
+	{ \
+		(void)sm, (void)seed; \
+		S; \
+	}
+
+// Defines the scalar function of generator N, which gets the next value of the state s as the expression X.
+#define sm_benchmark_define_scalar(N, X) \
+	static uint64_t sm_benchmark_##N##_scalar(void* s, uint64_t n) \
+	{ \
+		register uint64_t r = 0; \
+		for (; n > 0; --n) r ^= (X); \
+		return r; \
+	}
+
+// Defines the functions of generator N, seeded by the statement S, whose next value is the expression X. Bulk calls are
+// a loop of scalar calls.
+#define sm_benchmark_define(N, S, X) \
+	sm_benchmark_define_seed(N, S) \
+	sm_benchmark_define_scalar(N, X) \
+	static void sm_benchmark_##N##_bulk(void* s, uint64_t* p, size_t n) \
+	{ \
+		for (; n > 0; --n) *p++ = (X); \
+	}
+
+// Defines the functions of generator N, as sm_benchmark_define, but whose bulk calls are the statement B, filling n
+// values at p.
+#define sm_benchmark_define_native(N, S, X, B) \
+	sm_benchmark_define_seed(N, S) \
+	sm_benchmark_define_scalar(N, X) \
+	static void sm_benchmark_##N##_bulk(void* s, uint64_t* p, size_t n) \
+	{ \
+		B; \
+	}
+
+// Lists generator N under the given name, with a state of Z bytes.
+#define sm_benchmark_generator(N, Z, NAME) { NAME, Z, sm_benchmark_##N##_seed, sm_benchmark_##N##_scalar, sm_benchmark_##N##_bulk }
+
+
+// Seeds the fastrand (MWC1616) SSE state at s by expanding seed with Split Mix 64.
+static void sm_benchmark_seed_fastrand(void* s, uint64_t seed)
+{
+	uint16_t v[16];
+	uint64_t z;
+	register uint32_t i;
+
+	for (i = 0; i < 16; i += 4)
+	{
+		z = (seed += UINT64_C(0x9E3779B97F4A7C15));
+		z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+		z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+		z ^= z >> 31;
+		memcpy(&v[i], &z, sizeof(z));
+	}
+
+	sec_random_fastrand_sse_initialize(s, v);
+}
+
+
+// Seeds the PCG state at s.
+static void sm_benchmark_seed_pcg(void* s, uint64_t seed)
+{
+	register uint64_t* v = (uint64_t*)s;
+
+	v[0] = seed;
+	v[1] = (sm_yellow_64(seed) << 1) | UINT64_C(1); // The increment must be odd.
+}
+
+
+// Seeds the multi-lane engine at s.
+static void sm_benchmark_seed_vector(void* s, uint64_t seed)
+{
+	uint64_t k[2] = { seed, sm_yellow_64(~seed) };
+	sm_vector_rand_seed((sm_vector_rand_t*)s, k);
+}
+
+
+// Gets the next value of the multi-lane engine at s.
+inline static uint64_t sm_benchmark_next_vector(void* s)
+{
+	uint64_t r;
+	sm_vector_rand_block((sm_vector_rand_t*)s, &r, 1);
+	return r;
+}
+
+
+sm_benchmark_define(ran_a, ran_a_seed(s, seed), ran_a_rand(s))
+sm_benchmark_define(ran_b, ran_b_seed(s, seed), ran_b_rand(s))
+sm_benchmark_define(ran_c, ran_c_seed(s, seed), ran_c_rand(s))
+sm_benchmark_define(ran_d, ran_d_seed(s, seed), ran_d_rand(s))
+sm_benchmark_define(ran_e, ran_e_seed(s, seed), ran_e_rand(s))
+sm_benchmark_define(ran_f, ran_f_seed(s, seed), ran_f_rand(s))
+sm_benchmark_define(ran_g, ran_g_seed(s, seed), ran_g_rand(s))
+sm_benchmark_define(xorshift, sec_random_xorshift_initialize(s, seed), sec_random_xorshift_64(s))
+sm_benchmark_define(pcg, sm_benchmark_seed_pcg(s, seed), sec_random_pcg_64(s))
+sm_benchmark_define(fastrand, sm_benchmark_seed_fastrand(s, seed), sec_random_fastrand_sse_64(s))
+sm_benchmark_define_native(vector, sm_benchmark_seed_vector(s, seed), sm_benchmark_next_vector(s), sm_vector_rand_block((sm_vector_rand_t*)s, p, n))
+sm_benchmark_define_native(master, *(sm_t*)s = sm, sm_random(*(sm_t*)s), sm_random_fill(*(sm_t*)s, p, n * sizeof(uint64_t)))
+sm_benchmark_define_native(chacha, *(sm_t*)s = sm, sm_random_chacha(*(sm_t*)s), sm_random_chacha_fill(*(sm_t*)s, p, n * sizeof(uint64_t)))
+
+
+// The generators measured, in report order.
+static const sm_benchmark_generator_t sm_benchmark_generators[] =
+{
+	sm_benchmark_generator(ran_a, sizeof(uint64_t), "fishman-20"),
+	sm_benchmark_generator(ran_b, sizeof(int32_t) + (sizeof(uint32_t) * 0x4000), "gfsr4"),
+	sm_benchmark_generator(ran_c, sizeof(int32_t) + (sizeof(uint64_t) * 0x0138), "mt19937-64"),
+	sm_benchmark_generator(ran_d, sizeof(uint64_t), "splitmix-64"),
+	sm_benchmark_generator(ran_e, sizeof(uint64_t) * 2, "xoroshiro128+"),
+	sm_benchmark_generator(ran_f, sizeof(int32_t) + (sizeof(uint64_t) * 16), "xorshift1024*"),
+	sm_benchmark_generator(ran_g, sizeof(uint64_t) * 2, "pcg-64"),
+	sm_benchmark_generator(xorshift, sec_random_xorshift_state_size, "sec xorshift1024*"),
+	sm_benchmark_generator(pcg, sec_random_pcg_state_size, "sec pcg-32"),
+	sm_benchmark_generator(fastrand, sec_random_fastrand_sse_state_size, "sec fastrand sse"),
+	sm_benchmark_generator(vector, sizeof(sm_vector_rand_t), "vector xoroshiro128+"),
+	sm_benchmark_generator(master, sizeof(sm_t), "sm_random"),
+	sm_benchmark_generator(chacha, sizeof(sm_t), "sm_random_chacha"),
+};
+
+
+// Gets the wall time in microseconds.
+inline static uint64_t sm_benchmark_now()
+{
+	struct timeval tv = { 0, 0 };
+	(void)gettimeofday(&tv, NULL);
+	return ((uint64_t)tv.tv_sec * UINT64_C(1000000)) + (uint64_t)tv.tv_usec;
+}
+
+
+// Gets a distinct seed for each thread i.
+inline static uint64_t sm_benchmark_seed(uint32_t i)
+{
+	return sm_yellow_64(UINT64_C(0x9E3779B97F4A7C15) * ((uint64_t)i + 1));
+}
+
+
+// Runs one thread of a throughput measurement, checking the clock once per chunk.
+static void sm_benchmark_work(void* p)
+{
+	sm_benchmark_worker_t* w = (sm_benchmark_worker_t*)p;
+
+	while (sm_benchmark_now() < w->deadline)
+	{
+		if (w->bulk) w->generator->bulk(w->state, w->buffer, SM_BENCHMARK_CHUNK);
+		else w->sink ^= w->generator->scalar(w->state, SM_BENCHMARK_CHUNK);
+
+		w->values += SM_BENCHMARK_CHUNK;
+	}
+}
+
+
+// Measures generator g on the given count of threads, the calling thread included, and gets the wall time per value in
+// nanoseconds across all threads. Returns 0 if the threads could not be set up.
+static uint8_t sm_benchmark_measure(sm_t sm, const sm_benchmark_generator_t* g, uint8_t bulk, uint32_t threads, double* ns)
+{
+	sm_benchmark_worker_t* w = (sm_benchmark_worker_t*)calloc(threads, sizeof(sm_benchmark_worker_t));
+	register uint32_t i, started = 1;
+	register uint64_t start, values = 0;
+	register uint8_t rc = 0;
+
+	if (!w) return 0;
+
+	for (i = 0; i < threads; ++i)
+	{
+		w[i].generator = g;
+		w[i].bulk = bulk;
+		w[i].state = malloc(g->state);
+		w[i].buffer = (uint64_t*)malloc(SM_BENCHMARK_CHUNK * sizeof(uint64_t));
+
+		if (!w[i].state || !w[i].buffer) goto end;
+
+		g->seed(sm, w[i].state, sm_benchmark_seed(i)); // Seeded ahead, as seeding is not measured.
+	}
+
+	start = sm_benchmark_now();
+
+	for (i = 0; i < threads; ++i)
+		w[i].deadline = start + SM_BENCHMARK_DURATION;
+
+	for (; started < threads; ++started)
+		if (!sm_thread_create(&w[started].thread, sm_benchmark_work, &w[started])) break;
+
+	sm_benchmark_work(&w[0]);
+
+	for (i = 1; i < started; ++i)
+		(void)sm_thread_join(&w[i].thread);
+
+	start = sm_benchmark_now() - start;
+
+	for (i = 0; i < started; ++i)
+		values += w[i].values;
+
+	if (values)
+	{
+		*ns = ((double)start * 1000.0) / (double)values;
+		rc = 1;
+	}
+
+end:
+	for (i = 0; i < threads; ++i)
+	{
+		free(w[i].state);
+		free(w[i].buffer);
+	}
+
+	free(w);
+
+	return rc;
+}
+
+
+// Gets the p-value of the monobit and runs tests of count values at v. Bits are taken least significant first.
+static void sm_benchmark_test_bits(const uint64_t* v, size_t count, double* monobit, double* runs)
+{
+	register uint64_t ones = 0, changes = 0, last = v[0] & 1;
+	register size_t i;
+	register const double n = (double)count * 64.0;
+
+	for (i = 0; i < count; ++i)
+	{
+		ones += sm_bit_count_64(v[i]);
+		changes += sm_bit_count_64((v[i] ^ (v[i] >> 1)) & UINT64_C(0x7FFFFFFFFFFFFFFF)) + ((v[i] & 1) ^ last);
+		last = v[i] >> 63;
+	}
+
+	*monobit = erfc(fabs((2.0 * (double)ones) - n) / sqrt(2.0 * n));
+
+	register const double pi = (double)ones / n;
+
+	if (fabs(pi - 0.5) >= 2.0 / sqrt(n)) // Too unbalanced for the runs test to apply.
+	{
+		*runs = 0.0;
+		return;
+	}
+
+	*runs = erfc(fabs((double)(changes + 1) - (2.0 * n * pi * (1.0 - pi))) / (2.0 * sqrt(2.0 * n) * pi * (1.0 - pi)));
+}
+
+
+// Orders 32-bit values for qsort.
+static int sm_benchmark_compare_32(const void* a, const void* b)
+{
+	register const uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+
+// Gets the p-value of the birthday spacings test of the given generator state. The birthdays are the upper 32 bits of
+// each value, which is where lattice structure, as of multiplicative generators, shows.
+static double sm_benchmark_test_birthdays(const sm_benchmark_generator_t* g, void* s, uint64_t* v, uint32_t* days)
+{
+	register uint32_t i, j;
+	register uint64_t repeats = 0;
+
+	for (j = 0; j < SM_BENCHMARK_BIRTHDAY_SAMPLES; ++j)
+	{
+		g->bulk(s, v, SM_BENCHMARK_BIRTHDAYS);
+
+		for (i = 0; i < SM_BENCHMARK_BIRTHDAYS; ++i)
+			days[i] = (uint32_t)(v[i] >> 32);
+
+		qsort(days, SM_BENCHMARK_BIRTHDAYS, sizeof(uint32_t), sm_benchmark_compare_32);
+
+		for (i = SM_BENCHMARK_BIRTHDAYS - 1; i > 0; --i) // Spacings, in place.
+			days[i] -= days[i - 1];
+
+		qsort(days, SM_BENCHMARK_BIRTHDAYS, sizeof(uint32_t), sm_benchmark_compare_32);
+
+		for (i = 1; i < SM_BENCHMARK_BIRTHDAYS; ++i)
+			repeats += (days[i] == days[i - 1]);
+	}
+
+	register const double mean = (double)SM_BENCHMARK_BIRTHDAYS * SM_BENCHMARK_BIRTHDAYS * SM_BENCHMARK_BIRTHDAYS / (4.0 * 4294967296.0) * SM_BENCHMARK_BIRTHDAY_SAMPLES;
+
+	return erfc(fabs((double)repeats - mean) / sqrt(2.0 * mean)); // Poisson, approximated as normal.
+}
+
+
+// Gets the linear complexity of the n bits at b (one per byte) by the Berlekamp-Massey algorithm. c, p and t are scratch
+// of n bytes each.
+static uint32_t sm_benchmark_linear_complexity(const uint8_t* b, uint32_t n, uint8_t* c, uint8_t* p, uint8_t* t)
+{
+	register uint32_t i, k, q, l = 0, m = 0;
+	register uint8_t d;
+
+	memset(c, 0, n);
+	memset(p, 0, n);
+	c[0] = p[0] = 1;
+
+	for (k = 0; k < n; ++k)
+	{
+		d = b[k];
+
+		for (i = 1; i <= l; ++i)
+			d ^= c[i] & b[k - i];
+
+		if (!d) continue;
+
+		memcpy(t, c, n);
+
+		q = k + 1 - m; // The distance from the last length change, m being one past it.
+
+		for (i = 0; i + q < n; ++i)
+			c[i + q] ^= p[i];
+
+		if (l <= k / 2)
+		{
+			l = k + 1 - l;
+			m = k + 1;
+			memcpy(p, t, n);
+		}
+	}
+
+	return l;
+}
+
+
+// Gets the p-value of the linear complexity test of the given generator state. The bits are the least significant bit of
+// each value, where generators built on linear recurrences are weakest.
+static double sm_benchmark_test_linear(const sm_benchmark_generator_t* g, void* s, uint64_t* v, uint8_t* b)
+{
+	static const double pi[7] = { 0.010417, 0.03125, 0.125, 0.5, 0.25, 0.0625, 0.020833 };
+	uint32_t classes[7] = { 0 };
+	register uint32_t i, j;
+	register double x = 0.0, e;
+
+	register const double mean = (SM_BENCHMARK_LINEAR_BITS / 2.0) + (8.0 / 36.0) - (((SM_BENCHMARK_LINEAR_BITS / 3.0) + (2.0 / 9.0)) / pow(2.0, SM_BENCHMARK_LINEAR_BITS)); // For even lengths.
+
+	for (j = 0; j < SM_BENCHMARK_LINEAR_BLOCKS; ++j)
+	{
+		g->bulk(s, v, SM_BENCHMARK_LINEAR_BITS);
+
+		for (i = 0; i < SM_BENCHMARK_LINEAR_BITS; ++i)
+			b[i] = (uint8_t)(v[i] & 1);
+
+		register const double t = (double)sm_benchmark_linear_complexity(b, SM_BENCHMARK_LINEAR_BITS, b + SM_BENCHMARK_LINEAR_BITS, b + (SM_BENCHMARK_LINEAR_BITS * 2), b + (SM_BENCHMARK_LINEAR_BITS * 3)) - mean + (2.0 / 9.0);
+
+		if (t <= -2.5) classes[0]++;
+		else if (t <= -1.5) classes[1]++;
+		else if (t <= -0.5) classes[2]++;
+		else if (t <= 0.5) classes[3]++;
+		else if (t <= 1.5) classes[4]++;
+		else if (t <= 2.5) classes[5]++;
+		else classes[6]++;
+	}
+
+	for (i = 0; i < 7; ++i)
+	{
+		e = SM_BENCHMARK_LINEAR_BLOCKS * pi[i];
+		x += (((double)classes[i] - e) * ((double)classes[i] - e)) / e;
+	}
+
+	x /= 2.0;
+
+	return exp(-x) * (1.0 + x + ((x * x) / 2.0)); // Q(3, x), the chi-square tail of 6 degrees of freedom, in closed form.
+}
+
+
+// Writes a p-value, marked if it fails. Returns 1 if it fails.
+inline static uint32_t sm_benchmark_report_p(FILE* out, double p)
+{
+	fprintf(out, "  %9.6f%s", p, (p < SM_BENCHMARK_ALPHA) ? "!" : " ");
+	return p < SM_BENCHMARK_ALPHA;
+}
+
+
+// Measures every built-in generator and runs the smoke tests on each.
+exported uint32_t callconv sm_benchmark_random(FILE* out, uint32_t threads)
+{
+	register const size_t generators = sizeof(sm_benchmark_generators) / sizeof(sm_benchmark_generators[0]);
+	register uint32_t failed = 0, t;
+	register size_t i;
+	double scalar, bulk;
+
+	if (!out) return 0;
+
+	if (!threads) threads = sm_thread_processors();
+
+	sm_t sm = sm_create(0x10000);
+
+	uint64_t* v = (uint64_t*)malloc(SM_BENCHMARK_BITS_VALUES * sizeof(uint64_t));
+	uint8_t* scratch = (uint8_t*)malloc(sm_max((size_t)SM_BENCHMARK_BIRTHDAYS * sizeof(uint32_t), (size_t)SM_BENCHMARK_LINEAR_BITS * 4));
+	size_t largest = 0;
+
+	for (i = 0; i < generators; ++i)
+		largest = sm_max(largest, sm_benchmark_generators[i].state);
+
+	void* s = malloc(largest);
+
+	if (!sm || !v || !scratch || !s)
+	{
+		fprintf(out, "Out of memory.\n");
+		failed = 1;
+		goto end;
+	}
+
+	fprintf(out, "Throughput, %.2f s per measurement, values are 64 bits.\n\n", SM_BENCHMARK_DURATION / 1000000.0);
+	fprintf(out, "%-22s %7s  %15s %11s  %15s %11s\n", "generator", "threads", "scalar ns/value", "scalar GB/s", "bulk ns/value", "bulk GB/s");
+
+	for (i = 0; i < generators; ++i)
+	{
+		for (t = 1;; t = sm_min(t * 2, threads))
+		{
+			if (!sm_benchmark_measure(sm, &sm_benchmark_generators[i], 0, t, &scalar) || !sm_benchmark_measure(sm, &sm_benchmark_generators[i], 1, t, &bulk))
+			{
+				fprintf(out, "%-22s %7u  could not start threads\n", sm_benchmark_generators[i].name, t);
+				break;
+			}
+
+			fprintf(out, "%-22s %7u  %15.3f %11.3f  %15.3f %11.3f\n", (t == 1) ? sm_benchmark_generators[i].name : "", t, scalar, 8.0 / scalar, bulk, 8.0 / bulk);
+			fflush(out);
+
+			if (t >= threads) break;
+		}
+	}
+
+	fprintf(out, "\nQuality, p-values, ! marks p < %g.\n\n", SM_BENCHMARK_ALPHA);
+	fprintf(out, "%-22s  %10s  %10s  %10s  %10s\n", "generator", "monobit", "runs", "birthday", "linear");
+
+	for (i = 0; i < generators; ++i)
+	{
+		register const sm_benchmark_generator_t* g = &sm_benchmark_generators[i];
+		double monobit, runs;
+
+		g->seed(sm, s, sm_benchmark_seed(0));
+		g->bulk(s, v, SM_BENCHMARK_BITS_VALUES);
+
+		sm_benchmark_test_bits(v, SM_BENCHMARK_BITS_VALUES, &monobit, &runs);
+
+		fprintf(out, "%-22s", g->name);
+		failed += sm_benchmark_report_p(out, monobit);
+		failed += sm_benchmark_report_p(out, runs);
+		failed += sm_benchmark_report_p(out, sm_benchmark_test_birthdays(g, s, v, (uint32_t*)scratch));
+		failed += sm_benchmark_report_p(out, sm_benchmark_test_linear(g, s, v, scratch));
+		fprintf(out, "\n");
+		fflush(out);
+	}
+
+end:
+	free(s);
+	free(scratch);
+	free(v);
+
+	if (sm) sm_destroy(sm);
+
+	return failed;
+}
@@ -0,0 +1,31 @@
+// benchmark.h - Random number generator throughput benchmark and statistical smoke tests.
+
+
+#include <stdio.h>
+
+
+#include "config.h"
+
+
+#ifndef INCLUDE_BENCHMARK_H
+#define INCLUDE_BENCHMARK_H 1
+
+
+// The wall time, in microseconds, of each throughput measurement.
+#define SM_BENCHMARK_DURATION 250000U
+
+// The count of 64-bit values generated between clock reads, and the size of each bulk request.
+#define SM_BENCHMARK_CHUNK 0x2000U
+
+// Test results with a p-value below this are reported as failures.
+#define SM_BENCHMARK_ALPHA 0.0001
+
+
+// Measures every built-in generator, one value per call (scalar) and a chunk per call (bulk), on 1, 2, 4 .. up to the
+// given count of threads, zero for one per processor, and writes ns/value and GB/s for each to out. Then runs monobit,
+// runs, birthday spacings and linear complexity smoke tests on each generator's output and writes their p-values. Returns
+// the count of failed tests.
+exported uint32_t callconv sm_benchmark_random(FILE* out, uint32_t threads);
+
+
+#endif // INCLUDE_BENCHMARK_H
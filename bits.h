@@ -41,6 +41,24 @@ inline static uint8_t sm_rotr_8(register uint8_t n, register uint8_t c)
 }
 
 
+// 32-bit cyclic rotate bits left.
+inline static uint32_t sm_rotl_32(register uint32_t n, register uint32_t c)
+{
+	const uint32_t mask = (CHAR_BIT * sizeof(n) - 1);
+	c &= mask;
+	return (n << c) | (n >> ((-c) & mask));
+}
+
+
+// 32-bit cyclic rotate bits right.
+inline static uint32_t sm_rotr_32(register uint32_t n, register uint32_t c)
+{
+	const uint32_t mask = (CHAR_BIT * sizeof(n) - 1);
+	c &= mask;
+	return (n >> c) | (n << ((-c) & mask));
+}
+
+
 // 64-bit cyclic rotate bits left.
 inline static uint64_t sm_rotl_64(register uint64_t n, register uint64_t c)
 {
@@ -213,6 +231,16 @@ inline static uint64_t sm_swap_64(register uint64_t v)
 }
 
 
+// Reverse bits, 64-bit.
+inline static uint64_t sm_reverse_64(register uint64_t v)
+{
+	v = ((v >> 1) & UINT64_C(0x5555555555555555)) | ((v & UINT64_C(0x5555555555555555)) << 1);
+	v = ((v >> 2) & UINT64_C(0x3333333333333333)) | ((v & UINT64_C(0x3333333333333333)) << 2);
+	v = ((v >> 4) & UINT64_C(0x0F0F0F0F0F0F0F0F)) | ((v & UINT64_C(0x0F0F0F0F0F0F0F0F)) << 4);
+	return sm_swap_64(v);
+}
+
+
 inline static uint64_t sm_next_even_64(register uint64_t v) { return (v | UINT64_C(1)) + UINT64_C(1); }
 inline static uint64_t sm_prev_even_64(register uint64_t v) { return (v - UINT64_C(1)) & ~UINT64_C(1); }
 inline static uint64_t sm_next_odd_64(register uint64_t v) { return (v + UINT64_C(1)) | UINT64_C(1); }
@@ -249,5 +277,31 @@ inline static uint64_t sm_average_64(register uint64_t x, register uint64_t y)
 }
 
 
+
+// Multiplies x by y, returning the low 64 bits of the product and storing the high 64 bits in *h.
+inline static uint64_t sm_multiply_128(register uint64_t x, register uint64_t y, uint64_t* h)
+{
+#if defined(SM_OS_WINDOWS)
+	return _umul128(x, y, h);
+#else
+	register const unsigned __int128 p = (unsigned __int128)x * y;
+	*h = (uint64_t)(p >> 64);
+	return (uint64_t)p;
+#endif
+}
+
+
+// Gets the count of trailing zero bits of v, which must not be zero.
+inline static uint32_t sm_ctz_64(register uint64_t v)
+{
+#if defined(SM_OS_WINDOWS)
+	unsigned long i;
+	_BitScanForward64(&i, v);
+	return (uint32_t)i;
+#else
+	return (uint32_t)__builtin_ctzll(v);
+#endif
+}
+
 #endif // INCLUDE_BITS_H
 
@@ -0,0 +1,451 @@
+// chacha.c - ChaCha20 keystream generator.
+
+
+#include <string.h>
+
+
+#if defined(SM_OS_WINDOWS)
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
+
+
+#include "config.h"
+#include "sm.h"
+#include "sm_internal.h"
+#include "bits.h"
+#include "cpu.h"
+#include "entropy.h"
+#include "fork.h"
+#include "chacha.h"
+
+
+// The count of bytes each thread buffers.
+#define SM_CHACHA_BUFFER (SM_CHACHA_BLOCK * SM_CHACHA_BUFFER_BLOCKS)
+
+
+// Per-thread generator state.
+typedef struct sm_chacha_thread_s
+{
+	sm_context_t* context; // The context the key was drawn for.
+	uint64_t epoch; // The stream epoch of that context when the key was drawn.
+	uint64_t process; // The fork generation when the key was drawn.
+	uint8_t keyed; // Whether key holds a key.
+	uint32_t used; // The count of bytes of buffer consumed.
+	uint32_t key[8]; // The key for the next refill.
+	uint8_t buffer[SM_CHACHA_BUFFER]; // Buffered keystream. Consumed bytes are zeroed.
+}
+sm_chacha_thread_t;
+
+
+// The calling thread's generator.
+static tlocal sm_chacha_thread_t sm_chacha_thread__;
+
+
+// A kernel generating the given count of blocks at out, for a multiple of its width.
+typedef void (*sm_chacha_kernel_f)(const uint32_t state[16], uint8_t* out, size_t blocks);
+
+
+// ChaCha quarter round on scalar words.
+#define sm_chacha_quarter(A, B, C, D) \
+	A += B; D ^= A; D = sm_rotl_32(D, 16); \
+	C += D; B ^= C; B = sm_rotl_32(B, 12); \
+	A += B; D ^= A; D = sm_rotl_32(D, 8); \
+	C += D; B ^= C; B = sm_rotl_32(B, 7);
+
+
+// Stores a 32-bit word little-endian.
+inline static void sm_chacha_store_32(uint8_t* p, uint32_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+
+// Portable kernel, one block at a time.
+static void sm_chacha_blocks_scalar(const uint32_t state[16], uint8_t* out, size_t blocks)
+{
+	register uint32_t i;
+	uint32_t x[16], in[16];
+
+	memcpy(in, state, sizeof(in));
+
+	for (; blocks > 0; --blocks, out += SM_CHACHA_BLOCK)
+	{
+		memcpy(x, in, sizeof(x));
+
+		for (i = 0; i < SM_CHACHA_ROUNDS; i += 2)
+		{
+			sm_chacha_quarter(x[0], x[4], x[8], x[12]);
+			sm_chacha_quarter(x[1], x[5], x[9], x[13]);
+			sm_chacha_quarter(x[2], x[6], x[10], x[14]);
+			sm_chacha_quarter(x[3], x[7], x[11], x[15]);
+			sm_chacha_quarter(x[0], x[5], x[10], x[15]);
+			sm_chacha_quarter(x[1], x[6], x[11], x[12]);
+			sm_chacha_quarter(x[2], x[7], x[8], x[13]);
+			sm_chacha_quarter(x[3], x[4], x[9], x[14]);
+		}
+
+		for (i = 0; i < 16; ++i)
+			sm_chacha_store_32(out + (i * 4), x[i] + in[i]);
+
+		if (++in[12] == 0) ++in[13]; // 64-bit block counter.
+	}
+
+	memset(x, 0, sizeof(x));
+	memset(in, 0, sizeof(in));
+}
+
+
+#if defined(SM_CPU_AMD) || defined(SM_CPU_INTEL)
+
+
+// ChaCha quarter round on vectors of words, one block per element.
+#define sm_chacha_quarter_128(A, B, C, D) \
+	A = _mm_add_epi32(A, B); D = _mm_xor_si128(D, A); D = _mm_or_si128(_mm_slli_epi32(D, 16), _mm_srli_epi32(D, 16)); \
+	C = _mm_add_epi32(C, D); B = _mm_xor_si128(B, C); B = _mm_or_si128(_mm_slli_epi32(B, 12), _mm_srli_epi32(B, 20)); \
+	A = _mm_add_epi32(A, B); D = _mm_xor_si128(D, A); D = _mm_or_si128(_mm_slli_epi32(D, 8), _mm_srli_epi32(D, 24)); \
+	C = _mm_add_epi32(C, D); B = _mm_xor_si128(B, C); B = _mm_or_si128(_mm_slli_epi32(B, 7), _mm_srli_epi32(B, 25));
+
+
+// ChaCha double round on the named vector words x0 .. x15, using the given quarter round.
+#define sm_chacha_double(Q) \
+	Q(x0, x4, x8, x12); Q(x1, x5, x9, x13); Q(x2, x6, x10, x14); Q(x3, x7, x11, x15); \
+	Q(x0, x5, x10, x15); Q(x1, x6, x11, x12); Q(x2, x7, x8, x13); Q(x3, x4, x9, x14);
+
+
+// Adds the input to words 4G .. 4G + 3 of four blocks held in A, B, C and D, and stores them at out in block order.
+#define sm_chacha_store_128(G, A, B, C, D) \
+{ \
+	const __m128i a = _mm_add_epi32(A, _mm_set1_epi32((int)state[(G) * 4 + 0])); \
+	const __m128i b = _mm_add_epi32(B, _mm_set1_epi32((int)state[(G) * 4 + 1])); \
+	const __m128i c = _mm_add_epi32(C, _mm_set1_epi32((int)state[(G) * 4 + 2])); \
+	const __m128i d = _mm_add_epi32(D, _mm_set1_epi32((int)state[(G) * 4 + 3])); \
+	const __m128i t0 = _mm_unpacklo_epi32(a, b), t1 = _mm_unpacklo_epi32(c, d); \
+	const __m128i t2 = _mm_unpackhi_epi32(a, b), t3 = _mm_unpackhi_epi32(c, d); \
+	_mm_storeu_si128((__m128i*)(out + (SM_CHACHA_BLOCK * 0) + ((G) * 16)), _mm_unpacklo_epi64(t0, t1)); \
+	_mm_storeu_si128((__m128i*)(out + (SM_CHACHA_BLOCK * 1) + ((G) * 16)), _mm_unpackhi_epi64(t0, t1)); \
+	_mm_storeu_si128((__m128i*)(out + (SM_CHACHA_BLOCK * 2) + ((G) * 16)), _mm_unpacklo_epi64(t2, t3)); \
+	_mm_storeu_si128((__m128i*)(out + (SM_CHACHA_BLOCK * 3) + ((G) * 16)), _mm_unpackhi_epi64(t2, t3)); \
+}
+
+
+// SSE2 kernel, four blocks at a time. Vector xi holds word i of each of the four blocks.
+sm_target("sse2") static void sm_chacha_blocks_sse2(const uint32_t state[16], uint8_t* out, size_t blocks)
+{
+	register uint32_t i;
+	uint64_t counter = ((uint64_t)state[13] << 32) | state[12];
+
+	for (; blocks >= 4; blocks -= 4, out += SM_CHACHA_BLOCK * 4, counter += 4)
+	{
+		const __m128i c12 = _mm_setr_epi32((int)(uint32_t)counter, (int)(uint32_t)(counter + 1), (int)(uint32_t)(counter + 2), (int)(uint32_t)(counter + 3));
+		const __m128i c13 = _mm_setr_epi32((int)(uint32_t)(counter >> 32), (int)(uint32_t)((counter + 1) >> 32), (int)(uint32_t)((counter + 2) >> 32), (int)(uint32_t)((counter + 3) >> 32));
+
+		__m128i x0 = _mm_set1_epi32((int)state[0]), x1 = _mm_set1_epi32((int)state[1]), x2 = _mm_set1_epi32((int)state[2]), x3 = _mm_set1_epi32((int)state[3]);
+		__m128i x4 = _mm_set1_epi32((int)state[4]), x5 = _mm_set1_epi32((int)state[5]), x6 = _mm_set1_epi32((int)state[6]), x7 = _mm_set1_epi32((int)state[7]);
+		__m128i x8 = _mm_set1_epi32((int)state[8]), x9 = _mm_set1_epi32((int)state[9]), x10 = _mm_set1_epi32((int)state[10]), x11 = _mm_set1_epi32((int)state[11]);
+		__m128i x12 = c12, x13 = c13, x14 = _mm_set1_epi32((int)state[14]), x15 = _mm_set1_epi32((int)state[15]);
+
+		for (i = 0; i < SM_CHACHA_ROUNDS; i += 2)
+		{
+			sm_chacha_double(sm_chacha_quarter_128);
+		}
+
+		sm_chacha_store_128(0, x0, x1, x2, x3);
+		sm_chacha_store_128(1, x4, x5, x6, x7);
+		sm_chacha_store_128(2, x8, x9, x10, x11);
+		sm_chacha_store_128(3, _mm_sub_epi32(_mm_add_epi32(x12, c12), _mm_set1_epi32((int)state[12])), _mm_sub_epi32(_mm_add_epi32(x13, c13), _mm_set1_epi32((int)state[13])), x14, x15);
+	}
+}
+
+
+// ChaCha quarter round on 256-bit vectors of words. Rotations by whole bytes are done as byte shuffles.
+#define sm_chacha_quarter_256(A, B, C, D) \
+	A = _mm256_add_epi32(A, B); D = _mm256_xor_si256(D, A); D = _mm256_shuffle_epi8(D, r16); \
+	C = _mm256_add_epi32(C, D); B = _mm256_xor_si256(B, C); B = _mm256_or_si256(_mm256_slli_epi32(B, 12), _mm256_srli_epi32(B, 20)); \
+	A = _mm256_add_epi32(A, B); D = _mm256_xor_si256(D, A); D = _mm256_shuffle_epi8(D, r8); \
+	C = _mm256_add_epi32(C, D); B = _mm256_xor_si256(B, C); B = _mm256_or_si256(_mm256_slli_epi32(B, 7), _mm256_srli_epi32(B, 25));
+
+
+// Adds the input to words 4G .. 4G + 3 of eight blocks held in A, B, C and D, and transposes them within the 128-bit
+// halves: R0 .. R3 then hold those words of blocks 0 .. 3 in their low halves, and of blocks 4 .. 7 in their high halves.
+#define sm_chacha_transpose_256(G, A, B, C, D, R0, R1, R2, R3) \
+{ \
+	const __m256i a = _mm256_add_epi32(A, _mm256_set1_epi32((int)state[(G) * 4 + 0])); \
+	const __m256i b = _mm256_add_epi32(B, _mm256_set1_epi32((int)state[(G) * 4 + 1])); \
+	const __m256i c = _mm256_add_epi32(C, _mm256_set1_epi32((int)state[(G) * 4 + 2])); \
+	const __m256i d = _mm256_add_epi32(D, _mm256_set1_epi32((int)state[(G) * 4 + 3])); \
+	const __m256i t0 = _mm256_unpacklo_epi32(a, b), t1 = _mm256_unpacklo_epi32(c, d); \
+	const __m256i t2 = _mm256_unpackhi_epi32(a, b), t3 = _mm256_unpackhi_epi32(c, d); \
+	R0 = _mm256_unpacklo_epi64(t0, t1); \
+	R1 = _mm256_unpackhi_epi64(t0, t1); \
+	R2 = _mm256_unpacklo_epi64(t2, t3); \
+	R3 = _mm256_unpackhi_epi64(t2, t3); \
+}
+
+
+// Stores 32 bytes of block K and of block K + 4 at byte offset O, from the halves of two transposed groups.
+#define sm_chacha_store_256(K, O, L, H) \
+	_mm256_storeu_si256((__m256i*)(out + (SM_CHACHA_BLOCK * (K)) + (O)), _mm256_permute2x128_si256(L, H, 0x20)); \
+	_mm256_storeu_si256((__m256i*)(out + (SM_CHACHA_BLOCK * ((K) + 4)) + (O)), _mm256_permute2x128_si256(L, H, 0x31));
+
+
+// AVX2 kernel, eight blocks at a time. Vector xi holds word i of each of the eight blocks.
+sm_target("avx2") static void sm_chacha_blocks_avx2(const uint32_t state[16], uint8_t* out, size_t blocks)
+{
+	register uint32_t i, k;
+	uint64_t counter = ((uint64_t)state[13] << 32) | state[12];
+	uint32_t lo[8], hi[8];
+
+	const __m256i r16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13, 2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+	const __m256i r8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14, 3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+
+	for (; blocks >= 8; blocks -= 8, out += SM_CHACHA_BLOCK * 8, counter += 8)
+	{
+		for (k = 0; k < 8; ++k)
+			lo[k] = (uint32_t)(counter + k), hi[k] = (uint32_t)((counter + k) >> 32);
+
+		const __m256i c12 = _mm256_loadu_si256((const __m256i*)lo);
+		const __m256i c13 = _mm256_loadu_si256((const __m256i*)hi);
+
+		__m256i x0 = _mm256_set1_epi32((int)state[0]), x1 = _mm256_set1_epi32((int)state[1]), x2 = _mm256_set1_epi32((int)state[2]), x3 = _mm256_set1_epi32((int)state[3]);
+		__m256i x4 = _mm256_set1_epi32((int)state[4]), x5 = _mm256_set1_epi32((int)state[5]), x6 = _mm256_set1_epi32((int)state[6]), x7 = _mm256_set1_epi32((int)state[7]);
+		__m256i x8 = _mm256_set1_epi32((int)state[8]), x9 = _mm256_set1_epi32((int)state[9]), x10 = _mm256_set1_epi32((int)state[10]), x11 = _mm256_set1_epi32((int)state[11]);
+		__m256i x12 = c12, x13 = c13, x14 = _mm256_set1_epi32((int)state[14]), x15 = _mm256_set1_epi32((int)state[15]);
+		__m256i a0, a1, a2, a3, b0, b1, b2, b3;
+
+		for (i = 0; i < SM_CHACHA_ROUNDS; i += 2)
+		{
+			sm_chacha_double(sm_chacha_quarter_256);
+		}
+
+		x12 = _mm256_sub_epi32(_mm256_add_epi32(x12, c12), _mm256_set1_epi32((int)state[12])); // The transpose adds the
+		x13 = _mm256_sub_epi32(_mm256_add_epi32(x13, c13), _mm256_set1_epi32((int)state[13])); // broadcast input.
+
+		sm_chacha_transpose_256(0, x0, x1, x2, x3, a0, a1, a2, a3);
+		sm_chacha_transpose_256(1, x4, x5, x6, x7, b0, b1, b2, b3);
+
+		sm_chacha_store_256(0, 0, a0, b0);
+		sm_chacha_store_256(1, 0, a1, b1);
+		sm_chacha_store_256(2, 0, a2, b2);
+		sm_chacha_store_256(3, 0, a3, b3);
+
+		sm_chacha_transpose_256(2, x8, x9, x10, x11, a0, a1, a2, a3);
+		sm_chacha_transpose_256(3, x12, x13, x14, x15, b0, b1, b2, b3);
+
+		sm_chacha_store_256(0, 32, a0, b0);
+		sm_chacha_store_256(1, 32, a1, b1);
+		sm_chacha_store_256(2, 32, a2, b2);
+		sm_chacha_store_256(3, 32, a3, b3);
+	}
+
+	memset(lo, 0, sizeof(lo));
+	memset(hi, 0, sizeof(hi));
+}
+
+
+#endif
+
+
+// Generates the given count of keystream blocks at out, using the widest kernel the processor supports.
+exported void callconv sm_chacha_blocks(const uint32_t state[16], uint8_t* out, size_t blocks)
+{
+	static volatile uint32_t features = 0;
+
+	if (!state || !out || !blocks) return;
+
+	uint32_t in[16];
+	register size_t n;
+
+	memcpy(in, state, sizeof(in));
+
+	if (!features) features = sm_cpu_features();
+
+#if defined(SM_CPU_AMD) || defined(SM_CPU_INTEL)
+	static const struct { uint32_t feature; uint32_t width; sm_chacha_kernel_f kernel; } kernels[2] =
+	{
+		{ SM_CPU_AVX2, 8, sm_chacha_blocks_avx2 },
+		{ SM_CPU_SSE2, 4, sm_chacha_blocks_sse2 }
+	};
+
+	register uint32_t i;
+
+	for (i = 0; i < 2; ++i)
+	{
+		if (!(features & kernels[i].feature) || blocks < kernels[i].width) continue;
+
+		n = blocks - (blocks % kernels[i].width);
+		kernels[i].kernel(in, out, n);
+
+		register const uint64_t counter = (((uint64_t)in[13] << 32) | in[12]) + n;
+		in[12] = (uint32_t)counter, in[13] = (uint32_t)(counter >> 32);
+
+		out += n * SM_CHACHA_BLOCK;
+		blocks -= n;
+	}
+#endif
+
+	if (blocks) sm_chacha_blocks_scalar(in, out, blocks);
+
+	memset(in, 0, sizeof(in));
+}
+
+
+// Sets up the input state for the given key, with a zero counter and nonce.
+inline static void sm_chacha_state(uint32_t state[16], const uint32_t key[8])
+{
+	state[0] = UINT32_C(0x61707865); // "expand 32-byte k".
+	state[1] = UINT32_C(0x3320646E);
+	state[2] = UINT32_C(0x79622D32);
+	state[3] = UINT32_C(0x6B206574);
+
+	memcpy(&state[4], key, sizeof(uint32_t) * 8);
+
+	state[12] = state[13] = state[14] = state[15] = 0;
+}
+
+
+// Draws a new key for the calling thread when it has none, when the context has since started a new generation, or when
+// the process has forked since.
+inline static void sm_chacha_key(sm_chacha_thread_t* t, sm_context_t* context)
+{
+	if (context && !context->random.initialized)
+		(void)sm_random((sm_t)context); // Initialize the master, and its epoch.
+
+	register const uint64_t epoch = context ? context->random.streams.epoch : 0;
+	register const uint64_t process = sm_fork_generation();
+
+	if (t->keyed && t->context == context && t->epoch == epoch && t->process == process) return;
+
+	register uint32_t i;
+	uint32_t k[8];
+
+	(void)sm_entropy_read(k, sizeof(k));
+
+	for (i = 0; i < 8; i += 2) // Mix in the master, in case the pool had to fall back.
+	{
+		register const uint64_t v = sm_random((sm_t)context);
+		t->key[i] = k[i] ^ (uint32_t)v;
+		t->key[i + 1] = k[i + 1] ^ (uint32_t)(v >> 32);
+	}
+
+	memset(k, 0, sizeof(k));
+	memset(t->buffer, 0, sizeof(t->buffer));
+
+	t->context = context;
+	t->epoch = epoch;
+	t->process = process;
+	t->used = SM_CHACHA_BUFFER; // Empty.
+	t->keyed = 1;
+}
+
+
+// Refills the calling thread's buffer. The first 32 bytes of the new keystream replace the key and are erased at once.
+inline static void sm_chacha_refill(sm_chacha_thread_t* t)
+{
+	uint32_t state[16];
+
+	sm_chacha_state(state, t->key);
+	sm_chacha_blocks(state, t->buffer, SM_CHACHA_BUFFER_BLOCKS);
+	memset(state, 0, sizeof(state));
+
+	memcpy(t->key, t->buffer, sizeof(t->key));
+	memset(t->buffer, 0, sizeof(t->key));
+
+	t->used = sizeof(t->key);
+}
+
+
+// Copies n bytes from the calling thread's buffer to d, erasing them from the buffer, and refilling it as needed.
+inline static void sm_chacha_take(sm_chacha_thread_t* t, uint8_t* d, size_t n)
+{
+	register size_t k;
+
+	while (n > 0)
+	{
+		if (t->used == SM_CHACHA_BUFFER) sm_chacha_refill(t);
+
+		k = sm_min(n, (size_t)(SM_CHACHA_BUFFER - t->used));
+
+		memcpy(d, t->buffer + t->used, k);
+		memset(t->buffer + t->used, 0, k);
+
+		t->used += (uint32_t)k;
+		d += k;
+		n -= k;
+	}
+}
+
+
+// ChaCha20 random number generator.
+exported uint64_t callconv sm_random_chacha(sm_t sm)
+{
+	sm_chacha_thread_t* t = &sm_chacha_thread__;
+	uint64_t v;
+
+	sm_chacha_key(t, (sm_context_t*)sm);
+
+	if (t->used == SM_CHACHA_BUFFER) sm_chacha_refill(t); // Whole values only, as refills leave used a multiple of 8.
+	else if ((t->used & 7) != 0) // After an unaligned fill.
+	{
+		sm_chacha_take(t, (uint8_t*)&v, sizeof(v));
+		return v;
+	}
+
+	register uint64_t* w = (uint64_t*)(t->buffer + t->used);
+
+	v = *w;
+	*w = 0;
+	t->used += sizeof(uint64_t);
+
+	return v;
+}
+
+
+// Fills n bytes at p from the calling thread's ChaCha20 generator. Bulk output is generated in place under the current
+// key, after block zero has been set aside as the next key.
+exported void callconv sm_random_chacha_fill(sm_t sm, void* p, size_t n)
+{
+	if (!p || !n) return;
+
+	sm_chacha_thread_t* t = &sm_chacha_thread__;
+	register uint8_t* d = (uint8_t*)p;
+
+	sm_chacha_key(t, (sm_context_t*)sm);
+
+	register size_t k = sm_min(n, (size_t)(SM_CHACHA_BUFFER - t->used)); // Drain what is buffered first.
+
+	if (k)
+	{
+		sm_chacha_take(t, d, k);
+		d += k;
+		n -= k;
+	}
+
+	if (n >= SM_CHACHA_BUFFER)
+	{
+		register const size_t blocks = n / SM_CHACHA_BLOCK;
+		uint32_t state[16];
+		uint8_t next[SM_CHACHA_BLOCK];
+
+		sm_chacha_state(state, t->key);
+		sm_chacha_blocks(state, next, 1); // Block zero holds the next key.
+
+		state[12] = 1;
+		sm_chacha_blocks(state, d, blocks);
+
+		memcpy(t->key, next, sizeof(t->key));
+
+		memset(state, 0, sizeof(state));
+		register volatile uint8_t* v = next;
+		for (k = 0; k < sizeof(next); ++k) v[k] = 0;
+
+		d += blocks * SM_CHACHA_BLOCK;
+		n -= blocks * SM_CHACHA_BLOCK;
+	}
+
+	sm_chacha_take(t, d, n);
+}
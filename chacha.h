@@ -0,0 +1,36 @@
+// chacha.h - ChaCha20 keystream generator.
+
+
+#include "config.h"
+#include "sm.h"
+
+
+#ifndef INCLUDE_CHACHA_H
+#define INCLUDE_CHACHA_H 1
+
+
+// The count of rounds per block.
+#define SM_CHACHA_ROUNDS 20U
+
+// The count of bytes per block.
+#define SM_CHACHA_BLOCK 64U
+
+// The count of blocks each thread buffers. The first 32 bytes of every refill become the thread's next key.
+#define SM_CHACHA_BUFFER_BLOCKS 16U
+
+
+// Generates the given count of keystream blocks at out from the 16-word input state: the constants, key, 64-bit block
+// counter in words 12 and 13, and nonce. The counter is incremented per block, but the state is left unchanged.
+exported void callconv sm_chacha_blocks(const uint32_t state[16], uint8_t* out, size_t blocks);
+
+// ChaCha20 random number generator, selectable as the context RNG method. Values come from a per-thread buffer refilled
+// with fast key erasure, so earlier output cannot be recovered from the thread's current state. The key is drawn from
+// the process entropy pool and the master, and redrawn whenever the master starts a new generation.
+exported uint64_t callconv sm_random_chacha(sm_t sm);
+
+// Fills n bytes at p from the calling thread's ChaCha20 generator. Large fills are written directly as keystream under a
+// key that is replaced before returning.
+exported void callconv sm_random_chacha_fill(sm_t sm, void* p, size_t n);
+
+
+#endif // INCLUDE_CHACHA_H
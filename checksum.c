@@ -0,0 +1,610 @@
+// checksum.c - Carry-less multiply folding CRC-32 and CRC-64.
+
+
+#include <string.h>
+
+
+#if defined(SM_OS_WINDOWS)
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
+
+
+#include "config.h"
+#include "sm.h"
+#include "sm_internal.h"
+#include "bits.h"
+#include "cpu.h"
+#include "thread.h"
+#include "checksum.h"
+
+
+// Folding works on the reflected polynomial directly: a 16-byte block loaded little-endian holds the high half of the
+// polynomial in its low 64 bits. Multiplying a block by x^d modulo P is two carry-less multiplies of its halves by
+// x^(d + 63) mod P and x^(d - 1) mod P, bit-reversed (the - 1 makes up for the one-bit shift of a reflected product). The
+// folded remainder is congruent to the input, so it is run through the table kernel as a 16-byte message to finish.
+// Constants are { 512-bit fold: x^575, x^511 }, { 128-bit fold: x^191, x^127 }.
+
+// CRC-64 (x^64 + 0xAD93D23594C935A9) folding constants.
+static const uint64_t sm_crc_64_k[4] = { UINT64_C(0xAF86EFB16D9AB4FB), UINT64_C(0xF49784A634F014E4), UINT64_C(0xD9D7BE7D505DA32C), UINT64_C(0x381D0015C96F4444) };
+
+// CRC-32 (x^32 + 0x04C11DB7) folding constants.
+static const uint64_t sm_crc_32_k[4] = { UINT64_C(0x653D982200000000), UINT64_C(0xCAD38E8F00000000), UINT64_C(0x65673B4600000000), UINT64_C(0x9BA54C6F00000000) };
+
+
+// CRC32C reflected polynomial.
+#define SM_CRC_32C_POLY UINT32_C(0x82F63B78)
+
+// Stream lengths of the hardware CRC32C kernel, which runs three streams of equal length at once, as the crc32
+// instruction has a latency of three cycles and a throughput of one. Long streams are used first, then short ones.
+#define SM_CRC_32C_LONG 1024U
+#define SM_CRC_32C_SHORT 128U
+
+// CRC32C stream shift constants, x^(8 * L - 33) mod P, reflected: { long L, long 2L, short L, short 2L }. A carry-less
+// product with one, reduced by the crc32 instruction, advances a stream's CRC past L bytes; the - 33 makes up for the
+// shift of a reflected product and the x^32 of the instruction.
+static const uint32_t sm_crc_32c_k[4] = { UINT32_C(0x170076FA), UINT32_C(0xA51B6135), UINT32_C(0x0D3B6092), UINT32_C(0xB9E02B86) };
+
+// CRC32C slice-by-8 table, built on the first software CRC32C.
+static uint32_t sm_crc_32c_tab[8][256];
+static volatile uint32_t sm_crc_32c_built = 0;
+
+// CRC-64 reflected polynomial.
+#define SM_CRC_64_POLY UINT64_C(0x95AC9329AC4BC9B5)
+
+// CRC-64 polynomial, and floor(x^128 / P), without their x^64 terms, for Barrett reduction.
+#define SM_CRC_64_NORMAL UINT64_C(0xAD93D23594C935A9)
+#define SM_CRC_64_MU UINT64_C(0xDDF3EEB298BE6CF8)
+
+// x^(2^k) modulo the CRC-64 polynomial, reflected, for k = 0 .. 63.
+static const uint64_t sm_crc_64_x2n[64] =
+{
+	UINT64_C(0x4000000000000000), UINT64_C(0x2000000000000000), UINT64_C(0x0800000000000000), UINT64_C(0x0080000000000000),
+	UINT64_C(0x0000800000000000), UINT64_C(0x0000000080000000), UINT64_C(0x95AC9329AC4BC9B5), UINT64_C(0x1C0E800AE4B7A222),
+	UINT64_C(0x779E8E8C76C44F69), UINT64_C(0x7A4BC2531A780A72), UINT64_C(0xAEED23808ADF3F30), UINT64_C(0x4A38D29C484AFF22),
+	UINT64_C(0x28BE1B2D6ABB38FB), UINT64_C(0xFF5C4E9B5134F1C5), UINT64_C(0x399F80EEF2E1D9C9), UINT64_C(0x99D0E73488B65B59),
+	UINT64_C(0x45CB7616FDF1D10B), UINT64_C(0xFE07899C8C654606), UINT64_C(0x7CB583CEC2A4933D), UINT64_C(0x61EBD40E2F02BE32),
+	UINT64_C(0xBDBB1F8C03F9B4D9), UINT64_C(0x0EDA49A9D1A3D260), UINT64_C(0xA1B4FDDBC5D66A23), UINT64_C(0xB0B612B4B38CADF0),
+	UINT64_C(0x4EE882D5CE88A44D), UINT64_C(0xC9008982AEA49A55), UINT64_C(0xC1B17E2058BC0186), UINT64_C(0xEE35E8D4CD88732F),
+	UINT64_C(0x8A2C6667240AEABD), UINT64_C(0x6851C93A305BACAE), UINT64_C(0x5FEB0E28A26E5219), UINT64_C(0xF81D22D5D2744A06),
+	UINT64_C(0x6B8C76508B524D09), UINT64_C(0x8DC938F25A307D7B), UINT64_C(0xF0D2082A57D20EE7), UINT64_C(0xFBA8DF1DB3220720),
+	UINT64_C(0x05BDF77687D4F696), UINT64_C(0xEF65CE910F59671B), UINT64_C(0x948A7D6843F17F4F), UINT64_C(0x2DFEBC657443AE4D),
+	UINT64_C(0x0EBA5073997EDCFE), UINT64_C(0x316FCB1DF40A8386), UINT64_C(0x512FCEC633C5B1FD), UINT64_C(0x7E44B3D8C2B30E0D),
+	UINT64_C(0x352332F19FF14778), UINT64_C(0x74D9B90F4536B81D), UINT64_C(0xD23C71DCDAB7BB34), UINT64_C(0x572860867FFAAB48),
+	UINT64_C(0x7FFA7F77AFD220CC), UINT64_C(0x3974D35667151E70), UINT64_C(0x0557CAF302AC85FF), UINT64_C(0xA765D66B90F99AB2),
+	UINT64_C(0xE4A018139C714D44), UINT64_C(0x444C661126BBB3D6), UINT64_C(0xF671339C1B4A0AF0), UINT64_C(0xF5B7BB3F793440A8),
+	UINT64_C(0x0AA4F0B7A4209960), UINT64_C(0x80BDC51CAD474F27), UINT64_C(0x91B7AA901D8C3165), UINT64_C(0xAAC8DB2A7E67FA73),
+	UINT64_C(0x393DD35D2AC17780), UINT64_C(0x4C2CDBE37F04580F), UINT64_C(0x05647800BC9BA299), UINT64_C(0xFADF7C93E6BDDF32)
+};
+
+
+// CRC-32 reflected polynomial.
+#define SM_CRC_32_POLY UINT32_C(0xEDB88320)
+
+// x^(2^k) modulo the CRC-32 polynomial, reflected, for k = 0 .. 31. These repeat with a period of 32.
+static const uint32_t sm_crc_32_x2n[32] =
+{
+	UINT32_C(0x40000000), UINT32_C(0x20000000), UINT32_C(0x08000000), UINT32_C(0x00800000), UINT32_C(0x00008000), UINT32_C(0xEDB88320), UINT32_C(0xB1E6B092), UINT32_C(0xA06A2517),
+	UINT32_C(0xED627DAE), UINT32_C(0x88D14467), UINT32_C(0xD7BBFE6A), UINT32_C(0xEC447F11), UINT32_C(0x8E7EA170), UINT32_C(0x6427800E), UINT32_C(0x4D47BAE0), UINT32_C(0x09FE548F),
+	UINT32_C(0x83852D0F), UINT32_C(0x30362F1A), UINT32_C(0x7B5A9CC3), UINT32_C(0x31FEC169), UINT32_C(0x9FEC022A), UINT32_C(0x6C8DEDC4), UINT32_C(0x15D6874D), UINT32_C(0x5FDE7A4E),
+	UINT32_C(0xBAD90E37), UINT32_C(0x2E4E5EEF), UINT32_C(0x4EABA214), UINT32_C(0xA8A472C0), UINT32_C(0x429A969E), UINT32_C(0x148D302A), UINT32_C(0xC40BA6D0), UINT32_C(0xC4E22C3C)
+};
+
+// Table CRC-64 of n bytes at p from c, without the final inversion, 16 bytes at a time.
+inline static uint64_t sm_crc_64_table(register uint64_t c, register const uint8_t* p, register uint64_t n, register const uint64_t (*tab)[256])
+{
+	uint64_t a, b;
+
+	for (; n >= 16; n -= 16, p += 16)
+	{
+		memcpy(&a, p, sizeof(a));
+		memcpy(&b, p + 8, sizeof(b));
+		a ^= c;
+		c = tab[15][a & 0xFF] ^ tab[14][(a >> 8) & 0xFF] ^ tab[13][(a >> 16) & 0xFF] ^ tab[12][(a >> 24) & 0xFF] ^
+			tab[11][(a >> 32) & 0xFF] ^ tab[10][(a >> 40) & 0xFF] ^ tab[9][(a >> 48) & 0xFF] ^ tab[8][a >> 56] ^
+			tab[7][b & 0xFF] ^ tab[6][(b >> 8) & 0xFF] ^ tab[5][(b >> 16) & 0xFF] ^ tab[4][(b >> 24) & 0xFF] ^
+			tab[3][(b >> 32) & 0xFF] ^ tab[2][(b >> 40) & 0xFF] ^ tab[1][(b >> 48) & 0xFF] ^ tab[0][b >> 56];
+	}
+
+	while (n--)
+		c = tab[0][(uint8_t)c ^ *p++] ^ (c >> 8);
+
+	return c;
+}
+
+
+// Table CRC-32 of n bytes at p from c, without the inversions, 16 bytes at a time.
+inline static uint32_t sm_crc_32_table(register uint32_t c, register const uint8_t* p, register uint64_t n, register const uint32_t (*tab)[256])
+{
+	uint32_t w[4];
+
+	for (; n >= 16; n -= 16, p += 16)
+	{
+		memcpy(w, p, sizeof(w));
+		w[0] ^= c;
+		c = tab[15][w[0] & 0xFF] ^ tab[14][(w[0] >> 8) & 0xFF] ^ tab[13][(w[0] >> 16) & 0xFF] ^ tab[12][w[0] >> 24] ^
+			tab[11][w[1] & 0xFF] ^ tab[10][(w[1] >> 8) & 0xFF] ^ tab[9][(w[1] >> 16) & 0xFF] ^ tab[8][w[1] >> 24] ^
+			tab[7][w[2] & 0xFF] ^ tab[6][(w[2] >> 8) & 0xFF] ^ tab[5][(w[2] >> 16) & 0xFF] ^ tab[4][w[2] >> 24] ^
+			tab[3][w[3] & 0xFF] ^ tab[2][(w[3] >> 8) & 0xFF] ^ tab[1][(w[3] >> 16) & 0xFF] ^ tab[0][w[3] >> 24];
+	}
+
+	while (n--)
+		c = tab[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+
+	return c;
+}
+
+
+// Table CRC32C of n bytes at p from c, without the inversions, 8 bytes at a time.
+static uint32_t sm_crc_32c_table(register uint32_t c, register const uint8_t* p, register uint64_t n)
+{
+	register uint32_t i, k, x;
+	uint32_t w[2];
+
+	if (!sm_crc_32c_built)
+	{
+		for (i = 0; i < 256; ++i)
+		{
+			for (x = i, k = 0; k < 8; ++k)
+				x = (x >> 1) ^ (SM_CRC_32C_POLY & (0 - (x & 1)));
+
+			sm_crc_32c_tab[0][i] = x;
+		}
+
+		for (k = 1; k < 8; ++k)
+			for (i = 0; i < 256; ++i)
+				sm_crc_32c_tab[k][i] = (sm_crc_32c_tab[k - 1][i] >> 8) ^ sm_crc_32c_tab[0][sm_crc_32c_tab[k - 1][i] & 0xFF];
+
+		sm_crc_32c_built = 1; // Racing builders write the same values.
+	}
+
+	for (; n >= 8; n -= 8, p += 8)
+	{
+		memcpy(w, p, sizeof(w));
+		w[0] ^= c;
+		c = sm_crc_32c_tab[7][w[0] & 0xFF] ^ sm_crc_32c_tab[6][(w[0] >> 8) & 0xFF] ^ sm_crc_32c_tab[5][(w[0] >> 16) & 0xFF] ^ sm_crc_32c_tab[4][w[0] >> 24] ^
+			sm_crc_32c_tab[3][w[1] & 0xFF] ^ sm_crc_32c_tab[2][(w[1] >> 8) & 0xFF] ^ sm_crc_32c_tab[1][(w[1] >> 16) & 0xFF] ^ sm_crc_32c_tab[0][w[1] >> 24];
+	}
+
+	while (n--)
+		c = sm_crc_32c_tab[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+
+	return c;
+}
+
+#if defined(SM_CPU_AMD) || defined(SM_CPU_INTEL)
+
+
+// Multiplies the 128-bit block X by x^d modulo P, given the constants K for d, and XORs in the block Y.
+#define sm_crc_fold_128(X, K, Y) _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128((X), (K), 0x00), _mm_clmulepi64_si128((X), (K), 0x11)), (Y))
+
+
+// Folds n bytes at p, n at least 64, with the raw CRC state s XORed into the first bytes, down to a 16-byte remainder at r
+// congruent to them. Four blocks are folded in parallel, 64 bytes apart. Returns the count of bytes consumed, a multiple
+// of 16.
+sm_target("pclmul,sse2") static uint64_t sm_crc_fold(uint64_t s, const uint8_t* p, uint64_t n, const uint64_t k[4], uint8_t r[16])
+{
+	register const __m128i k512 = _mm_set_epi64x((int64_t)k[1], (int64_t)k[0]);
+	register const __m128i k128 = _mm_set_epi64x((int64_t)k[3], (int64_t)k[2]);
+	register uint64_t i = 64;
+
+	__m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)p), _mm_cvtsi64_si128((int64_t)s));
+	__m128i x1 = _mm_loadu_si128((const __m128i*)(p + 16));
+	__m128i x2 = _mm_loadu_si128((const __m128i*)(p + 32));
+	__m128i x3 = _mm_loadu_si128((const __m128i*)(p + 48));
+
+	for (; i + 64 <= n; i += 64)
+	{
+		x0 = sm_crc_fold_128(x0, k512, _mm_loadu_si128((const __m128i*)(p + i)));
+		x1 = sm_crc_fold_128(x1, k512, _mm_loadu_si128((const __m128i*)(p + i + 16)));
+		x2 = sm_crc_fold_128(x2, k512, _mm_loadu_si128((const __m128i*)(p + i + 32)));
+		x3 = sm_crc_fold_128(x3, k512, _mm_loadu_si128((const __m128i*)(p + i + 48)));
+	}
+
+	x0 = sm_crc_fold_128(x0, k128, x1);
+	x0 = sm_crc_fold_128(x0, k128, x2);
+	x0 = sm_crc_fold_128(x0, k128, x3);
+
+	for (; i + 16 <= n; i += 16)
+		x0 = sm_crc_fold_128(x0, k128, _mm_loadu_si128((const __m128i*)(p + i)));
+
+	_mm_storeu_si128((__m128i*)r, x0);
+
+	return i;
+}
+
+
+
+// Runs CRC32C over three streams of l bytes at p, the first from c and the others from zero, and joins them, shifting
+// the first past 2 * l bytes with k2 and the second past l bytes with k1.
+sm_target("sse4.2,pclmul") inline static uint32_t sm_crc_32c_streams(uint32_t c, const uint8_t* p, size_t l, uint32_t k1, uint32_t k2)
+{
+	register uint64_t a = c, b = 0, d = 0;
+	register size_t i;
+	uint64_t x[3];
+
+	for (i = 0; i < l; i += 8)
+	{
+		memcpy(&x[0], p + i, sizeof(uint64_t));
+		memcpy(&x[1], p + l + i, sizeof(uint64_t));
+		memcpy(&x[2], p + l + l + i, sizeof(uint64_t));
+		a = _mm_crc32_u64(a, x[0]);
+		b = _mm_crc32_u64(b, x[1]);
+		d = _mm_crc32_u64(d, x[2]);
+	}
+
+	register const __m128i m = _mm_xor_si128(_mm_clmulepi64_si128(_mm_cvtsi64_si128((int64_t)a), _mm_cvtsi32_si128((int)k2), 0x00),
+		_mm_clmulepi64_si128(_mm_cvtsi64_si128((int64_t)b), _mm_cvtsi32_si128((int)k1), 0x00));
+
+	return (uint32_t)_mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(m)) ^ (uint32_t)d;
+}
+
+
+// Hardware CRC32C of n bytes at p from c, without the inversions.
+sm_target("sse4.2,pclmul") static uint32_t sm_crc_32c_hardware(register uint32_t c, register const uint8_t* p, register uint64_t n)
+{
+	uint64_t x;
+
+	for (; n >= 3 * SM_CRC_32C_LONG; n -= 3 * SM_CRC_32C_LONG, p += 3 * SM_CRC_32C_LONG)
+		c = sm_crc_32c_streams(c, p, SM_CRC_32C_LONG, sm_crc_32c_k[0], sm_crc_32c_k[1]);
+
+	for (; n >= 3 * SM_CRC_32C_SHORT; n -= 3 * SM_CRC_32C_SHORT, p += 3 * SM_CRC_32C_SHORT)
+		c = sm_crc_32c_streams(c, p, SM_CRC_32C_SHORT, sm_crc_32c_k[2], sm_crc_32c_k[3]);
+
+	for (; n >= 8; n -= 8, p += 8)
+	{
+		memcpy(&x, p, sizeof(x));
+		c = (uint32_t)_mm_crc32_u64(c, x);
+	}
+
+	while (n--)
+		c = _mm_crc32_u8(c, *p++);
+
+	return c;
+}
+
+#endif
+
+
+// Returns non-zero if the processor can run the folding kernels (PCLMULQDQ).
+exported uint8_t callconv sm_crc_fold_supported(void)
+{
+#if defined(SM_CPU_AMD) || defined(SM_CPU_INTEL)
+	return (sm_cpu_features() & (SM_CPU_PCLMUL | SM_CPU_SSE2)) == (SM_CPU_PCLMUL | SM_CPU_SSE2);
+#else
+	return 0;
+#endif
+}
+
+
+// Folding CRC-64, bit-exact with the crc_64 entity.
+exported uint64_t callconv sm_crc_64_fold(uint64_t c, const uint8_t* p, uint64_t n, void* t)
+{
+	register const uint64_t (*tab)[256] = t;
+
+#if defined(SM_CPU_AMD) || defined(SM_CPU_INTEL)
+	if (n >= SM_CRC_FOLD_MINIMUM && sm_crc_fold_supported())
+	{
+		uint8_t r[16];
+		register const uint64_t i = sm_crc_fold(c, p, n, sm_crc_64_k, r);
+
+		c = sm_crc_64_table(sm_crc_64_table(0, r, sizeof(r), tab), p + i, n - i, tab);
+
+		return c ^ ~UINT64_C(0);
+	}
+#endif
+
+	return sm_crc_64_table(c, p, n, tab) ^ ~UINT64_C(0);
+}
+
+
+// Folding CRC-32, bit-exact with the crc_32 entity.
+exported uint32_t callconv sm_crc_32_fold(uint32_t c, const uint8_t* p, uint64_t n, void* t)
+{
+	register const uint32_t (*tab)[256] = t;
+
+	c = c ^ ~UINT32_C(0);
+
+#if defined(SM_CPU_AMD) || defined(SM_CPU_INTEL)
+	if (n >= SM_CRC_FOLD_MINIMUM && sm_crc_fold_supported())
+	{
+		uint8_t r[16];
+		register const uint64_t i = sm_crc_fold(c, p, n, sm_crc_32_k, r);
+
+		c = sm_crc_32_table(sm_crc_32_table(0, r, sizeof(r), tab), p + i, n - i, tab);
+
+		return c ^ ~UINT32_C(0);
+	}
+#endif
+
+	return sm_crc_32_table(c, p, n, tab) ^ ~UINT32_C(0);
+}
+
+
+// Multiplies a by b modulo the CRC-64 polynomial, both reflected.
+inline static uint64_t sm_crc_64_multiply(register uint64_t a, register uint64_t b)
+{
+	register uint64_t m = UINT64_C(1) << 63, p = 0;
+
+	if (!a) return 0;
+
+	for (;;)
+	{
+		if (a & m)
+		{
+			p ^= b;
+			if (!(a & (m - 1))) break;
+		}
+
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ SM_CRC_64_POLY : (b >> 1);
+	}
+
+	return p;
+}
+
+
+#if defined(SM_CPU_AMD) || defined(SM_CPU_INTEL)
+
+
+// sm_crc_64_shift by carry-less multiplication. Works on bit-reversed (normal) polynomials, where a product is just the
+// 128-bit carry-less product, reduced by Barrett's method: with the product H * x^64 + L, the quotient is H + the high
+// half of H * MU, and the remainder is L + the low half of the quotient times P.
+sm_target("pclmul,sse2") static uint64_t sm_crc_64_shift_clmul(uint64_t r, uint64_t n)
+{
+	register const __m128i c = _mm_set_epi64x((int64_t)SM_CRC_64_MU, (int64_t)SM_CRC_64_NORMAL);
+	register uint32_t k;
+	__m128i x, q;
+
+	r = sm_reverse_64(r);
+
+	for (k = 3; n && r; n >>= 1, ++k)
+	{
+		if (!(n & 1)) continue;
+
+		x = _mm_clmulepi64_si128(_mm_cvtsi64_si128((int64_t)r), _mm_cvtsi64_si128((int64_t)sm_reverse_64(sm_crc_64_x2n[k & 63])), 0x00);
+		q = _mm_xor_si128(_mm_srli_si128(x, 8), _mm_srli_si128(_mm_clmulepi64_si128(x, c, 0x11), 8));
+		r = (uint64_t)_mm_cvtsi128_si64(_mm_xor_si128(x, _mm_clmulepi64_si128(q, c, 0x00)));
+	}
+
+	return sm_reverse_64(r);
+}
+
+
+#endif
+
+
+// Appends n zero bytes to the raw CRC-64 state r.
+exported uint64_t callconv sm_crc_64_shift(uint64_t r, uint64_t n)
+{
+	register uint32_t k;
+
+#if defined(SM_CPU_AMD) || defined(SM_CPU_INTEL)
+	if (sm_crc_fold_supported()) return sm_crc_64_shift_clmul(r, n);
+#endif
+
+	for (k = 3; n && r; n >>= 1, ++k) // 8 * n is n shifted by 3, so bit i of n is x^(2^(i + 3)).
+		if (n & 1) r = sm_crc_64_multiply(sm_crc_64_x2n[k & 63], r);
+
+	return r;
+}
+
+
+// Combines crc_64(c, A) and crc_64(0, B) into crc_64(c, A || B).
+exported uint64_t callconv sm_crc_64_combine(uint64_t a, uint64_t b, uint64_t n)
+{
+	return sm_crc_64_shift(a ^ ~UINT64_C(0), n) ^ b;
+}
+
+
+// Updates a CRC-64 for a changed range followed by n bytes.
+exported uint64_t callconv sm_crc_64_update(uint64_t c, uint64_t before, uint64_t after, uint64_t n)
+{
+	return c ^ sm_crc_64_shift(before ^ after, n); // The CRC is linear in the message, so only the difference shifts through.
+}
+
+
+// Multiplies a by b modulo the CRC-32 polynomial, both reflected.
+inline static uint32_t sm_crc_32_multiply(register uint32_t a, register uint32_t b)
+{
+	register uint32_t m = UINT32_C(1) << 31, p = 0;
+
+	if (!a) return 0;
+
+	for (;;)
+	{
+		if (a & m)
+		{
+			p ^= b;
+			if (!(a & (m - 1))) break;
+		}
+
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ SM_CRC_32_POLY : (b >> 1);
+	}
+
+	return p;
+}
+
+
+// Combines crc_32(c, A) and crc_32(0, B) into crc_32(c, A || B).
+exported uint32_t callconv sm_crc_32_combine(uint32_t a, uint32_t b, uint64_t n)
+{
+	register uint32_t k;
+
+	for (k = 3; n && a; n >>= 1, ++k) // The inversions of a and b cancel, leaving a * x^(8 * n) + b.
+		if (n & 1) a = sm_crc_32_multiply(sm_crc_32_x2n[k & 31], a);
+
+	return a ^ b;
+}
+
+// Computes the CRC of the structure of the given size at o, with the 8 bytes at offset q taken as zero.
+inline static uint64_t sm_crc_object(sm_context_t* context, const uint8_t* o, size_t size, size_t q)
+{
+	static const uint8_t zero[sizeof(uint64_t)] = { 0 };
+	register const sm_crc64_f f = context->checking.crc_64;
+	register void* t = context->checking.tab_64;
+	register uint64_t c;
+
+	c = f((uint64_t)size, o, q, t);
+	c = f(c ^ ~UINT64_C(0), zero, sizeof(zero), t);
+	return f(c ^ ~UINT64_C(0), o + q + sizeof(zero), size - q - sizeof(zero), t);
+}
+
+
+// Seals a structure.
+exported void callconv sm_crc_seal(sm_t sm, void* object, size_t size, void* crc)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+
+	if (!context || !object || !crc || !context->checking.crc_64) return;
+
+	const uint64_t c = sm_crc_object(context, (const uint8_t*)object, size, (size_t)((uint8_t*)crc - (uint8_t*)object));
+
+	memcpy(crc, &c, sizeof(c));
+}
+
+
+// Verifies a structure against its CRC.
+exported uint8_t callconv sm_crc_verify(sm_t sm, const void* object, size_t size, const void* crc)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+	uint64_t c;
+
+	if (!context || !object || !crc) return 0;
+	if (!context->checking.crc_64) return 1;
+
+	memcpy(&c, crc, sizeof(c));
+
+	if (!c) return 1;
+
+	return sm_crc_object(context, (const uint8_t*)object, size, (size_t)((const uint8_t*)crc - (const uint8_t*)object)) == c;
+}
+
+
+// Assigns a field of a structure, updating its CRC.
+exported void callconv sm_crc_assign(sm_t sm, void* object, size_t size, void* crc, void* field, const void* value, size_t bytes)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+	register uint8_t* o = (uint8_t*)object;
+	register uint8_t* p = (uint8_t*)field;
+	register uint8_t* q = (uint8_t*)crc;
+	uint64_t c;
+
+	if (!context || !object || !crc || !field || !value || !bytes) return;
+
+	memcpy(&c, crc, sizeof(c));
+
+	if (!c || !context->checking.crc_64 || p < o || p + bytes > o + size) // Unsealed, or cannot be checked.
+	{
+		memmove(field, value, bytes);
+		return;
+	}
+
+	if (p < q + sizeof(c) && q < p + bytes) // Overlaps the CRC.
+	{
+		memmove(field, value, bytes);
+		sm_crc_seal(sm, object, size, crc);
+		return;
+	}
+
+	register const uint64_t before = context->checking.crc_64(0, p, bytes, context->checking.tab_64);
+
+	memmove(field, value, bytes);
+
+	c = sm_crc_64_update(c, before, context->checking.crc_64(0, p, bytes, context->checking.tab_64), (uint64_t)((o + size) - (p + bytes)));
+
+	memcpy(crc, &c, sizeof(c));
+}
+
+
+// CRC32C.
+exported uint32_t callconv sm_crc_32c(uint32_t c, const uint8_t* p, uint64_t n)
+{
+#if defined(SM_CPU_AMD) || defined(SM_CPU_INTEL)
+	register const uint32_t f = sm_cpu_features();
+
+	if ((f & (SM_CPU_SSE42 | SM_CPU_PCLMUL)) == (SM_CPU_SSE42 | SM_CPU_PCLMUL))
+		return sm_crc_32c_hardware(c ^ ~UINT32_C(0), p, n) ^ ~UINT32_C(0);
+#endif
+
+	return sm_crc_32c_table(c ^ ~UINT32_C(0), p, n) ^ ~UINT32_C(0);
+}
+
+
+// A parallel CRC run: the buffer is cut into pieces of equal size but the last, each CRCed from zero on its own.
+typedef struct sm_crc_parallel_s
+{
+	sm_crc64_f crc_64; // The CRC-64 kernel, or null.
+	sm_crc32_f crc_32; // The CRC-32 kernel, or null.
+	void* tab; // The kernel's table.
+	const uint8_t* p; // The buffer.
+	uint64_t n; // The size of the buffer.
+	uint64_t piece; // The size of a piece.
+	uint64_t crcs[SM_CRC_PARALLEL_PIECES]; // The CRC of each piece.
+}
+sm_crc_parallel_t;
+
+
+// CRCs piece i of a parallel run.
+static void sm_crc_parallel_task(void* a, size_t i)
+{
+	sm_crc_parallel_t* run = (sm_crc_parallel_t*)a;
+	register const uint64_t start = run->piece * i;
+	register const uint64_t n = sm_min(run->piece, run->n - start);
+
+	if (run->crc_64) run->crcs[i] = run->crc_64(0, run->p + start, n, run->tab);
+	else run->crcs[i] = run->crc_32(0, run->p + start, n, run->tab);
+}
+
+
+// Splits a parallel run of n bytes into pieces, returning the count.
+inline static size_t sm_crc_parallel_split(sm_crc_parallel_t* run, uint64_t n)
+{
+	run->piece = sm_max((uint64_t)SM_CRC_PARALLEL_PIECE, (n + SM_CRC_PARALLEL_PIECES - 1) / SM_CRC_PARALLEL_PIECES);
+
+	return (size_t)((n + run->piece - 1) / run->piece);
+}
+
+
+// Parallel CRC-64.
+exported uint64_t callconv sm_crc_64_parallel(sm_crc64_f f, void* t, uint64_t c, const uint8_t* p, uint64_t n, uint32_t threads)
+{
+	if (n < SM_CRC_PARALLEL_MINIMUM || threads == 1) return f(c, p, n, t);
+
+	sm_crc_parallel_t run;
+	register size_t i, count;
+
+	run.crc_64 = f, run.crc_32 = NULL, run.tab = t, run.p = p, run.n = n;
+	count = sm_crc_parallel_split(&run, n);
+
+	sm_thread_parallel(sm_crc_parallel_task, &run, count, threads);
+
+	c = sm_crc_64_combine(c ^ ~UINT64_C(0), run.crcs[0], run.piece); // c, as the CRC of nothing, seeded by c.
+
+	for (i = 1; i < count; ++i)
+		c = sm_crc_64_combine(c, run.crcs[i], sm_min(run.piece, n - (run.piece * i)));
+
+	return c;
+}
+
+
+// Parallel CRC-32.
+exported uint32_t callconv sm_crc_32_parallel(sm_crc32_f f, void* t, uint32_t c, const uint8_t* p, uint64_t n, uint32_t threads)
+{
+	if (n < SM_CRC_PARALLEL_MINIMUM || threads == 1) return f(c, p, n, t);
+
+	sm_crc_parallel_t run;
+	register size_t i, count;
+
+	run.crc_64 = NULL, run.crc_32 = f, run.tab = t, run.p = p, run.n = n;
+	count = sm_crc_parallel_split(&run, n);
+
+	sm_thread_parallel(sm_crc_parallel_task, &run, count, threads);
+
+	for (i = 0; i < count; ++i) // c is the CRC of everything before piece i.
+		c = sm_crc_32_combine(c, (uint32_t)run.crcs[i], sm_min(run.piece, n - (run.piece * i)));
+
+	return c;
+}
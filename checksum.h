@@ -1,7 +1,9 @@
-// checksum.h
+// checksum.h - CRC-32 and CRC-64: a portable slice-by-8 CRC-32, carry-less multiply folding kernels, and CRC-64
+// combination for incremental updates.
 
 
 #include "config.h"
+#include "sm.h"
 
 
 #ifndef INCLUDE_CHECKSUM_H
@@ -11,8 +13,23 @@
 #define CRCPOLY 0xEDB88320
 #define CRCINIT 0xFFFFFFFF
 
+// The count of 256-entry rows in a table made by sec_crc_initialize.
+#define CRCROWS 8
 
-void sec_crc_initialize(void *restrict s)
+// Buffers shorter than this are CRCed on the calling thread by the parallel CRC functions.
+#define SM_CRC_PARALLEL_MINIMUM UINT64_C(0x400000)
+
+// The smallest piece the parallel CRC functions hand a thread, and the most pieces they cut a buffer into.
+#define SM_CRC_PARALLEL_PIECE UINT64_C(0x100000)
+#define SM_CRC_PARALLEL_PIECES 256U
+
+// Inputs shorter than this are left to the table kernels by the folding kernels, which start with four 16-byte blocks.
+// Folding is already about twice as fast as slice-by-16 at this size.
+#define SM_CRC_FOLD_MINIMUM 64U
+
+
+// Fills the table at s, CRCROWS rows of 256 uint32_t, where entry i of row k is the CRC of byte i followed by k zero bytes.
+inline static void sec_crc_initialize(void *restrict s)
 {
 	register uint32_t i, x, j, c;
 	register uint32_t* p = (uint32_t*)s;
@@ -22,7 +39,7 @@ void sec_crc_initialize(void *restrict s)
 		x = i;
 
 		for (j = 0; j < UINT32_C(8); ++j)
-			x = (x >> 1) ^ (UINT32_C(0xEDB88320) & (-(int32_t)(x & UINT32_C(1))));
+			x = (x >> 1) ^ (CRCPOLY & (-(int32_t)(x & UINT32_C(1))));
 
 		p[(0 * 256) + i] = x;
 	}
@@ -31,7 +48,7 @@ void sec_crc_initialize(void *restrict s)
 	{
 		c = p[(0 * 256) + i];
 
-		for (j = 1; j < UINT32_C(4); ++j)
+		for (j = 1; j < CRCROWS; ++j)
 		{
 			c = p[(0 * 256) + (c & UINT32_C(0xFF))] ^ (c >> 8);
 			p[(j * 256) + i] = c;
@@ -39,37 +56,91 @@ void sec_crc_initialize(void *restrict s)
 	}
 }
 
-uint32_t sec_crc_compute(const void *restrict s, const uint8_t *restrict v, size_t n)
-{
-	uint32_t r = UINT32_C(0xFFFFFFFF);
-	uint32_t i = (uint32_t)(n / sizeof(uint32_t));
-	uint32_t c;
 
-	for (; i; i--) 
-	{
-		r ^= *(uint32_t*)v;
-		r =
-			g_crc_precalc[3][(r) & 0xFF] ^
-			g_crc_precalc[2][(r >> 8) & 0xFF] ^
-			g_crc_precalc[1][(r >> 16) & 0xFF] ^
-			g_crc_precalc[0][(r >> 24) & 0xFF];
-		v += sizeof(uint32_t);
-	}
+// Computes the CRC-32 of n bytes at v, eight bytes per step, with the table at s made by sec_crc_initialize.
+inline static uint32_t sec_crc_compute(const void *restrict s, const uint8_t *restrict v, size_t n)
+{
+	register const uint32_t (*t)[256] = (const uint32_t(*)[256])s;
+	register uint32_t r = CRCINIT, a, b;
 
-	if (n & sizeof(uint16_t)) 
+	for (; n >= 8; n -= 8, v += 8)
 	{
-		c = r ^ *(uint16_t*)v;
-		r = g_crc_precalc[1][(c) & 0xFF] ^
-			g_crc_precalc[0][(c >> 8) & 0xFF] ^ (r >> 16);
-		v += sizeof(uint16_t);
+		a = ((const uint32_t*)v)[0] ^ r;
+		b = ((const uint32_t*)v)[1];
+		r = t[7][a & 0xFF] ^ t[6][(a >> 8) & 0xFF] ^ t[5][(a >> 16) & 0xFF] ^ t[4][a >> 24] ^
+			t[3][b & 0xFF] ^ t[2][(b >> 8) & 0xFF] ^ t[1][(b >> 16) & 0xFF] ^ t[0][b >> 24];
 	}
 
-	if (n & 1)
-		r = g_crc_precalc[0][(r ^ *v) & 0xFF] ^ (r >> 8);
+	while (n--)
+		r = t[0][(r ^ *v++) & 0xFF] ^ (r >> 8);
 
 	return ~r;
 }
 
 
-#endif // 
+// Returns non-zero if the processor can run the folding kernels (PCLMULQDQ).
+exported uint8_t callconv sm_crc_fold_supported(void);
+
+// Folding CRC-64 with the sm_crc64_f signature, giving the same result as the crc_64 entity. t is the 16-row slice table
+// of the crc_64_s16 entity, used for inputs under SM_CRC_FOLD_MINIMUM bytes, the final reduction and any trailing bytes,
+// and for everything on a processor without PCLMULQDQ.
+exported uint64_t callconv sm_crc_64_fold(uint64_t c, const uint8_t* p, uint64_t n, void* t);
+
+// Folding CRC-32 with the sm_crc32_f signature, giving the same result as the crc_32 entity. t is the 16-row slice table
+// of the crc_32_s16 entity, used as for sm_crc_64_fold.
+exported uint32_t callconv sm_crc_32_fold(uint32_t c, const uint8_t* p, uint64_t n, void* t);
+
+
+
+// CRC32C (Castagnoli, reflected 0x82F63B78) of n bytes at p, continuing from the CRC32C c of any preceding bytes, zero for
+// none. Uses the SSE 4.2 crc32 instruction over three interleaved streams where the processor has it and PCLMULQDQ, and
+// a slice-by-8 table, built on the first call, otherwise.
+exported uint32_t callconv sm_crc_32c(uint32_t c, const uint8_t* p, uint64_t n);
+
+
+// CRC-64 arithmetic. The raw CRC-64 state r of a message M is M * x^64 mod P, and crc_64(c, M) is (c * x^(8 * |M|) + r)
+// ^ ~0, so CRCs of pieces can be combined, and a CRC updated for a changed range, with one multiplication modulo P by a
+// power of x, in O(log n).
+
+// Multiplies the raw state r by x^(8 * n) modulo P, as if n zero bytes followed the message. n is below 2^61.
+exported uint64_t callconv sm_crc_64_shift(uint64_t r, uint64_t n);
+
+// Combines a = crc_64(c, A) and b = crc_64(0, B), where B is n bytes long, into crc_64(c, A || B).
+exported uint64_t callconv sm_crc_64_combine(uint64_t a, uint64_t b, uint64_t n);
+
+// Combines a = crc_32(c, A) and b = crc_32(0, B), where B is n bytes long, into crc_32(c, A || B).
+exported uint32_t callconv sm_crc_32_combine(uint32_t a, uint32_t b, uint64_t n);
+
+// Updates c, the CRC-64 of a message, for a change to a range of it followed by n more bytes. before and after are
+// crc_64(0, ...) of the old and new bytes of the range.
+exported uint64_t callconv sm_crc_64_update(uint64_t c, uint64_t before, uint64_t after, uint64_t n);
+
+
+// Parallel CRCs. The buffer is cut into pieces CRCed by up to the given count of threads, zero for one per processor, of
+// the worker pool of sm_thread_parallel, and their CRCs combined, which gives the same result as f(c, p, n, t) alone. f
+// and t are a kernel and its table, such as the context's. Buffers under SM_CRC_PARALLEL_MINIMUM bytes, or with one
+// thread, are CRCed on the calling thread.
+
+// Parallel CRC-64 by f, with table t, of n bytes at p from c.
+exported uint64_t callconv sm_crc_64_parallel(sm_crc64_f f, void* t, uint64_t c, const uint8_t* p, uint64_t n, uint32_t threads);
+
+// Parallel CRC-32 by f, with table t, of n bytes at p from c.
+exported uint32_t callconv sm_crc_32_parallel(sm_crc32_f f, void* t, uint32_t c, const uint8_t* p, uint64_t n, uint32_t threads);
+
+// Structure integrity. The CRC of a structure is crc_64(size, structure) with the CRC field itself taken as zero. For
+// the context and hash tables, size is that of their leading configuration, which sm_create and sm_hash_table_create
+// seal, not of the state after it that changes with use. A CRC of zero means the structure is not sealed, and is left
+// alone. These use the context's CRC-64 kernel, and do nothing, or verify anything, without one.
+
+// Seals the structure of the given size at object, storing its CRC at crc, a field of it.
+exported void callconv sm_crc_seal(sm_t sm, void* object, size_t size, void* crc);
+
+// Returns non-zero if the structure of the given size at object is unsealed or matches its CRC at crc.
+exported uint8_t callconv sm_crc_verify(sm_t sm, const void* object, size_t size, const void* crc);
+
+// Copies bytes from value over field, within the structure at object, and updates its CRC at crc to match, from the old
+// and new bytes of the field alone. A sealed structure is assumed to be intact; a field overlapping the CRC reseals it.
+exported void callconv sm_crc_assign(sm_t sm, void* object, size_t size, void* crc, void* field, const void* value, size_t bytes);
+
 
+#endif // INCLUDE_CHECKSUM_H
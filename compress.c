@@ -0,0 +1,935 @@
+// compress.c - Block-framed streaming compression.
+
+
+#include <string.h>
+
+
+#include "config.h"
+#include "sm.h"
+#include "sm_internal.h"
+#include "checksum.h"
+#include "thread.h"
+#include "bits.h"
+#include "compress.h"
+
+
+// SM_COMPRESS_FAST steps one further for each 2^SM_COMPRESS_SKIP literals since the last match.
+#define SM_COMPRESS_SKIP 5U
+
+// The input and output left for the fast decoding loop: a control byte and the longest literal run, and the longest match
+// and the most a word copy writes past its end.
+#define SM_DECOMPRESS_MARGIN_INPUT (1U + 32U)
+#define SM_DECOMPRESS_MARGIN_OUTPUT (SM_COMPRESS_MATCH_MAXIMUM + 16U)
+
+
+// A batch of blocks being compressed.
+typedef struct sm_compress_run_s
+{
+	const uint8_t* src; // The raw bytes.
+	size_t bytes; // The count of raw bytes.
+	size_t block; // The raw size of a block.
+	uint8_t level; // The compression level and flags.
+	uint8_t* output; // The slot of each block.
+	uint8_t* tables; // The hash table of each block.
+	uint8_t decisions[SM_THREAD_PARALLEL_MAXIMUM]; // The decision taken for each block, SM_COMPRESS_PREDICT_*.
+}
+sm_compress_run_t;
+
+
+// A frame being decompressed in parallel.
+typedef struct sm_decompress_run_s
+{
+	const sm_compress_frame_t* frame; // The frame.
+	uint8_t* dst; // The raw bytes.
+	volatile uint64_t failures; // The count of corrupt blocks.
+}
+sm_decompress_run_t;
+
+
+// A frame written to memory.
+typedef struct sm_compress_sink_s
+{
+	uint8_t* p; // The next byte.
+	size_t left; // The count of bytes left.
+}
+sm_compress_sink_t;
+
+
+// Stores v at p, little-endian.
+inline static void sm_compress_put(uint8_t* p, uint32_t v)
+{
+	p[0] = (uint8_t)v, p[1] = (uint8_t)(v >> 8), p[2] = (uint8_t)(v >> 16), p[3] = (uint8_t)(v >> 24);
+}
+
+
+// Loads the little-endian value at p.
+inline static uint32_t sm_compress_get(const uint8_t* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+// Gets the hash, of the given count of bits, of the three bytes at p. Four bytes are read.
+inline static uint32_t sm_compress_hash(const uint8_t* p, uint32_t bits)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return ((v << 8) * 0x9E3779B1U) >> (32 - bits);
+}
+
+
+// Gets the length of the common prefix of p and q, at least ln and at most xl, comparing eight bytes at a time.
+inline static size_t sm_compress_extend(const uint8_t* p, const uint8_t* q, size_t ln, size_t xl)
+{
+	uint64_t a, b;
+
+	for (; ln + sizeof(uint64_t) <= xl; ln += sizeof(uint64_t))
+	{
+		memcpy(&a, p + ln, sizeof(a));
+		memcpy(&b, q + ln, sizeof(b));
+
+		if (a != b) return ln + (sm_ctz_64(a ^ b) >> 3); // The first differing byte, little-endian.
+	}
+
+	while (ln < xl && p[ln] == q[ln])
+		++ln;
+
+	return ln;
+}
+
+
+// Records the position ip of s under its hash, as sm_compress_find does, linking it into its chain if chained.
+inline static void sm_compress_insert(const uint8_t* s, const uint8_t* ip, uint32_t* heads, uint32_t* chain, uint32_t bits, uint8_t chained)
+{
+	register const uint32_t h = sm_compress_hash(ip, bits), position = (uint32_t)(ip - s) + 1;
+
+	if (heads[h] == position) return;
+
+	if (chained) chain[position & (SM_COMPRESS_WINDOW - 1)] = heads[h];
+
+	heads[h] = position;
+}
+
+
+// Finds the longest match for the bytes at ip, of s, trying up to depth earlier positions with their hash, and records ip
+// under the hash. Positions are stored plus one, so that zero is none, with a chain link per position in the window
+// when depth is above one. Returns the length of the match, below 3 for none, storing its offset less one at of.
+inline static size_t sm_compress_find(const uint8_t* s, const uint8_t* ip, const uint8_t* ie, uint32_t* heads, uint32_t* chain, uint32_t bits, uint32_t depth, size_t* of)
+{
+	register const uint32_t h = sm_compress_hash(ip, bits), position = (uint32_t)(ip - s) + 1;
+	register const size_t xl = sm_min((size_t)(ie - ip), (size_t)SM_COMPRESS_MATCH_MAXIMUM);
+	register uint32_t c = heads[h], d, e;
+	register size_t best = 0, ln;
+
+	if (c == position) // Recorded by a lazy step.
+		c = (depth > 1) ? chain[position & (SM_COMPRESS_WINDOW - 1)] : 0;
+	else
+	{
+		if (depth > 1) chain[position & (SM_COMPRESS_WINDOW - 1)] = c;
+		heads[h] = position;
+	}
+
+	for (d = position - c; c && d && d <= SM_COMPRESS_WINDOW; d = e)
+	{
+		register const uint8_t* rf = ip - d;
+
+		if (rf[best] == ip[best] && (ln = sm_compress_extend(ip, rf, 0, xl)) > best) // Only a longer match can end later.
+		{
+			best = ln, *of = d - 1;
+			if (ln == xl) break;
+		}
+
+		if (!--depth) break;
+
+		c = chain[c & (SM_COMPRESS_WINDOW - 1)];
+		e = position - c;
+
+		if (e <= d) break; // Links must lead further back; a link of a position beyond the window has been reused.
+	}
+
+	return best;
+}
+
+
+// Writes the n literals at p as runs of up to 32, each after its control byte. Returns the end of the output, or null if
+// it would pass oe.
+inline static uint8_t* sm_compress_literals(uint8_t* op, const uint8_t* oe, const uint8_t* p, size_t n)
+{
+	register size_t k;
+
+	if ((size_t)(oe - op) < n + ((n + 31) / 32)) return NULL;
+
+	for (; n; n -= k, p += k, op += k)
+	{
+		k = sm_min(n, (size_t)32);
+		*op++ = (uint8_t)(k - 1);
+		memcpy(op, p, k);
+	}
+
+	return op;
+}
+
+
+// Writes a back reference to a match of ln bytes, 3 to SM_COMPRESS_MATCH_MAXIMUM, starting of + 1 bytes back. Returns the
+// end of the output, or null if it would pass oe.
+inline static uint8_t* sm_compress_match(uint8_t* op, const uint8_t* oe, size_t of, size_t ln)
+{
+	if (oe - op < 3) return NULL;
+
+	ln -= 2;
+
+	if (ln < 7)
+		*op++ = (uint8_t)((of >> 8) + (ln << 5));
+	else
+	{
+		*op++ = (uint8_t)((of >> 8) + 0xE0);
+		*op++ = (uint8_t)(ln - 7);
+	}
+
+	*op++ = (uint8_t)of;
+
+	return op;
+}
+
+
+// The distance, a multiple of each match offset below eight, from which eight bytes of the match repeat.
+static const uint8_t sm_decompress_period[8] = { 0, 8, 8, 9, 8, 10, 12, 14 };
+
+
+// Copies 16 bytes from s to d, which do not overlap.
+inline static void sm_decompress_copy_16(uint8_t* d, const uint8_t* s)
+{
+	memcpy(d, s, 16);
+}
+
+
+// Copies 8 bytes from s to d, which do not overlap.
+inline static void sm_decompress_copy_8(uint8_t* d, const uint8_t* s)
+{
+	memcpy(d, s, 8);
+}
+
+
+// Copies the match of ln bytes, of bytes back, to op, in words that may write up to 15 bytes past its end. An offset of
+// 16 or more is copied 16 bytes at a time. A shorter one repeats, so eight bytes at a time are copied from a whole count
+// of repeats back, once the first eight are there.
+inline static void sm_decompress_match(uint8_t* op, size_t of, size_t ln)
+{
+	register const uint8_t* rf = op - of;
+	register const uint8_t* const end = op + ln;
+
+	if (of >= 16)
+	{
+		do sm_decompress_copy_16(op, rf), op += 16, rf += 16;
+		while (op < end);
+
+		return;
+	}
+
+	if (of < 8)
+	{
+		op[0] = rf[0], op[1] = rf[1], op[2] = rf[2], op[3] = rf[3];
+		op[4] = rf[4], op[5] = rf[5], op[6] = rf[6], op[7] = rf[7];
+
+		op += 8;
+		rf = op - sm_decompress_period[of];
+	}
+
+	for (; op < end; op += 8, rf += 8)
+		sm_decompress_copy_8(op, rf);
+}
+
+
+// Gets the decompressed size of the slen bytes at src. Returns SM_COMPRESS_OK, or SM_COMPRESS_CORRUPT if they end early.
+static uint8_t sm_decompress_size(const void* src, uint64_t slen, uint64_t* dlen)
+{
+	register const uint8_t* ip = (const uint8_t*)src;
+	register const uint8_t* const ie = ip + slen;
+	register uint64_t tl = 0, ct, ln;
+
+	while (ip < ie)
+	{
+		ct = *ip++;
+
+		if (ct < 0x20)
+		{
+			if ((uint64_t)(ie - ip) < ++ct) return SM_COMPRESS_CORRUPT;
+
+			ip += ct, tl += ct;
+		}
+		else
+		{
+			ln = ct >> 5;
+
+			if (ln == 7)
+			{
+				if (ip >= ie) return SM_COMPRESS_CORRUPT;
+				ln += *ip++;
+			}
+
+			if (ip++ >= ie) return SM_COMPRESS_CORRUPT;
+
+			tl += ln + 2;
+		}
+	}
+
+	*dlen = tl;
+
+	return SM_COMPRESS_OK;
+}
+
+
+// Compresses a buffer at a level.
+exported uint8_t callconv sm_compress_level(const void *const src, const uint64_t slen, void *dst, uint64_t *const dlen, void* htab, uint8_t level)
+{
+	const uint8_t* const s = (const uint8_t*)src;
+	const uint8_t* const ie = s + slen;
+	const uint8_t* ip = s;
+	const uint8_t* lt = s;
+	const uint8_t* end;
+	uint32_t* const heads = (uint32_t*)htab;
+	uint32_t* const chain = heads + 0x10000U;
+	uint8_t* op = (uint8_t*)dst;
+	const uint8_t* oe;
+	uint32_t bits = 16;
+	size_t ln, lazy, of, ol;
+
+	if (!dlen || !htab) return SM_COMPRESS_ARGUMENTS;
+
+	if (!level) level = SM_COMPRESS_DEFAULT;
+
+	if (level > SM_COMPRESS_STRONG) return SM_COMPRESS_ARGUMENTS;
+
+	if (!src)
+	{
+		if (slen) return SM_COMPRESS_ARGUMENTS;
+		*dlen = 0;
+		return SM_COMPRESS_OK;
+	}
+
+	if (!dst) return SM_COMPRESS_ARGUMENTS;
+
+	oe = op + *dlen;
+
+	register const uint32_t depth = (level == SM_COMPRESS_STRONG) ? SM_COMPRESS_CHAIN : 1;
+
+	while (bits > 10 && (UINT64_C(1) << (bits - 2)) >= slen) // Up to four slots per position, for less to clear.
+		--bits;
+
+	memset(heads, 0, sizeof(uint32_t) << bits);
+
+	while (ie - ip >= 4)
+	{
+		ln = sm_compress_find(s, ip, ie, heads, chain, bits, depth, &of);
+
+		if (ln < 3)
+		{
+			ip += (level == SM_COMPRESS_FAST) ? sm_min(1 + ((size_t)(ip - lt) >> SM_COMPRESS_SKIP), (size_t)(ie - ip)) : 1;
+			continue;
+		}
+
+		if (level == SM_COMPRESS_STRONG) // Defer to a longer match one byte on.
+			while (ln < SM_COMPRESS_MATCH_MAXIMUM && ie - ip >= 5 && (lazy = sm_compress_find(s, ip + 1, ie, heads, chain, bits, depth, &ol)) > ln)
+				++ip, ln = lazy, of = ol;
+
+		if (!(op = sm_compress_literals(op, oe, lt, ip - lt))) return SM_COMPRESS_SIZE;
+		if (!(op = sm_compress_match(op, oe, of, ln))) return SM_COMPRESS_SIZE;
+
+		end = ip + ln;
+
+		if (level == SM_COMPRESS_STRONG) // Record every position of the match, or else just the last, which starts the next three.
+			ip++;
+		else ip = end - 1;
+
+		for (; ip < end && ie - ip >= 4; ++ip)
+			sm_compress_insert(s, ip, heads, chain, bits, depth > 1);
+
+		ip = lt = end;
+	}
+
+	if (!(op = sm_compress_literals(op, oe, lt, ie - lt))) return SM_COMPRESS_SIZE;
+
+	*dlen = op - (uint8_t*)dst;
+
+	return SM_COMPRESS_OK;
+}
+
+
+// Compresses a buffer.
+exported uint8_t callconv sm_compress_buffer(const void *const src, const uint64_t slen, void *dst, uint64_t *const dlen, void* htab)
+{
+	return sm_compress_level(src, slen, dst, dlen, htab, SM_COMPRESS_DEFAULT);
+}
+
+
+// Predicts whether a buffer is worth compressing.
+exported uint8_t callconv sm_compress_predict(const void* p, size_t n, void* htab)
+{
+	register const uint8_t* q = (const uint8_t*)p;
+	uint32_t histogram[256];
+	uint8_t trial[SM_COMPRESS_SAMPLE];
+	register uint64_t sum = 0, m;
+	register size_t i, j, stride;
+	uint64_t packed = SM_COMPRESS_SAMPLE - (SM_COMPRESS_SAMPLE / SM_COMPRESS_GAIN);
+
+	if (!q || !htab || n < 2 * SM_COMPRESS_SAMPLE) return SM_COMPRESS_PREDICT_COMPRESS; // As cheap to compress as to sample.
+
+	memset(histogram, 0, sizeof(histogram));
+
+	stride = (n / SM_COMPRESS_SAMPLE) * 8; // Eight bytes from each stride, from all over the buffer.
+
+	for (i = 0, m = 0; i + 8 <= n && m < SM_COMPRESS_SAMPLE; i += stride, m += 8)
+		for (j = 0; j < 8; ++j)
+			histogram[q[i + j]]++;
+
+	for (i = 0; i < 256; ++i)
+		sum += (uint64_t)histogram[i] * histogram[i];
+
+	if (sum * SM_COMPRESS_UNIFORM < m * m) // The chance of two sampled bytes matching, sum / m^2, is near 1 / 256.
+		return SM_COMPRESS_PREDICT_UNIFORM;
+
+	if (sm_compress_level(q, SM_COMPRESS_SAMPLE, trial, &packed, htab, SM_COMPRESS_NORMAL) != SM_COMPRESS_OK) // Out of room.
+		return SM_COMPRESS_PREDICT_TRIAL;
+
+	return SM_COMPRESS_PREDICT_COMPRESS;
+}
+
+
+// Decompresses a buffer.
+exported uint8_t callconv sm_decompress_buffer(const void* src, uint64_t slen, void* dst, uint64_t* dlen)
+{
+	const uint8_t* ip = (const uint8_t*)src;
+	const uint8_t* const ie = ip + slen;
+	uint8_t* op = (uint8_t*)dst;
+	const uint8_t* oe;
+	const uint8_t* rf;
+	uint64_t ct, ln, of;
+
+	if (!dlen) return SM_COMPRESS_ARGUMENTS;
+
+	if (!src)
+	{
+		if (slen) return SM_COMPRESS_ARGUMENTS;
+		*dlen = 0;
+		return SM_COMPRESS_OK;
+	}
+
+	if (!dst)
+	{
+		if (*dlen) return SM_COMPRESS_ARGUMENTS;
+		return sm_decompress_size(src, slen, dlen);
+	}
+
+	oe = op + *dlen;
+
+	if (slen >= SM_DECOMPRESS_MARGIN_INPUT && *dlen >= SM_DECOMPRESS_MARGIN_OUTPUT)
+	{
+		register const uint8_t* const il = ie - SM_DECOMPRESS_MARGIN_INPUT;
+		register const uint8_t* const ol = oe - SM_DECOMPRESS_MARGIN_OUTPUT;
+
+		while (ip <= il && op <= ol) // No bounds to check but the offset.
+		{
+			ct = *ip++;
+
+			if (ct < 0x20) // All 32 bytes, whatever the length of the run.
+			{
+				sm_decompress_copy_16(op, ip);
+				sm_decompress_copy_16(op + 16, ip + 16);
+
+				op += ct + 1, ip += ct + 1;
+			}
+			else
+			{
+				ln = ct >> 5;
+				of = (ct & 0x1F) << 8;
+
+				if (ln == 7) ln += *ip++;
+
+				of += (uint64_t)*ip++ + 1;
+				ln += 2;
+
+				if (of > (uint64_t)(op - (uint8_t*)dst)) return SM_COMPRESS_CORRUPT;
+
+				sm_decompress_match(op, (size_t)of, (size_t)ln);
+				op += ln;
+			}
+		}
+	}
+
+	while (ip < ie) // Near the ends, checking every bound.
+	{
+		ct = *ip++;
+
+		if (ct < 0x20)
+		{
+			++ct;
+
+			if ((uint64_t)(ie - ip) < ct) return SM_COMPRESS_CORRUPT;
+			if ((uint64_t)(oe - op) < ct) goto LOC_SIZE;
+
+			memcpy(op, ip, ct);
+			op += ct, ip += ct;
+		}
+		else
+		{
+			ln = ct >> 5;
+			of = (ct & 0x1F) << 8;
+
+			if (ln == 7)
+			{
+				if (ip >= ie) return SM_COMPRESS_CORRUPT;
+				ln += *ip++;
+			}
+
+			if (ip >= ie) return SM_COMPRESS_CORRUPT;
+
+			of += (uint64_t)*ip++ + 1;
+			ln += 2;
+
+			if (of > (uint64_t)(op - (uint8_t*)dst)) return SM_COMPRESS_CORRUPT;
+			if ((uint64_t)(oe - op) < ln) goto LOC_SIZE;
+
+			rf = op - of;
+
+			do *op++ = *rf++; // Byte by byte, as the match may overlap its own output.
+			while (--ln);
+		}
+	}
+
+	*dlen = op - (uint8_t*)dst;
+
+	return SM_COMPRESS_OK;
+
+LOC_SIZE:
+
+	if (sm_decompress_size(src, slen, &of) != SM_COMPRESS_OK) return SM_COMPRESS_CORRUPT;
+
+	*dlen = of;
+
+	return SM_COMPRESS_SIZE;
+}
+
+
+// Compresses block k of a batch into its slot, or stores it raw if it does not compress, or is predicted not to with
+// SM_COMPRESS_ADAPTIVE, and fills in its header.
+static void sm_compress_task(void* p, size_t k)
+{
+	sm_compress_run_t* run = (sm_compress_run_t*)p;
+	register const size_t start = k * run->block, raw = sm_min(run->block, run->bytes - start);
+	register uint8_t* slot = run->output + (k * (SM_COMPRESS_BLOCK_HEADER + run->block));
+	register uint8_t* table = run->tables + (k * SM_COMPRESS_TABLE);
+	register uint8_t decision = SM_COMPRESS_PREDICT_COMPRESS;
+	uint64_t packed = raw;
+	uint32_t flags = 0;
+
+	if (run->level & SM_COMPRESS_ADAPTIVE)
+		decision = sm_compress_predict(run->src + start, raw, table);
+
+	if (decision == SM_COMPRESS_PREDICT_COMPRESS &&
+		(sm_compress_level(run->src + start, raw, slot + SM_COMPRESS_BLOCK_HEADER, &packed, table, run->level & (uint8_t)~SM_COMPRESS_ADAPTIVE) != SM_COMPRESS_OK || packed >= raw))
+		decision = SM_COMPRESS_PREDICT_WRONG;
+
+	if (decision != SM_COMPRESS_PREDICT_COMPRESS)
+	{
+		memcpy(slot + SM_COMPRESS_BLOCK_HEADER, run->src + start, raw);
+		packed = raw, flags = SM_COMPRESS_STORED;
+	}
+
+	run->decisions[k] = decision;
+
+	sm_compress_put(slot, (uint32_t)raw);
+	sm_compress_put(slot + 4, (uint32_t)packed);
+	sm_compress_put(slot + 8, sm_crc_32c(0, run->src + start, raw));
+	sm_compress_put(slot + 12, flags);
+}
+
+
+// Compresses the n raw bytes at p, at most a batch, and writes their blocks in order. Returns 1 on success.
+static uint8_t sm_compress_batch(sm_compress_stream_t* stream, const uint8_t* p, size_t n)
+{
+	sm_compress_run_t run = { p, n, stream->block, stream->level, stream->output, stream->tables, { 0 } };
+	register const size_t count = (n + stream->block - 1) / stream->block;
+	register const uint8_t* slot;
+	register size_t k, size;
+
+	sm_thread_parallel(sm_compress_task, &run, count, stream->threads);
+
+	for (k = 0; k < count; ++k)
+	{
+		slot = stream->output + (k * (SM_COMPRESS_BLOCK_HEADER + stream->block));
+		size = SM_COMPRESS_BLOCK_HEADER + sm_compress_get(slot + 4);
+
+		if (!stream->write(stream->target, slot, size))
+		{
+			stream->failed = 1;
+			return 0;
+		}
+
+		stream->packed += size;
+
+		switch (run.decisions[k])
+		{
+		case SM_COMPRESS_PREDICT_COMPRESS: stream->statistics.compressed++; break;
+		case SM_COMPRESS_PREDICT_WRONG: stream->statistics.stored++; break;
+		case SM_COMPRESS_PREDICT_UNIFORM: stream->statistics.uniform++, stream->statistics.skipped += size - SM_COMPRESS_BLOCK_HEADER; break;
+		case SM_COMPRESS_PREDICT_TRIAL: stream->statistics.trial++, stream->statistics.skipped += size - SM_COMPRESS_BLOCK_HEADER; break;
+		}
+	}
+
+	stream->blocks += count;
+	stream->raw += n;
+
+	return 1;
+}
+
+
+// Rounds N up to a whole count of words, so that the hash tables following the input and output of a stream are aligned.
+#define sm_compress_align(N) (((N) + (sizeof(uint64_t) - 1)) & ~(size_t)(sizeof(uint64_t) - 1))
+
+
+// Gets the size of the buffers of a stream.
+inline static size_t sm_compress_buffer_size(const sm_compress_stream_t* stream)
+{
+	return sm_compress_align(stream->batch * stream->block) + sm_compress_align(stream->batch * (SM_COMPRESS_BLOCK_HEADER + stream->block)) +
+		(stream->batch * SM_COMPRESS_TABLE);
+}
+
+
+// Writes to memory.
+static uint8_t sm_compress_sink(void* target, const void* p, size_t n)
+{
+	sm_compress_sink_t* sink = (sm_compress_sink_t*)target;
+
+	if (n > sink->left) return 0;
+
+	memcpy(sink->p, p, n);
+	sink->p += n, sink->left -= n;
+
+	return 1;
+}
+
+
+// Starts a compression stream.
+exported uint8_t callconv sm_compress_init(sm_t sm, sm_compress_stream_t* stream, size_t block, uint8_t level, uint32_t threads, sm_compress_write_f write, void* target)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+	uint8_t header[SM_COMPRESS_FRAME_HEADER];
+
+	if (!context || !stream) return 0;
+
+	if (!block) block = SM_COMPRESS_BLOCK;
+	if (!(level & (uint8_t)~SM_COMPRESS_ADAPTIVE)) level |= SM_COMPRESS_DEFAULT;
+
+	if (!write || block > SM_COMPRESS_BLOCK_MAXIMUM || (level & (uint8_t)~SM_COMPRESS_ADAPTIVE) > SM_COMPRESS_STRONG)
+	{
+		if (context->error)
+			context->error(context, SM_ERR_INVALID_ARGUMENT);
+
+		return 0;
+	}
+
+	if (!threads) threads = sm_thread_processors();
+
+	memset(stream, 0, sizeof(sm_compress_stream_t));
+
+	stream->sm = sm;
+	stream->block = block;
+	stream->level = level;
+	stream->batch = sm_min(threads, SM_THREAD_PARALLEL_MAXIMUM);
+	stream->threads = threads;
+	stream->write = write;
+	stream->target = target;
+	stream->buffer = (uint8_t*)context->memory.allocate(context->memory.allocator, sm_compress_buffer_size(stream));
+
+	if (!stream->buffer)
+	{
+		if (context->error)
+			context->error(context, SM_ERR_OUT_OF_MEMORY);
+
+		return 0;
+	}
+
+	stream->input = stream->buffer;
+	stream->output = stream->input + sm_compress_align(stream->batch * block);
+	stream->tables = stream->output + sm_compress_align(stream->batch * (SM_COMPRESS_BLOCK_HEADER + block));
+
+	sm_compress_put(header, SM_COMPRESS_MAGIC);
+	sm_compress_put(header + 4, (uint32_t)block);
+
+	if (!write(target, header, sizeof(header)))
+	{
+		context->memory.release(context->memory.allocator, stream->buffer);
+		stream->buffer = NULL;
+
+		return 0;
+	}
+
+	stream->packed = sizeof(header);
+
+	return 1;
+}
+
+
+// Adds raw bytes to a compression stream.
+exported uint8_t callconv sm_compress_update(sm_compress_stream_t* stream, const void* p, size_t n)
+{
+	if (!stream || !stream->buffer || stream->failed || (!p && n)) return 0;
+
+	if (!n) return 1;
+
+	register const uint8_t* q = (const uint8_t*)p;
+	register const size_t whole = stream->block * stream->batch;
+	register size_t k;
+
+	if (stream->filled)
+	{
+		k = sm_min(n, whole - stream->filled);
+
+		memcpy(stream->input + stream->filled, q, k);
+		stream->filled += k, q += k, n -= k;
+
+		if (stream->filled < whole) return 1;
+
+		stream->filled = 0;
+
+		if (!sm_compress_batch(stream, stream->input, whole)) return 0;
+	}
+
+	for (; n >= whole; n -= whole, q += whole) // Straight from the caller's bytes.
+		if (!sm_compress_batch(stream, q, whole)) return 0;
+
+	if (n) memcpy(stream->input, q, n);
+	stream->filled = n;
+
+	return 1;
+}
+
+
+// Finishes a compression stream.
+exported uint8_t callconv sm_compress_finish(sm_compress_stream_t* stream)
+{
+	if (!stream || !stream->buffer) return 0;
+
+	sm_context_t* context = (sm_context_t*)stream->sm;
+	uint8_t header[SM_COMPRESS_BLOCK_HEADER];
+
+	if (!stream->failed && stream->filled)
+		sm_compress_batch(stream, stream->input, stream->filled);
+
+	if (!stream->failed)
+	{
+		sm_compress_put(header, 0);
+		sm_compress_put(header + 4, 0);
+		sm_compress_put(header + 8, (uint32_t)stream->blocks);
+		sm_compress_put(header + 12, SM_COMPRESS_END);
+
+		if (stream->write(stream->target, header, sizeof(header)))
+			stream->packed += sizeof(header);
+		else stream->failed = 1;
+	}
+
+	sm_random_fill(stream->sm, stream->buffer, sm_compress_buffer_size(stream));
+	context->memory.release(context->memory.allocator, stream->buffer);
+
+	stream->buffer = stream->input = stream->output = stream->tables = NULL;
+	stream->filled = 0;
+
+	return !stream->failed;
+}
+
+
+// Compresses a buffer to a frame.
+exported uint8_t callconv sm_compress_frame(sm_t sm, const void* src, size_t n, void* dst, size_t* dlen, size_t block, uint8_t level, uint32_t threads, sm_compress_statistics_t* statistics)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+	sm_compress_stream_t stream;
+	sm_compress_sink_t sink;
+
+	if (!context) return 0;
+
+	if (!dst || !dlen || (!src && n))
+	{
+		if (context->error)
+			context->error(context, SM_ERR_INVALID_ARGUMENT);
+
+		return 0;
+	}
+
+	sink.p = (uint8_t*)dst, sink.left = *dlen;
+
+	if (!sm_compress_init(sm, &stream, block, level, threads, sm_compress_sink, &sink)) return 0;
+
+	sm_compress_update(&stream, src, n);
+
+	if (!sm_compress_finish(&stream)) return 0;
+
+	*dlen = (size_t)stream.packed;
+
+	if (statistics) *statistics = stream.statistics;
+
+	return 1;
+}
+
+
+// Opens a frame for decompression.
+exported uint8_t callconv sm_decompress_open(sm_t sm, sm_compress_frame_t* frame, const void* p, size_t n)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+	register const uint8_t* q = (const uint8_t*)p;
+	register size_t offset, raw, packed, k;
+	register uint32_t flags;
+	register uint8_t last = 0;
+
+	if (!context || !frame) return 0;
+
+	memset(frame, 0, sizeof(sm_compress_frame_t));
+
+	if (!q || n < SM_COMPRESS_FRAME_HEADER || sm_compress_get(q) != SM_COMPRESS_MAGIC) goto LOC_MALFORMED;
+
+	frame->block = sm_compress_get(q + 4);
+
+	if (!frame->block || frame->block > SM_COMPRESS_BLOCK_MAXIMUM) goto LOC_MALFORMED;
+
+	for (offset = SM_COMPRESS_FRAME_HEADER;; offset += SM_COMPRESS_BLOCK_HEADER + packed) // Check the headers.
+	{
+		if (n - offset < SM_COMPRESS_BLOCK_HEADER) goto LOC_MALFORMED;
+
+		raw = sm_compress_get(q + offset);
+		packed = sm_compress_get(q + offset + 4);
+		flags = sm_compress_get(q + offset + 12);
+
+		if (flags == SM_COMPRESS_END)
+		{
+			if (raw || packed || sm_compress_get(q + offset + 8) != (uint32_t)frame->blocks) goto LOC_MALFORMED;
+			break;
+		}
+
+		if (last || (flags & ~SM_COMPRESS_STORED) || !raw || raw > frame->block || !packed) goto LOC_MALFORMED; // Only the last block may be short.
+		if ((flags & SM_COMPRESS_STORED) ? (packed != raw) : (packed >= raw)) goto LOC_MALFORMED;
+		if (packed > n - offset - SM_COMPRESS_BLOCK_HEADER) goto LOC_MALFORMED;
+
+		last = raw < frame->block;
+		frame->blocks++;
+		frame->raw += raw;
+	}
+
+	frame->data = q;
+	frame->bytes = offset + SM_COMPRESS_BLOCK_HEADER;
+	frame->offsets = (size_t*)context->memory.allocate(context->memory.allocator, sm_max((size_t)frame->blocks, (size_t)1) * sizeof(size_t));
+
+	if (!frame->offsets)
+	{
+		if (context->error)
+			context->error(context, SM_ERR_OUT_OF_MEMORY);
+
+		return 0;
+	}
+
+	for (k = 0, offset = SM_COMPRESS_FRAME_HEADER; k < frame->blocks; ++k, offset += SM_COMPRESS_BLOCK_HEADER + sm_compress_get(q + offset + 4))
+		frame->offsets[k] = offset;
+
+	return 1;
+
+LOC_MALFORMED:
+
+	memset(frame, 0, sizeof(sm_compress_frame_t));
+
+	if (context->error)
+		context->error(context, SM_ERR_INVALID_ARGUMENT);
+
+	return 0;
+}
+
+
+// Decompresses block k of the frame to dst and checks its CRC. Returns 1 if it is intact.
+static uint8_t sm_decompress_one(const sm_compress_frame_t* frame, uint64_t k, uint8_t* dst)
+{
+	register const uint8_t* h = frame->data + frame->offsets[k];
+	register const uint32_t raw = sm_compress_get(h), packed = sm_compress_get(h + 4);
+	uint64_t n = raw;
+
+	if (sm_compress_get(h + 12) & SM_COMPRESS_STORED)
+		memcpy(dst, h + SM_COMPRESS_BLOCK_HEADER, raw);
+	else if (sm_decompress_buffer(h + SM_COMPRESS_BLOCK_HEADER, packed, dst, &n) != SM_COMPRESS_OK || n != raw)
+		return 0;
+
+	return sm_crc_32c(0, dst, raw) == sm_compress_get(h + 8);
+}
+
+
+// Decompresses block k of a parallel decompression.
+static void sm_decompress_task(void* p, size_t k)
+{
+	sm_decompress_run_t* run = (sm_decompress_run_t*)p;
+
+	if (!sm_decompress_one(run->frame, k, run->dst + (k * run->frame->block)))
+		sm_atomic_add_64(&run->failures, 1);
+}
+
+
+// Decompresses one block of a frame.
+exported uint8_t callconv sm_decompress_block(sm_t sm, const sm_compress_frame_t* frame, uint64_t index, void* dst)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+
+	if (!context) return 0;
+
+	if (!frame || !frame->offsets || index >= frame->blocks || !dst)
+	{
+		if (context->error)
+			context->error(context, SM_ERR_INVALID_ARGUMENT);
+
+		return 0;
+	}
+
+	if (sm_decompress_one(frame, index, (uint8_t*)dst)) return 1;
+
+	if (context->error)
+		context->error(context, SM_ERR_INVALID_CRC);
+
+	return 0;
+}
+
+
+// Decompresses a whole frame.
+exported uint8_t callconv sm_decompress_frame(sm_t sm, const sm_compress_frame_t* frame, void* dst, uint32_t threads)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+
+	if (!context) return 0;
+
+	if (!frame || !frame->offsets || (!dst && frame->raw))
+	{
+		if (context->error)
+			context->error(context, SM_ERR_INVALID_ARGUMENT);
+
+		return 0;
+	}
+
+	sm_decompress_run_t run = { frame, (uint8_t*)dst, 0 };
+
+	sm_thread_parallel(sm_decompress_task, &run, (size_t)frame->blocks, threads);
+
+	if (!run.failures) return 1;
+
+	if (context->error)
+		context->error(context, SM_ERR_INVALID_CRC);
+
+	return 0;
+}
+
+
+// Closes a frame.
+exported void callconv sm_decompress_close(sm_t sm, sm_compress_frame_t* frame)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+
+	if (!context || !frame) return;
+
+	if (frame->offsets)
+		context->memory.release(context->memory.allocator, frame->offsets);
+
+	memset(frame, 0, sizeof(sm_compress_frame_t));
+}
@@ -0,0 +1,194 @@
+// compress.h - Block-framed streaming compression.
+
+
+#include "config.h"
+#include "sm.h"
+
+
+#ifndef INCLUDE_COMPRESS_H
+#define INCLUDE_COMPRESS_H 1
+
+
+// Codec return codes, as for sec_compress and sec_decompress.
+#define SM_COMPRESS_OK        0 // Success.
+#define SM_COMPRESS_SIZE      1 // Output buffer too small.
+#define SM_COMPRESS_CORRUPT   2 // Invalid data for decompression.
+#define SM_COMPRESS_ARGUMENTS 3 // Arguments invalid.
+
+// The farthest back a match may start, and the longest match, of the sec_compress format.
+#define SM_COMPRESS_WINDOW 0x2000U
+#define SM_COMPRESS_MATCH_MAXIMUM 0x108U
+
+// The size of the hash table sm_compress_level needs: the last position of each of 2^16 hashes, and a chain link for each
+// position in the window.
+#define SM_COMPRESS_TABLE (sizeof(uint32_t) * (0x10000U + SM_COMPRESS_WINDOW))
+
+// Compression levels. All give output in the format of sec_compress.
+#define SM_COMPRESS_FAST    1 // One probe per position, stepping further the longer no match is found.
+#define SM_COMPRESS_NORMAL  2 // One probe per position, as sec_compress.
+#define SM_COMPRESS_STRONG  3 // Up to SM_COMPRESS_CHAIN probes per position along hash chains, with lazy matching.
+#define SM_COMPRESS_DEFAULT SM_COMPRESS_NORMAL
+
+// The most earlier positions SM_COMPRESS_STRONG tries for a match.
+#define SM_COMPRESS_CHAIN 16U
+
+// A flag of the level of a stream: blocks predicted by sm_compress_predict not to compress are stored raw untried.
+#define SM_COMPRESS_ADAPTIVE 0x80U
+
+
+// Compression prediction. A block is worth compressing if it shrinks by 1 / SM_COMPRESS_GAIN or more. Blocks of random
+// bytes, such as keys, are told by a byte histogram of a sample of them, whose collision entropy is above log2 of
+// SM_COMPRESS_UNIFORM bits. Other blocks that do not compress, such as encoded tokens, are told by a trial at
+// SM_COMPRESS_NORMAL on their first SM_COMPRESS_SAMPLE bytes.
+
+#define SM_COMPRESS_GAIN 16U
+#define SM_COMPRESS_UNIFORM 222U // 7.8 bits of 8.
+#define SM_COMPRESS_SAMPLE 0x1000U
+
+// Predictions, and the decision recorded for each block.
+#define SM_COMPRESS_PREDICT_COMPRESS 0 // Worth compressing, or too short to tell.
+#define SM_COMPRESS_PREDICT_UNIFORM  1 // The byte histogram is near uniform.
+#define SM_COMPRESS_PREDICT_TRIAL    2 // The trial fell short.
+#define SM_COMPRESS_PREDICT_WRONG    3 // Compressed as predicted, but did not shrink, so stored raw.
+
+// The most bytes sm_compress_buffer writes for N bytes of input, which are all literals: a control byte per 32.
+#define sm_compress_bound(N) ((N) + (((N) + 31U) / 32U))
+
+
+// Frames. A frame is a header, blocks, and an end header. The frame header is the magic and the raw size of a block, and
+// each block is a header of its raw size, its compressed size, the CRC32C of its raw bytes and its flags, followed by its
+// compressed bytes. Every block but the last holds the frame's block size of raw bytes, so that the block holding any
+// raw offset is known, and each decodes alone. The end header has zero sizes and the count of blocks in place of the
+// CRC. All fields are 32-bit little-endian.
+
+// The frame magic, "SMCF".
+#define SM_COMPRESS_MAGIC 0x46434D53U
+
+// The size of the frame header.
+#define SM_COMPRESS_FRAME_HEADER 8U
+
+// The size of a block header, and of the end header.
+#define SM_COMPRESS_BLOCK_HEADER 16U
+
+// The default, and the largest, raw size of a block.
+#define SM_COMPRESS_BLOCK 0x10000U
+#define SM_COMPRESS_BLOCK_MAXIMUM 0x1000000U
+
+// Block flags.
+#define SM_COMPRESS_STORED 0x01U // The block is stored raw, having not compressed.
+#define SM_COMPRESS_END    0x80U // The end header.
+
+// The most bytes of a frame of N raw bytes in blocks of B. A block that does not compress is stored raw.
+#define sm_compress_frame_bound(N, B) (SM_COMPRESS_FRAME_HEADER + ((((N) + (B) - 1U) / (B)) + 1U) * SM_COMPRESS_BLOCK_HEADER + (N))
+
+
+// Writes n bytes at p to the target of a stream. Returns 1 on success.
+typedef uint8_t (*sm_compress_write_f)(void* target, const void* p, size_t n);
+
+
+// Compression statistics: the decision taken for each block.
+typedef struct sm_compress_statistics_s
+{
+	uint64_t compressed; // The count of blocks compressed.
+	uint64_t stored; // The count of blocks stored raw after not shrinking when compressed.
+	uint64_t uniform; // The count of blocks stored raw untried, by SM_COMPRESS_PREDICT_UNIFORM.
+	uint64_t trial; // The count of blocks stored raw untried, by SM_COMPRESS_PREDICT_TRIAL.
+	uint64_t skipped; // The count of raw bytes of blocks stored untried.
+}
+sm_compress_statistics_t;
+
+
+// A compression stream. Raw bytes are buffered until a batch of blocks is full, then the blocks are compressed at once,
+// one per thread, and written in order, so memory is bounded by the batch whatever the length of the stream.
+typedef struct sm_compress_stream_s
+{
+	sm_t sm; // The context.
+	size_t block; // The raw size of a block.
+	uint8_t level; // The compression level, maybe with SM_COMPRESS_ADAPTIVE. May be changed between updates.
+	uint32_t batch; // The count of blocks compressed at once.
+	uint32_t threads; // The count of threads compressing a batch.
+	sm_compress_write_f write; // Writes the frame.
+	void* target; // The argument of write.
+	uint8_t* buffer; // The allocation holding input, output and tables.
+	uint8_t* input; // The batch of raw bytes.
+	size_t filled; // The count of raw bytes in input.
+	uint8_t* output; // One slot of a header and block raw bytes per block of the batch.
+	uint8_t* tables; // One hash table per block of the batch.
+	uint64_t blocks; // The count of blocks written.
+	uint64_t raw; // The count of raw bytes taken.
+	uint64_t packed; // The count of frame bytes written.
+	sm_compress_statistics_t statistics; // The decisions taken for the blocks written.
+	uint8_t failed; // Whether a write or compression has failed.
+}
+sm_compress_stream_t;
+
+
+// A frame opened for decompression, with the offset of every block, for random access.
+typedef struct sm_compress_frame_s
+{
+	const uint8_t* data; // The frame.
+	size_t bytes; // The size of the frame, up to the end of its end header.
+	size_t block; // The raw size of a block.
+	uint64_t blocks; // The count of blocks.
+	uint64_t raw; // The count of raw bytes.
+	size_t* offsets; // The offset of each block header.
+}
+sm_compress_frame_t;
+
+
+// Compresses slen bytes at src to dst, of *dlen bytes, in the format of sec_compress, at the given level, zero for
+// SM_COMPRESS_DEFAULT. htab is SM_COMPRESS_TABLE bytes. Sets *dlen to the bytes written and returns SM_COMPRESS_OK, or
+// returns SM_COMPRESS_SIZE if dst is too small, which sm_compress_bound(slen) bytes never are.
+exported uint8_t callconv sm_compress_level(const void *const src, const uint64_t slen, void *dst, uint64_t *const dlen, void* htab, uint8_t level);
+
+// Compresses at SM_COMPRESS_DEFAULT, with the sm_cpr_f signature, as for sm_compress_level.
+exported uint8_t callconv sm_compress_buffer(const void *const src, const uint64_t slen, void *dst, uint64_t *const dlen, void* htab);
+
+// Predicts whether the n bytes at p are worth compressing, as above. htab is SM_COMPRESS_TABLE bytes, for the trial.
+// Returns SM_COMPRESS_PREDICT_COMPRESS, or the reason they are not.
+exported uint8_t callconv sm_compress_predict(const void* p, size_t n, void* htab);
+
+// Decompresses slen bytes at src to dst, of *dlen bytes, with the sm_dcp_f signature, taking the output of sec_compress
+// or sm_compress_level. Sets *dlen to the bytes written and returns SM_COMPRESS_OK. If dst is null and *dlen is zero,
+// or dst is too small, sets *dlen to the size needed and returns SM_COMPRESS_OK or SM_COMPRESS_SIZE respectively. Away
+// from the ends of src and dst, literals and matches are copied in whole words, without bounds checks, so bytes of dst
+// past the output may be overwritten; any input is safe, and is checked byte by byte near the ends.
+exported uint8_t callconv sm_decompress_buffer(const void* src, uint64_t slen, void* dst, uint64_t* dlen);
+
+// Starts a frame with blocks of the given raw size, zero for SM_COMPRESS_BLOCK, written to write(target, ...) as they are
+// made, and compressed at the given level, zero for SM_COMPRESS_DEFAULT, with SM_COMPRESS_ADAPTIVE for only those blocks
+// predicted to compress, on up to the given count of threads, zero for one per processor. Writes the frame header.
+// Returns 1 on success, or 0 if the arguments are invalid or the buffers cannot be allocated.
+exported uint8_t callconv sm_compress_init(sm_t sm, sm_compress_stream_t* stream, size_t block, uint8_t level, uint32_t threads, sm_compress_write_f write, void* target);
+
+// Adds n raw bytes at p to the stream, writing any batches of blocks they fill. Whole batches are compressed from p, not
+// copied. Returns 1 on success, or 0 if a write has failed.
+exported uint8_t callconv sm_compress_update(sm_compress_stream_t* stream, const void* p, size_t n);
+
+// Writes the blocks left in the stream and the end header, then releases the stream's buffers, wiped. Returns 1 if the
+// whole frame was written.
+exported uint8_t callconv sm_compress_finish(sm_compress_stream_t* stream);
+
+// Compresses n bytes at src to a frame at dst, of *dlen bytes, which sm_compress_frame_bound(n, block) bytes always
+// suffice for, as for a stream of the given block size, level and threads. Sets *dlen to the size of the frame, and the
+// statistics, if not null, to those of the stream. Returns 1 on success.
+exported uint8_t callconv sm_compress_frame(sm_t sm, const void* src, size_t n, void* dst, size_t* dlen, size_t block, uint8_t level, uint32_t threads, sm_compress_statistics_t* statistics);
+
+// Opens the frame of up to n bytes at p, checking its headers and recording the offset of every block. The frame must
+// stay in place until closed. Returns 1 on success, or 0 if the frame is malformed or the index cannot be allocated.
+exported uint8_t callconv sm_decompress_open(sm_t sm, sm_compress_frame_t* frame, const void* p, size_t n);
+
+// Decompresses block index of the frame to dst, of at least the frame's block size, and checks its CRC. The block holds
+// raw bytes [index * block .. min(raw, (index + 1) * block)). Returns 1 on success, or 0, raising SM_ERR_INVALID_CRC, if
+// the block is corrupt.
+exported uint8_t callconv sm_decompress_block(sm_t sm, const sm_compress_frame_t* frame, uint64_t index, void* dst);
+
+// Decompresses every block of the frame to dst, of the frame's raw size, on up to the given count of threads, zero for
+// one per processor, and checks their CRCs. Returns 1 on success, or 0 as for sm_decompress_block.
+exported uint8_t callconv sm_decompress_frame(sm_t sm, const sm_compress_frame_t* frame, void* dst, uint32_t threads);
+
+// Releases the index of the frame.
+exported void callconv sm_decompress_close(sm_t sm, sm_compress_frame_t* frame);
+
+
+#endif // INCLUDE_COMPRESS_H
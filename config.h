@@ -67,6 +67,10 @@ extern uint64_t getunh();
 #define restrict __restrict
 #define halign(b) __declspec(align(b))
 #define talign(b)
+#define tlocal __declspec(thread)
+#define sm_target(T)
+#define sm_atomic_add_64(P, V) ((uint64_t)InterlockedExchangeAdd64((volatile LONG64*)(P), (LONG64)(V)))
+#define sm_atomic_cas_64(P, E, D) (InterlockedCompareExchange64((volatile LONG64*)(P), (LONG64)(D), (LONG64)(E)) == (LONG64)(E))
 
 #elif defined(SM_OS_LINUX)
 
@@ -74,6 +78,10 @@ extern uint64_t getunh();
 #define restrict __restrict
 #define halign(b)
 #define talign(b) __attribute__((aligned(b),packed))
+#define tlocal __thread
+#define sm_target(T) __attribute__((target(T)))
+#define sm_atomic_add_64(P, V) ((uint64_t)__atomic_fetch_add((P), (V), __ATOMIC_RELAXED))
+#define sm_atomic_cas_64(P, E, D) __extension__({ uint64_t e__ = (E); __atomic_compare_exchange_n((P), &e__, (D), 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); })
 #include <unistd.h>
 #include <pthread.h>
 typedef pthread_mutex_t sm_mutex_t;
@@ -82,6 +90,11 @@ typedef pthread_mutex_t sm_mutex_t;
 
 #define inline
 #define restrict
+#define tlocal _Thread_local
+#define sm_target(T)
+// sm_atomic_add_64 adds V to the 64-bit value at P and returns the previous value, as on the other platforms.
+#define sm_atomic_add_64(P, V) ((uint64_t)((*(P) += (V)) - (V)))
+#define sm_atomic_cas_64(P, E, D) ((*(P) == (E)) ? (*(P) = (D), 1) : 0)
 
 #endif
 
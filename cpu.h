@@ -0,0 +1,105 @@
+// cpu.h - Processor feature detection.
+
+
+#include "config.h"
+
+
+#ifndef INCLUDE_CPU_H
+#define INCLUDE_CPU_H 1
+
+
+#if defined(SM_OS_WINDOWS)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+
+// Processor feature flags.
+
+#define SM_CPU_SSE2			UINT32_C(0x00000001)
+#define SM_CPU_SSSE3		UINT32_C(0x00000002)
+#define SM_CPU_SSE41		UINT32_C(0x00000004)
+#define SM_CPU_SSE42		UINT32_C(0x00000008)
+#define SM_CPU_PCLMUL		UINT32_C(0x00000010)
+#define SM_CPU_AVX			UINT32_C(0x00000020)
+#define SM_CPU_AVX2			UINT32_C(0x00000040)
+#define SM_CPU_BMI2			UINT32_C(0x00000080)
+#define SM_CPU_AVX512F		UINT32_C(0x00000100)
+#define SM_CPU_AVX512BW		UINT32_C(0x00000200)
+#define SM_CPU_VPCLMUL		UINT32_C(0x00000400)
+#define SM_CPU_DETECTED		UINT32_C(0x80000000)
+
+
+// Executes CPUID for the given leaf and sub-leaf, storing EAX, EBX, ECX and EDX in r.
+inline static void sm_cpu_id(uint32_t leaf, uint32_t sub, uint32_t r[4])
+{
+#if defined(SM_OS_WINDOWS)
+	__cpuidex((int*)r, (int)leaf, (int)sub);
+#else
+	__cpuid_count(leaf, sub, r[0], r[1], r[2], r[3]);
+#endif
+}
+
+
+// Reads XCR0, the register state the operating system saves on a context switch. Only valid if OSXSAVE is set.
+inline static uint64_t sm_cpu_xcr0()
+{
+#if defined(SM_OS_WINDOWS)
+	return (uint64_t)_xgetbv(0);
+#else
+	uint32_t a, d;
+	__asm__ volatile ("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+	return ((uint64_t)d << 32) | a;
+#endif
+}
+
+
+// Gets the SM_CPU_* flags of the processor, detected on the first call. AVX and AVX-512 features are only reported if the
+// operating system saves the wider registers.
+inline static uint32_t sm_cpu_features()
+{
+	static volatile uint32_t features = 0;
+
+	if (features & SM_CPU_DETECTED) return features;
+
+	register uint32_t f = SM_CPU_DETECTED;
+	uint32_t r[4] = { 0, 0, 0, 0 };
+
+	sm_cpu_id(0, 0, r);
+
+	register const uint32_t leaves = r[0];
+
+	if (leaves >= 1)
+	{
+		sm_cpu_id(1, 0, r);
+
+		if (r[3] & (1U << 26)) f |= SM_CPU_SSE2;
+		if (r[2] & (1U << 9)) f |= SM_CPU_SSSE3;
+		if (r[2] & (1U << 19)) f |= SM_CPU_SSE41;
+		if (r[2] & (1U << 20)) f |= SM_CPU_SSE42;
+		if (r[2] & (1U << 1)) f |= SM_CPU_PCLMUL;
+
+		register const uint64_t xcr0 = (r[2] & (1U << 27)) ? sm_cpu_xcr0() : 0; // OSXSAVE.
+		register const bool ymm = (xcr0 & 0x06) == 0x06; // XMM and YMM state.
+		register const bool zmm = (xcr0 & 0xE6) == 0xE6; // And opmask and ZMM state.
+
+		if (ymm && (r[2] & (1U << 28))) f |= SM_CPU_AVX;
+
+		if (leaves >= 7)
+		{
+			sm_cpu_id(7, 0, r);
+
+			if (r[1] & (1U << 8)) f |= SM_CPU_BMI2;
+			if ((f & SM_CPU_AVX) && (r[1] & (1U << 5))) f |= SM_CPU_AVX2;
+			if ((f & SM_CPU_AVX) && (r[2] & (1U << 10))) f |= SM_CPU_VPCLMUL;
+			if (zmm && (r[1] & (1U << 16))) f |= SM_CPU_AVX512F;
+			if (zmm && (r[1] & (1U << 30))) f |= SM_CPU_AVX512BW;
+		}
+	}
+
+	return features = f;
+}
+
+
+#endif // INCLUDE_CPU_H
@@ -13,6 +13,8 @@
 
 #define SEC_OP_HRDRND64 (0x4300U) // Tests for rdrand support: sec_g64_f.
 #define SEC_OP_RDRAND64 (0x9ADFU) // Read rand via rdrand: sec_g64_f.
+#define SEC_OP_HRDSED64 (0x61B4U) // Tests for rdseed support: sec_g64_f.
+#define SEC_OP_RDSEED64 (0xE27CU) // Read seed via rdseed: sec_g64_f.
 
 #define SEC_OP_SHRGML64 (0xF661U) // Multiply using Schrage's method: sec_sch_t;
 
@@ -0,0 +1,198 @@
+// entropy.c - Process-wide system entropy pool.
+
+
+#include <time.h>
+
+
+#include "config.h"
+#include "bits.h"
+#include "fork.h"
+#include "entropy.h"
+
+
+#if defined(SM_OS_WINDOWS)
+
+#include <ntsecapi.h>
+
+static SRWLOCK sm_entropy_lock__ = SRWLOCK_INIT;
+
+#define sm_entropy_enter() AcquireSRWLockExclusive(&sm_entropy_lock__)
+#define sm_entropy_leave() ReleaseSRWLockExclusive(&sm_entropy_lock__)
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+
+#ifndef GRND_NONBLOCK
+#define GRND_NONBLOCK 0x0001
+#endif
+
+static pthread_mutex_t sm_entropy_lock__ = PTHREAD_MUTEX_INITIALIZER;
+
+#define sm_entropy_enter() pthread_mutex_lock(&sm_entropy_lock__)
+#define sm_entropy_leave() pthread_mutex_unlock(&sm_entropy_lock__)
+
+#endif
+
+
+// The process-wide entropy pool.
+static struct
+{
+	uint64_t generation; // The fork generation the pool was filled in.
+	uint8_t stale; // Set when the pool must be refreshed before the next read.
+	uint8_t strong; // Set if the pool contents came from the system source alone.
+	size_t used; // The count of pool bytes consumed.
+	time_t stamp; // The time of the last refresh.
+	uint8_t bytes[SM_ENTROPY_POOL_SIZE]; // The pool.
+}
+sm_entropy_pool__ = { 0, 1, 0, SM_ENTROPY_POOL_SIZE, 0, { 0 } };
+
+
+// Reads n bytes into p from the system source without blocking. Returns 1 on success, else 0.
+inline static uint8_t sm_entropy_system(uint8_t* p, size_t n)
+{
+#if defined(SM_OS_WINDOWS)
+
+	return RtlGenRandom(p, (ULONG)n) ? 1 : 0;
+
+#else
+
+	long r;
+	int f;
+
+	while (n > 0)
+	{
+		r = syscall(SYS_getrandom, p, n, GRND_NONBLOCK);
+
+		if (r > 0)
+		{
+			p += r;
+			n -= (size_t)r;
+		}
+		else if (r < 0 && errno == EINTR) continue;
+		else break;
+	}
+
+	if (n == 0) return 1;
+
+	if (errno != ENOSYS) return 0; // Not yet seeded at early boot; the fallback is mixed in and the pool retried on next read.
+
+	// Kernels before getrandom. The urandom device never blocks.
+
+	if ((f = open("/dev/urandom", O_RDONLY | O_CLOEXEC)) < 0) return 0;
+
+	while (n > 0)
+	{
+		r = read(f, p, n);
+
+		if (r > 0)
+		{
+			p += r;
+			n -= (size_t)r;
+		}
+		else if (r < 0 && errno == EINTR) continue;
+		else break;
+	}
+
+	close(f);
+
+	return (n == 0) ? 1 : 0;
+
+#endif
+}
+
+
+// Mixes time, clock and address measures into the pool, for when the system source is unavailable.
+inline static void sm_entropy_fallback(uint8_t* p, size_t n)
+{
+	uint8_t a = 0;
+	register uint64_t z = 0, s = (uint64_t)time(NULL) ^ sm_shuffle_64((uint64_t)clock()) ^ sm_yellow_64((uint64_t)(uintptr_t)&a);
+	register size_t i;
+
+#if defined(SM_OS_WINDOWS)
+	s ^= sm_green_64(GetTickCount64());
+#else
+	s ^= sm_green_64((uint64_t)getpid());
+#endif
+
+	for (i = 0; i < n; ++i)
+	{
+		if ((i & 7) == 0)
+		{
+			z = (s += UINT64_C(0x9E3779B97F4A7C15));
+			z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+			z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+			z ^= (z >> 31);
+		}
+
+		p[i] ^= (uint8_t)(z >> ((i & 7) << 3));
+	}
+}
+
+
+// Refreshes the pool. The pool lock must be held.
+inline static uint8_t sm_entropy_refresh__(void)
+{
+	sm_entropy_pool__.generation = sm_fork_generation();
+	sm_entropy_pool__.strong = sm_entropy_system(sm_entropy_pool__.bytes, SM_ENTROPY_POOL_SIZE);
+
+	if (!sm_entropy_pool__.strong)
+		sm_entropy_fallback(sm_entropy_pool__.bytes, SM_ENTROPY_POOL_SIZE);
+
+	sm_entropy_pool__.used = 0;
+	sm_entropy_pool__.stamp = time(NULL);
+	sm_entropy_pool__.stale = !sm_entropy_pool__.strong; // Retry the system source next time if it failed.
+
+	return sm_entropy_pool__.strong;
+}
+
+
+exported uint8_t callconv sm_entropy_read(void* p, size_t n)
+{
+	register uint8_t* d = (uint8_t*)p;
+	register size_t i, k;
+	uint8_t strong = 1;
+
+	if (!p) return 0;
+
+	sm_entropy_enter();
+
+	while (n > 0)
+	{
+		if (sm_entropy_pool__.stale || sm_entropy_pool__.generation != sm_fork_generation() || sm_entropy_pool__.used == SM_ENTROPY_POOL_SIZE || (time(NULL) - sm_entropy_pool__.stamp) > SM_ENTROPY_REFRESH_SECONDS)
+			(void)sm_entropy_refresh__();
+
+		strong &= sm_entropy_pool__.strong;
+
+		k = sm_min(n, SM_ENTROPY_POOL_SIZE - sm_entropy_pool__.used);
+
+		for (i = 0; i < k; ++i) // Consumed bytes are cleared, so they are never handed out twice.
+		{
+			*d++ = sm_entropy_pool__.bytes[sm_entropy_pool__.used];
+			sm_entropy_pool__.bytes[sm_entropy_pool__.used++] = 0;
+		}
+
+		n -= k;
+	}
+
+	sm_entropy_leave();
+
+	return strong;
+}
+
+
+exported uint8_t callconv sm_entropy_refresh(void)
+{
+	uint8_t r;
+
+	sm_entropy_enter();
+
+	r = sm_entropy_refresh__();
+
+	sm_entropy_leave();
+
+	return r;
+}
+
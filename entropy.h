@@ -0,0 +1,29 @@
+// entropy.h - Process-wide system entropy pool.
+
+
+#include "config.h"
+
+
+#ifndef INCLUDE_ENTROPY_H
+#define INCLUDE_ENTROPY_H 1
+
+
+// The count of bytes the pool holds between refreshes.
+#define SM_ENTROPY_POOL_SIZE 512U
+
+// The pool is refreshed once it is older than this many seconds, even if not drained.
+#define SM_ENTROPY_REFRESH_SECONDS 60
+
+
+// Fills n bytes at p from the process-wide entropy pool, refreshing the pool from the system source when it is drained,
+// stale, or was inherited across a fork. Never blocks and does no file I/O while the system call is available. Returns 1 
+// if all bytes came from the system source, or 0 if a weaker fallback had to be mixed in.
+exported uint8_t callconv sm_entropy_read(void* p, size_t n);
+
+// Refreshes the process-wide entropy pool from the system source now. Returns 1 on success, or 0 if a weaker fallback had
+// to be mixed in.
+exported uint8_t callconv sm_entropy_refresh(void);
+
+
+#endif // INCLUDE_ENTROPY_H
+
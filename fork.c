@@ -0,0 +1,101 @@
+// fork.c - Process fork detection.
+
+
+#include "config.h"
+#include "fork.h"
+
+
+#if defined(SM_OS_WINDOWS)
+
+static SRWLOCK sm_fork_lock__ = SRWLOCK_INIT;
+
+#define sm_fork_enter() AcquireSRWLockExclusive(&sm_fork_lock__)
+#define sm_fork_leave() ReleaseSRWLockExclusive(&sm_fork_lock__)
+
+#else
+
+#include <sys/mman.h>
+
+#ifndef MADV_WIPEONFORK
+#define MADV_WIPEONFORK 18
+#endif
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+static pthread_mutex_t sm_fork_lock__ = PTHREAD_MUTEX_INITIALIZER;
+
+#define sm_fork_enter() pthread_mutex_lock(&sm_fork_lock__)
+#define sm_fork_leave() pthread_mutex_unlock(&sm_fork_lock__)
+
+#endif
+
+
+volatile uint64_t* sm_fork_marker__ = NULL;
+
+// The last generation assigned in this process, or in its parent before the fork. Unlike the marker it is inherited, so
+// a child never takes a generation its parent has used.
+static volatile uint64_t sm_fork_last__ = 0;
+
+
+#if !defined(SM_OS_WINDOWS)
+
+// Clears the marker in a forked child, where the kernel cannot wipe it.
+static void sm_fork_atfork_child(void)
+{
+	if (sm_fork_marker__) *sm_fork_marker__ = 0;
+}
+
+#endif
+
+
+// Sets up the marker: on its own page, wiped in a child by the kernel, or else cleared by a fork handler.
+inline static volatile uint64_t* sm_fork_map(void)
+{
+#if defined(SM_OS_WINDOWS)
+
+	static uint64_t marker = 0; // Processes are never forked.
+	return &marker;
+
+#else
+
+	static uint64_t marker = 0;
+	register const size_t size = (size_t)sysconf(_SC_PAGESIZE);
+	void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (p != MAP_FAILED && madvise(p, size, MADV_WIPEONFORK) == 0) return (volatile uint64_t*)p;
+
+	if (p != MAP_FAILED) munmap(p, size); // Kernels before 4.14.
+
+	pthread_atfork(NULL, NULL, sm_fork_atfork_child);
+
+	return &marker;
+
+#endif
+}
+
+
+exported uint64_t callconv sm_fork_renew(void)
+{
+	register volatile uint64_t* m = sm_fork_marker__;
+	register uint64_t g;
+
+	if (!m)
+	{
+		sm_fork_enter();
+
+		if (!sm_fork_marker__) sm_fork_marker__ = sm_fork_map();
+		m = sm_fork_marker__;
+
+		sm_fork_leave();
+	}
+
+	if ((g = *m) != 0) return g; // Renewed by another thread.
+
+	g = sm_atomic_add_64(&sm_fork_last__, 1) + 1;
+
+	if (sm_atomic_cas_64(m, 0, g)) return g;
+
+	return *m; // Another thread renewed first.
+}
@@ -0,0 +1,35 @@
+// fork.h - Process fork detection.
+
+
+#include "config.h"
+
+
+#ifndef INCLUDE_FORK_H
+#define INCLUDE_FORK_H 1
+
+
+// The fork generation marker. Null until first used, and the marker is zero again in a child process after a fork.
+extern volatile uint64_t* sm_fork_marker__;
+
+
+// Assigns the calling process a new fork generation if its marker is unset or was wiped by a fork, and returns the
+// current generation. Called by sm_fork_generation, which should be used instead.
+exported uint64_t callconv sm_fork_renew(void);
+
+
+// Gets the fork generation of the calling process. A child process gets a new generation after a fork, so that state
+// copied from the parent can be told apart by the generation it was made in. The marker is kept on a page the kernel
+// wipes in the child (MADV_WIPEONFORK), or cleared by a pthread_atfork handler where that is unsupported, so this is a
+// plain load, with no system call, unless a fork has just happened.
+inline static uint64_t sm_fork_generation(void)
+{
+	register volatile uint64_t* m = sm_fork_marker__;
+	register uint64_t g;
+
+	if (m && (g = *m) != 0) return g;
+
+	return sm_fork_renew();
+}
+
+
+#endif // INCLUDE_FORK_H
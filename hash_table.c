@@ -8,11 +8,47 @@
 #include <string.h>
 #include <stdbool.h>
 #include <intrin.h>
+#include <emmintrin.h>
 #include <limits.h>
 
 #include "sm.h"
 #include "sm_internal.h"
 #include "hash_table.h"
+#include "ticks.h"
+#include "hashing.h"
+
+
+// Bucket flag accessors. Each bucket has two bits in the flags vector: bit 1 marks it empty, and bit 0 marks it deleted.
+#define sm_hash_table_is_empty(F, I) (((F)[(I) >> 4ULL] >> (((I) & 15ULL) << 1ULL)) & 2ULL)
+#define sm_hash_table_is_deleted(F, I) (((F)[(I) >> 4ULL] >> (((I) & 15ULL) << 1ULL)) & 1ULL)
+#define sm_hash_table_is_either(F, I) (((F)[(I) >> 4ULL] >> (((I) & 15ULL) << 1ULL)) & 3ULL)
+#define sm_hash_table_set_deleted(F, I) ((F)[(I) >> 4ULL] |= 1ULL << (((I) & 15ULL) << 1ULL))
+#define sm_hash_table_set_occupied(F, I) ((F)[(I) >> 4ULL] &= ~(3ULL << (((I) & 15ULL) << 1ULL)))
+#define sm_hash_table_set_empty(F, I) ((F)[(I) >> 4ULL] = ((F)[(I) >> 4ULL] & ~(3ULL << (((I) & 15ULL) << 1ULL))) | (2ULL << (((I) & 15ULL) << 1ULL)))
+
+// Tests whether the table is still using its inline storage.
+#define sm_hash_table_is_inline(O) ((O)->keys == (O)->small.keys)
+
+// The most occupied buckets of a generation of B buckets, at the maximum load factor.
+#define sm_hash_table_upper(B) ((uint64_t)((B) * 0.77 + 0.5))
+
+
+// Internals
+
+
+uint64_t sm_hash_table_default_hasher(const void* data, size_t size);
+inline static bool sm_hash_table_enter__(sm_hash_table_t *restrict object);
+inline static uint64_t sm_hash_table_hash__(sm_hash_table_t *restrict object, void* key);
+inline static void sm_hash_table_record__(uint64_t* histogram, uint64_t length);
+inline static bool sm_hash_table_resize__(sm_hash_table_t *restrict object, uint64_t buckets);
+inline static bool sm_hash_table_grow__(sm_hash_table_t *restrict object, uint64_t buckets);
+inline static bool sm_hash_table_rebuild__(sm_hash_table_t *restrict object, uint64_t buckets);
+inline static void sm_hash_table_migrate__(sm_hash_table_t *restrict object, uint64_t steps);
+inline static sm_rc sm_hash_table_find__(sm_hash_table_t *restrict object, void* key, sm_hash_table_iterator* result);
+inline static sm_rc sm_hash_table_insert__(sm_hash_table_t *restrict object, void* key, void* value, sm_hash_table_iterator* result);
+inline static sm_rc sm_hash_table_remove_at__(sm_hash_table_t *restrict object, sm_hash_table_iterator iterator);
+inline static sm_rc sm_hash_table_exists_at__(sm_hash_table_t *restrict object, sm_hash_table_iterator iterator, bool* result);
+inline static sm_rc sm_hash_table_get_value__(sm_hash_table_t *restrict object, sm_hash_table_iterator iterator, void** result);
 
 
 // Methods
@@ -25,7 +61,6 @@ exported sm_rc callconv sm_hash_table_create(sm_t sm, sm_hash_table_t** object,
 
 	if (!sm) return SM_RC_OBJECT_NULL;
 	if (!object) return SM_RC_OBJECT_NULL;
-	if (!hasher) return SM_RC_ARGUMENT_NULL;
 
 	*object = NULL;
 
@@ -43,14 +78,23 @@ exported sm_rc callconv sm_hash_table_create(sm_t sm, sm_hash_table_t** object,
 	temp->initialized = 1;
 	temp->crc = 0;
 	temp->context = context;
-	temp->hasher = hasher;
+	temp->hasher = (hasher == sm_hash_table_default_hasher) ? NULL : hasher;
+	temp->seed[0] = context->random.method(context);
+	temp->seed[1] = context->random.method(context);
 	temp->key = size;
+	temp->incremental = 1;
+
+	temp->small.flags = 0xAAAAAAAAUL;
+	temp->flags = &temp->small.flags;
+	temp->keys = temp->small.keys;
+	temp->values = temp->small.values;
+	temp->buckets = temp->upper = SM_HASH_TABLE_INLINE_CAPACITY;
+
+	sm_hash_table_seal(context, temp);
 
 	if (!context->synchronization.create(&temp->mutex))
 	{
-		p = (uint8_t*)temp;
-		n = sizeof(sm_hash_table_t);
-		while (n-- > 0U) *p++ = (uint8_t)context->random.method(context);
+		sm_random_fill(context, temp, sizeof(sm_hash_table_t));
 
 		context->memory.release(context->memory.allocator, temp);
 
@@ -73,26 +117,38 @@ exported sm_rc callconv sm_hash_table_destroy(sm_hash_table_t** object)
 
 	sm_context_t* context = temp->context;
 
-	if (!context->synchronization.enter(&temp->mutex)) 
+	if (!context->synchronization.enter(&temp->mutex))
 		return SM_RC_OPERATION_BLOCKED;
 
 	*object = NULL;
 
-	context->memory.release(context->memory.allocator, temp->keys);
-	temp->keys = NULL;
+	if (!sm_hash_table_is_inline(temp))
+	{
+		context->memory.release(context->memory.allocator, temp->keys);
+		context->memory.release(context->memory.allocator, temp->flags);
+		context->memory.release(context->memory.allocator, temp->values);
+		context->memory.release(context->memory.allocator, temp->probes);
+	}
 
-	context->memory.release(context->memory.allocator, temp->flags);
+	temp->keys = temp->values = NULL;
 	temp->flags = NULL;
+	temp->probes = NULL;
 
-	context->memory.release(context->memory.allocator, temp->values);
-	temp->values = NULL;
+	context->memory.release(context->memory.allocator, temp->statistics);
+	temp->statistics = NULL;
+
+	if (temp->migration.buckets)
+	{
+		context->memory.release(context->memory.allocator, temp->migration.keys);
+		context->memory.release(context->memory.allocator, temp->migration.flags);
+		context->memory.release(context->memory.allocator, temp->migration.values);
+		context->memory.release(context->memory.allocator, temp->migration.probes);
+	}
 
 	context->synchronization.leave(&temp->mutex);
 	context->synchronization.destroy(&temp->mutex);
 
-	register uint8_t* p = (uint8_t*)temp;
-	register size_t n = sizeof(sm_hash_table_t);
-	while (n-- > 0U) *p++ = (uint8_t)context->random.method(context);
+	sm_random_fill(context, temp, sizeof(sm_hash_table_t));
 
 	context->memory.release(context->memory.allocator, temp);
 
@@ -108,7 +164,7 @@ exported sm_rc callconv sm_hash_table_clear(sm_hash_table_t *restrict object)
 
 	sm_context_t* context = object->context;
 
-	if (!context->synchronization.enter(&object->mutex)) return SM_RC_OPERATION_BLOCKED;
+	if (!sm_hash_table_enter__(object)) return SM_RC_OPERATION_BLOCKED;
 
 	if (object->flags == NULL)
 	{
@@ -117,72 +173,319 @@ exported sm_rc callconv sm_hash_table_clear(sm_hash_table_t *restrict object)
 		return SM_RC_INTERNAL_REFERENCE_NULL;
 	}
 
+	if (object->migration.buckets) // Drop the previous generation outright.
+	{
+		context->memory.release(context->memory.allocator, object->migration.keys);
+		context->memory.release(context->memory.allocator, object->migration.flags);
+		context->memory.release(context->memory.allocator, object->migration.values);
+		context->memory.release(context->memory.allocator, object->migration.probes);
+
+		object->migration.keys = object->migration.values = NULL;
+		object->migration.flags = NULL;
+		object->migration.probes = NULL;
+		object->migration.buckets = object->migration.cursor = 0;
+	}
+
 	buckets = object->buckets;
 
+	if (sm_hash_table_is_inline(object))
+	{
+		register uint64_t i;
+		for (i = 0; i < SM_HASH_TABLE_INLINE_CAPACITY; ++i)
+			object->small.keys[i] = NULL;
+	}
+
 	register uint8_t* p = (uint8_t*)object->flags;
-	register size_t n = (buckets < 16ULL ? 1ULL : buckets >> 4ULL) * sizeof(uint64_t);
+	register size_t n = (buckets < 16ULL ? 1ULL : buckets >> 4ULL) * sizeof(uint32_t);
 	while (n-- > 0U) *p++ = 0xAA;
 
 	object->count = object->occupied = 0;
-	
+	object->upper = sm_hash_table_is_inline(object) ? buckets : sm_hash_table_upper(buckets); // Undo any early grow.
+
 	context->synchronization.leave(&object->mutex);
 
 	return SM_RC_NO_ERROR;
 }
 
 
-inline static sm_rc sm_hash_table_find__(sm_hash_table_t *restrict object, void* key, sm_hash_table_iterator* result)
+exported sm_rc callconv sm_hash_table_set_incremental(sm_hash_table_t *restrict object, bool enabled)
+{
+	if (object == NULL) return SM_RC_OBJECT_NULL;
+
+	sm_context_t* context = object->context;
+
+	if (!sm_hash_table_enter__(object)) return SM_RC_OPERATION_BLOCKED;
+
+	if (!enabled) sm_hash_table_migrate__(object, UINT64_MAX);
+
+	const uint8_t incremental = enabled ? 1 : 0;
+
+	sm_hash_table_assign(context, object, incremental, incremental);
+
+	context->synchronization.leave(&object->mutex);
+
+	return SM_RC_NO_ERROR;
+}
+
+
+exported sm_rc callconv sm_hash_table_set_statistics(sm_hash_table_t *restrict object, bool enabled)
+{
+	sm_hash_table_statistics_t* temp = NULL;
+
+	if (object == NULL) return SM_RC_OBJECT_NULL;
+
+	sm_context_t* context = object->context;
+
+	if (enabled)
+	{
+		temp = (sm_hash_table_statistics_t*)context->memory.allocate(context->memory.allocator, sizeof(sm_hash_table_statistics_t));
+
+		if (temp == NULL) return SM_RC_ALLOCATION_FAILED;
+
+		register uint8_t* p = (uint8_t*)temp;
+		register size_t n = sizeof(sm_hash_table_statistics_t);
+		while (n-- > 0U) *p++ = 0;
+	}
+
+	if (!sm_hash_table_enter__(object))
+	{
+		context->memory.release(context->memory.allocator, temp);
+
+		return SM_RC_OPERATION_BLOCKED;
+	}
+
+	context->memory.release(context->memory.allocator, object->statistics);
+	sm_hash_table_assign(context, object, statistics, temp);
+
+	context->synchronization.leave(&object->mutex);
+
+	return SM_RC_NO_ERROR;
+}
+
+
+exported sm_rc callconv sm_hash_table_get_statistics(sm_hash_table_t *restrict object, sm_hash_table_statistics_t* result)
 {
-	uint64_t k, i, last, mask, step = 0;
+	uint64_t i;
 
 	if (object == NULL) return SM_RC_OBJECT_NULL;
 	if (result == NULL) return SM_RC_ARGUMENT_NULL;
 
-	*result = 0;
+	register uint8_t* p = (uint8_t*)result;
+	register size_t n = sizeof(sm_hash_table_statistics_t);
+	while (n-- > 0U) *p++ = 0;
 
 	sm_context_t* context = object->context;
 
-	if (!context->synchronization.enter(&object->mutex)) return SM_RC_OPERATION_BLOCKED;
+	if (!sm_hash_table_enter__(object)) return SM_RC_OPERATION_BLOCKED;
 
-	if (object->buckets)
+	if (object->statistics == NULL)
 	{
-		mask = object->buckets - 1;
+		context->synchronization.leave(&object->mutex);
+
+		return SM_RC_INTERNAL_REFERENCE_NULL;
+	}
 
-		k = object->hasher(key, object->key);
+	*result = *object->statistics;
 
-		i = k & mask;
-		last = i;
+	for (i = 0; i < object->migration.buckets; ++i)
+		if (sm_hash_table_is_deleted(object->migration.flags, i) && !sm_hash_table_is_empty(object->migration.flags, i))
+			result->tombstones++;
 
-		while (!((object->flags[i >> 4ULL] >> ((i & 15ULL) << 1ULL)) & 2ULL) && (((object->flags[i >> 4ULL] >> ((i & 15ULL) << 1ULL)) & 1ULL) || (object->keys[i] != key)))
+	context->synchronization.leave(&object->mutex);
+
+	return SM_RC_NO_ERROR;
+}
+
+
+// Enters the table mutex, recording the wait when statistics are enabled. The statistics pointer is only dereferenced 
+// once the mutex is held. Returns false if the mutex could not be entered.
+inline static bool sm_hash_table_enter__(sm_hash_table_t *restrict object)
+{
+	sm_context_t* context = object->context;
+	uint64_t t = (object->statistics != NULL) ? sm_ticks() : 0;
+
+	if (!context->synchronization.enter(&object->mutex)) return false;
+
+	if (t != 0 && object->statistics != NULL)
+	{
+		object->statistics->locks++;
+		object->statistics->lock_ticks += sm_ticks() - t;
+	}
+
+	return true;
+}
+
+
+// Hashes the given key with the table's hasher, or with SipHash-1-3 under the table's secret if it has none. Records the cost
+// when statistics are enabled.
+inline static uint64_t sm_hash_table_hash__(sm_hash_table_t *restrict object, void* key)
+{
+	uint64_t h, t;
+
+	if (object->statistics == NULL)
+	{
+		if (object->hasher == NULL) return sec_hashing_sip13_bytes_64(key, (key != NULL) ? object->key : 0, object->seed);
+		return object->hasher(key, object->key);
+	}
+
+	t = sm_ticks();
+	h = (object->hasher == NULL) ? sec_hashing_sip13_bytes_64(key, (key != NULL) ? object->key : 0, object->seed) : object->hasher(key, object->key);
+
+	object->statistics->hashes++;
+	object->statistics->hash_ticks += sm_ticks() - t;
+
+	return h;
+}
+
+
+// Records a probe of the given length in the given histogram.
+inline static void sm_hash_table_record__(uint64_t* histogram, uint64_t length)
+{
+	histogram[(length > SM_HASH_TABLE_HISTOGRAM_BINS ? SM_HASH_TABLE_HISTOGRAM_BINS : (length ? length : 1)) - 1]++;
+}
+
+
+// Scans the inline keys for key, comparing several pointers per SSE2 step. Empty inline buckets hold null, so a scan for
+// null finds a free bucket. Returns the bucket index, or SM_HASH_TABLE_INLINE_CAPACITY if absent.
+inline static uint64_t sm_hash_table_scan__(void* const* keys, const void* key)
+{
+	uint64_t i;
+	int m;
+
+#if UINTPTR_MAX == UINT64_MAX
+	const __m128i k = _mm_set1_epi64x((long long)(uintptr_t)key);
+
+	for (i = 0; i < SM_HASH_TABLE_INLINE_CAPACITY; i += 2)
+	{
+		m = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&keys[i]), k));
+
+		if ((m & 0x00FF) == 0x00FF) return i;
+		if ((m & 0xFF00) == 0xFF00) return i + 1;
+	}
+#else
+	const __m128i k = _mm_set1_epi32((int)(uintptr_t)key);
+
+	for (i = 0; i < SM_HASH_TABLE_INLINE_CAPACITY; i += 4)
+	{
+		m = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&keys[i]), k));
+
+		if (m != 0)
 		{
-			i = (i + (++step)) & mask;
+			while ((m & 0xF) == 0) { m >>= 4; ++i; }
+			return i;
+		}
+	}
+#endif
 
-			if (i == last)
-			{
-				*result = object->buckets;
+	return SM_HASH_TABLE_INLINE_CAPACITY;
+}
 
-				context->synchronization.leave(&object->mutex);
 
-				return SM_RC_NO_ERROR;
-			}
+// Gets the probe distance of the entry in bucket i of the given generation, recomputing it if it has saturated.
+inline static uint64_t sm_hash_table_distance__(sm_hash_table_t *restrict object, const uint8_t* probes, void** keys, uint64_t buckets, uint64_t i)
+{
+	if (probes[i] != 0xFF) return probes[i];
+	return (i - sm_hash_table_hash__(object, keys[i])) & (buckets - 1);
+}
+
+
+// Probes the given bucket generation for key, given its hash k. Probing stops at the first empty bucket, or at the first
+// bucket whose entry is closer to its home than the key would be, as no Robin Hood insert could have placed the key past 
+// it. Deleted buckets only occur in a draining previous generation, and keep their distance. The count of buckets 
+// inspected is added to *length. Returns the bucket index, or buckets if absent.
+inline static uint64_t sm_hash_table_probe__(sm_hash_table_t *restrict object, const uint32_t* flags, const uint8_t* probes, void** keys, uint64_t buckets, uint64_t k, void* key, uint64_t* length)
+{
+	uint64_t d, i, mask = buckets - 1;
+
+	i = k & mask;
+
+	for (d = 0; d != buckets; ++d)
+	{
+		if (sm_hash_table_is_empty(flags, i) || sm_hash_table_distance__(object, probes, keys, buckets, i) < d)
+			break;
+
+		if (!sm_hash_table_is_deleted(flags, i) && keys[i] == key)
+		{
+			*length += d + 1;
+
+			return i;
 		}
 
-		*result = ((object->flags[i >> 4ULL] >> ((i & 15ULL) << 1ULL)) & 3ULL) ? object->buckets : i;
+		i = (i + 1) & mask;
+	}
 
-		context->synchronization.leave(&object->mutex);
+	*length += d + 1;
 
-		return SM_RC_NO_ERROR;
+	return buckets;
+}
+
+
+// Places a key known to be absent into the current bucket generation, given its hash k, using Robin Hood displacement:
+// the carried entry swaps with any resident that is closer to its home bucket. Does not alter the count. Returns the
+// bucket index of the key.
+inline static uint64_t sm_hash_table_place__(sm_hash_table_t *restrict object, uint64_t k, void* key, void* value)
+{
+	void* t;
+	uint64_t d, e, i, r, mask = object->buckets - 1;
+
+	i = k & mask;
+	r = object->buckets;
+
+	for (d = 0; ; ++d, i = (i + 1) & mask)
+	{
+		if (sm_hash_table_is_empty(object->flags, i))
+		{
+			object->keys[i] = key;
+			object->values[i] = value;
+			object->probes[i] = (uint8_t)(d < 0xFF ? d : 0xFF);
+			sm_hash_table_set_occupied(object->flags, i);
+			object->occupied++;
+
+			if (d >= SM_HASH_TABLE_PROBE_LIMIT && (object->count << 2) >= object->buckets && !object->migration.buckets)
+				object->upper = object->occupied; // Grow on the next insert to keep probes short, once no migration is in flight.
+
+			return (r == object->buckets) ? i : r;
+		}
+
+		e = sm_hash_table_distance__(object, object->probes, object->keys, object->buckets, i);
+
+		if (e < d) // Take from the rich.
+		{
+			if (r == object->buckets) r = i;
+
+			t = object->keys[i]; object->keys[i] = key; key = t;
+			t = object->values[i]; object->values[i] = value; value = t;
+			object->probes[i] = (uint8_t)(d < 0xFF ? d : 0xFF);
+			d = e;
+		}
 	}
+}
 
-	context->synchronization.leave(&object->mutex);
 
-	return SM_RC_NOT_FOUND;
+// Removes the entry in bucket i of the current generation by shifting the rest of its cluster back by one bucket, so
+// that no tombstone is left behind.
+inline static void sm_hash_table_erase__(sm_hash_table_t *restrict object, uint64_t i)
+{
+	uint64_t d, j, mask = object->buckets - 1;
+
+	for (j = (i + 1) & mask; !sm_hash_table_is_empty(object->flags, j); i = j, j = (j + 1) & mask)
+	{
+		if ((d = sm_hash_table_distance__(object, object->probes, object->keys, object->buckets, j)) == 0)
+			break;
+
+		object->keys[i] = object->keys[j];
+		object->values[i] = object->values[j];
+		object->probes[i] = (uint8_t)(d - 1 < 0xFF ? d - 1 : 0xFF);
+	}
+
+	sm_hash_table_set_empty(object->flags, i);
+	object->occupied--;
 }
 
 
-exported sm_rc callconv sm_hash_table_find(sm_hash_table_t *restrict object, void* key, sm_hash_table_iterator* result)
+inline static sm_rc sm_hash_table_find__(sm_hash_table_t *restrict object, void* key, sm_hash_table_iterator* result)
 {
-	uint64_t k, i, last, mask, step = 0;
+	uint64_t k, i, n = 0;
 
 	if (object == NULL) return SM_RC_OBJECT_NULL;
 	if (result == NULL) return SM_RC_ARGUMENT_NULL;
@@ -191,45 +494,65 @@ exported sm_rc callconv sm_hash_table_find(sm_hash_table_t *restrict object, voi
 
 	sm_context_t* context = object->context;
 
-	if (!context->synchronization.enter(&object->mutex)) return SM_RC_OPERATION_BLOCKED;
+	if (!sm_hash_table_enter__(object)) return SM_RC_OPERATION_BLOCKED;
 
-	if (object->buckets)
+	if (sm_hash_table_is_inline(object))
 	{
-		mask = object->buckets - 1;
+		*result = (key == NULL) ? object->buckets : sm_hash_table_scan__(object->keys, key);
 
-		k = object->hasher(key, object->key);
+		if (object->statistics != NULL)
+		{
+			object->statistics->finds++;
+			sm_hash_table_record__(object->statistics->find_probes, 1);
+		}
 
-		i = k & mask;
-		last = i;
+		context->synchronization.leave(&object->mutex);
 
-		while (!((object->flags[i >> 4ULL] >> ((i & 15ULL) << 1ULL)) & 2ULL) && (((object->flags[i >> 4ULL] >> ((i & 15ULL) << 1ULL)) & 1ULL) || (object->keys[i] != key)))
-		{
-			i = (i + (++step)) & mask;
+		return SM_RC_NO_ERROR;
+	}
 
-			if (i == last)
-			{
-				*result = object->buckets;
+	if (object->buckets)
+	{
+		k = sm_hash_table_hash__(object, key);
 
-				context->synchronization.leave(&object->mutex);
+		i = sm_hash_table_probe__(object, object->flags, object->probes, object->keys, object->buckets, k, key, &n);
 
-				return SM_RC_NO_ERROR;
+		if (i == object->buckets && object->migration.buckets)
+		{
+			uint64_t j = sm_hash_table_probe__(object, object->migration.flags, object->migration.probes, object->migration.keys, object->migration.buckets, k, key, &n);
+
+			if (j != object->migration.buckets) // Found in the previous generation, so move it over now so the iterator stays valid.
+			{
+				sm_hash_table_set_deleted(object->migration.flags, j);
+				i = sm_hash_table_place__(object, k, key, object->migration.values[j]);
 			}
 		}
 
-		*result = ((object->flags[i >> 4ULL] >> ((i & 15ULL) << 1ULL)) & 3ULL) ? object->buckets : i;
+		if (object->statistics != NULL)
+		{
+			object->statistics->finds++;
+			sm_hash_table_record__(object->statistics->find_probes, n);
+		}
+
+		sm_hash_table_migrate__(object, SM_HASH_TABLE_MIGRATION_STEP);
+
+		*result = i;
 
 		context->synchronization.leave(&object->mutex);
 
 		return SM_RC_NO_ERROR;
 	}
-	
+
 	context->synchronization.leave(&object->mutex);
 
 	return SM_RC_NOT_FOUND;
 }
 
 
-inline static bool sm_hash_table_resize__(sm_hash_table_t *restrict object, uint64_t buckets);
+exported sm_rc callconv sm_hash_table_find(sm_hash_table_t *restrict object, void* key, sm_hash_table_iterator* result)
+{
+	return sm_hash_table_find__(object, key, result);
+}
 
 
 exported sm_rc callconv sm_hash_table_resize(sm_hash_table_t *restrict object, uint64_t buckets)
@@ -238,7 +561,9 @@ exported sm_rc callconv sm_hash_table_resize(sm_hash_table_t *restrict object, u
 
 	sm_context_t* context = object->context;
 
-	if (!context->synchronization.enter(&object->mutex)) return SM_RC_OPERATION_BLOCKED;
+	if (!sm_hash_table_enter__(object)) return SM_RC_OPERATION_BLOCKED;
+
+	sm_hash_table_migrate__(object, UINT64_MAX); // An explicit resize is always done in one call.
 
 	if (!sm_hash_table_resize__(object, buckets))
 	{
@@ -253,10 +578,6 @@ exported sm_rc callconv sm_hash_table_resize(sm_hash_table_t *restrict object, u
 }
 
 
-inline static sm_rc sm_hash_table_find__(sm_hash_table_t *restrict object, void* key, sm_hash_table_iterator* result);
-inline static sm_rc sm_hash_table_insert__(sm_hash_table_t *restrict object, void* key, void* value, sm_hash_table_iterator* result);
-inline static sm_rc sm_hash_table_get_value__(sm_hash_table_t *restrict object, sm_hash_table_iterator iterator, void** result);
-
 inline static sm_rc sm_hash_table_exists_at__(sm_hash_table_t *restrict object, sm_hash_table_iterator iterator, bool* result)
 {
 	if (object == NULL) return SM_RC_OBJECT_NULL;
@@ -266,15 +587,16 @@ inline static sm_rc sm_hash_table_exists_at__(sm_hash_table_t *restrict object,
 
 	sm_context_t* context = object->context;
 
-	if (!context->synchronization.enter(&object->mutex)) return SM_RC_OPERATION_BLOCKED;
+	if (!sm_hash_table_enter__(object)) return SM_RC_OPERATION_BLOCKED;
 
-	*result = !((object->flags[iterator >> 4ULL] >> ((iterator & 0xFULL) << 1ULL)) & 3ULL);
+	*result = iterator < object->buckets && !sm_hash_table_is_either(object->flags, iterator);
 
 	context->synchronization.leave(&object->mutex);
 
 	return SM_RC_NO_ERROR;
 }
 
+
 exported sm_rc callconv sm_hash_table_contains(sm_hash_table_t *restrict object, void* key, bool* result)
 {
 	sm_rc rc;
@@ -309,7 +631,7 @@ inline static sm_rc sm_hash_table_get_value__(sm_hash_table_t *restrict object,
 
 	sm_context_t* context = object->context;
 
-	if (!context->synchronization.enter(&object->mutex)) return SM_RC_OPERATION_BLOCKED;
+	if (!sm_hash_table_enter__(object)) return SM_RC_OPERATION_BLOCKED;
 
 	if (object->keys == NULL || object->values == NULL)
 	{
@@ -318,6 +640,13 @@ inline static sm_rc sm_hash_table_get_value__(sm_hash_table_t *restrict object,
 		return SM_RC_INTERNAL_REFERENCE_NULL;
 	}
 
+	if (iterator >= object->buckets)
+	{
+		context->synchronization.leave(&object->mutex);
+
+		return SM_RC_NOT_FOUND;
+	}
+
 	*result = object->values[iterator];
 
 	context->synchronization.leave(&object->mutex);
@@ -328,8 +657,7 @@ inline static sm_rc sm_hash_table_get_value__(sm_hash_table_t *restrict object,
 
 inline static sm_rc sm_hash_table_insert__(sm_hash_table_t *restrict object, void* key, void* value, sm_hash_table_iterator* result)
 {
-	sm_rc rc;
-	uint64_t x, k, i, site, last, mask, step;
+	uint64_t x, k, n = 0;
 
 	if (object == NULL) return SM_RC_OBJECT_NULL;
 	if (key == NULL || result == NULL) return SM_RC_ARGUMENT_NULL;
@@ -338,97 +666,98 @@ inline static sm_rc sm_hash_table_insert__(sm_hash_table_t *restrict object, voi
 
 	sm_context_t* context = object->context;
 
-	if (!context->synchronization.enter(&object->mutex)) return SM_RC_OPERATION_BLOCKED;
+	if (!sm_hash_table_enter__(object)) return SM_RC_OPERATION_BLOCKED;
 
-	if (object->occupied >= object->upper)
+	if (sm_hash_table_is_inline(object))
 	{
-		if (object->buckets > (object->count << 1)) // Update.
+		if ((x = sm_hash_table_scan__(object->keys, key)) == object->buckets && object->occupied < object->upper)
 		{
-			if (!sm_hash_table_resize__(object, object->buckets - 1))
-			{
-				*result = object->buckets;
+			x = sm_hash_table_scan__(object->keys, NULL);
 
-				context->synchronization.leave(&object->mutex);
-
-				return SM_RC_ALLOCATION_FAILED;
-			}
+			object->keys[x] = key;
+			object->values[x] = value;
+			sm_hash_table_set_occupied(object->flags, x);
+			object->occupied++;
+			object->count++;
 		}
-		else if (!sm_hash_table_resize__(object, object->buckets + 1)) // Expand.
+
+		if (x != object->buckets)
 		{
-			*result = object->buckets;
+			if (object->statistics != NULL)
+			{
+				object->statistics->inserts++;
+				sm_hash_table_record__(object->statistics->insert_probes, 1);
+			}
+
+			*result = x;
 
 			context->synchronization.leave(&object->mutex);
 
-			return SM_RC_ALLOCATION_FAILED;
+			return SM_RC_NO_ERROR;
 		}
 	}
 
-	step = 0;
-	mask = object->buckets - 1;
-	x = site = object->buckets;
-	k = object->hasher(key, object->key);
-	i = k & mask;
+	if (object->occupied >= object->upper && !sm_hash_table_grow__(object, object->buckets + 1)) // Expand.
+	{
+		*result = object->buckets;
 
-	if (((object->flags[i >> 4ULL] >> ((i & 15ULL) << 1ULL)) & 2ULL))
-		x = i;
-	else
+		context->synchronization.leave(&object->mutex);
+
+		return SM_RC_ALLOCATION_FAILED;
+	}
+
+	k = sm_hash_table_hash__(object, key);
+
+	if (object->migration.buckets)
 	{
-		last = i;
+		sm_hash_table_migrate__(object, SM_HASH_TABLE_MIGRATION_STEP);
 
-		while (!((object->flags[i >> 4ULL] >> ((i & 15ULL) << 1ULL)) & 2ULL) && (((object->flags[i >> 4ULL] >> ((i & 15ULL) << 1ULL)) & 1ULL) || (object->keys[i] != key)))
+		if (object->migration.buckets) // Move the key over now if it is still in the previous generation.
 		{
-			if (((object->flags[i >> 4ULL] >> ((i & 15ULL) << 1ULL)) & 1ULL))
-				site = i;
-
-			i = (i + (++step)) & mask;
+			x = sm_hash_table_probe__(object, object->migration.flags, object->migration.probes, object->migration.keys, object->migration.buckets, k, key, &n);
 
-			if (i == last)
+			if (x != object->migration.buckets)
 			{
-				x = site;
+				sm_hash_table_set_deleted(object->migration.flags, x);
+				*result = sm_hash_table_place__(object, k, key, object->migration.values[x]);
 
-				break;
+				if (object->statistics != NULL)
+				{
+					object->statistics->inserts++;
+					sm_hash_table_record__(object->statistics->insert_probes, n + ((*result - k) & (object->buckets - 1)) + 1);
+				}
+
+				context->synchronization.leave(&object->mutex);
+
+				return SM_RC_NO_ERROR;
 			}
 		}
-		if (x == object->buckets)
-		{
-			if (((object->flags[i >> 4ULL] >> ((i & 15ULL) << 1ULL)) & 2ULL) && site != object->buckets)
-				x = site;
-			else x = i;
-		}
 	}
 
-	if (((object->flags[x >> 4ULL] >> ((x & 15ULL) << 1ULL)) & 2ULL)) // Not present.
+	x = sm_hash_table_probe__(object, object->flags, object->probes, object->keys, object->buckets, k, key, &n);
+
+	if (x == object->buckets) // Not present.
 	{
-		object->keys[x] = key;
-		object->values[x] = value;
-		object->flags[x >> 4ULL] &= ~(3ULL << ((x & 15ULL) << 1ULL));
+		x = sm_hash_table_place__(object, k, key, value);
 		object->count++;
-		object->occupied++;
 
-		rc = SM_RC_NO_ERROR;
+		n = ((x - k) & (object->buckets - 1)) + 1;
 	}
-	else if (((object->flags[x >> 4ULL] >> ((x & 15ULL) << 1ULL)) & 1ULL)) // Deleted.
-	{
-		object->keys[x] = key;
-		object->values[x] = value;
-		object->flags[x >> 4ULL] &= ~(3ULL << ((x & 15ULL) << 1ULL));
-		object->count++;
 
-		rc = SM_RC_NO_ERROR;
+	if (object->statistics != NULL)
+	{
+		object->statistics->inserts++;
+		sm_hash_table_record__(object->statistics->insert_probes, n);
 	}
-	else rc = SM_RC_NO_ERROR;
 
 	*result = x;
 
 	context->synchronization.leave(&object->mutex);
 
-	return rc;
+	return SM_RC_NO_ERROR;
 }
 
 
-inline static sm_rc sm_hash_table_remove_at__(sm_hash_table_t *restrict object, sm_hash_table_iterator iterator);
-
-
 exported sm_rc callconv sm_hash_table_remove(sm_hash_table_t *restrict object, void* key)
 {
 	sm_rc rc;
@@ -444,11 +773,18 @@ inline static sm_rc sm_hash_table_remove_at__(sm_hash_table_t *restrict object,
 
 	sm_context_t* context = object->context;
 
-	if (!context->synchronization.enter(&object->mutex)) return SM_RC_OPERATION_BLOCKED;
+	if (!sm_hash_table_enter__(object)) return SM_RC_OPERATION_BLOCKED;
 
-	if (iterator != object->buckets && !((object->flags[iterator >> 4ULL] >> ((iterator & 15ULL) << 1ULL)) & 3ULL))
+	if (iterator < object->buckets && !sm_hash_table_is_either(object->flags, iterator))
 	{
-		object->flags[iterator >> 4ULL] |= 1ULL << ((iterator & 15ULL) << 1ULL);
+		if (sm_hash_table_is_inline(object))
+		{
+			object->keys[iterator] = NULL;
+			sm_hash_table_set_empty(object->flags, iterator);
+			object->occupied--;
+		}
+		else sm_hash_table_erase__(object, iterator);
+
 		object->count--;
 	}
 
@@ -460,140 +796,19 @@ inline static sm_rc sm_hash_table_remove_at__(sm_hash_table_t *restrict object,
 
 exported sm_rc callconv sm_hash_table_insert(sm_hash_table_t *restrict object, void* key, void* value, sm_hash_table_iterator* result)
 {
-	sm_rc rc;
-	uint64_t x, k, i, site, last, mask, step;
-
-	if (object == NULL) return SM_RC_OBJECT_NULL;
-	if (key == NULL || result == NULL) return SM_RC_ARGUMENT_NULL;
-
-	*result = 0;
-
-	sm_context_t* context = object->context;
-
-	if (!context->synchronization.enter(&object->mutex)) return SM_RC_OPERATION_BLOCKED;
-
-	if (object->occupied >= object->upper)
-	{
-		if (object->buckets > (object->count << 1)) // Update.
-		{
-			if (!sm_hash_table_resize__(object, object->buckets - 1))
-			{
-				*result = object->buckets;
-
-				context->synchronization.leave(&object->mutex);
-
-				return SM_RC_ALLOCATION_FAILED;
-			}
-		}
-		else if (!sm_hash_table_resize__(object, object->buckets + 1)) // Expand.
-		{
-			*result = object->buckets;
-
-			context->synchronization.leave(&object->mutex);
-
-			return SM_RC_ALLOCATION_FAILED;
-		}
-	}
-
-	step = 0;
-	mask = object->buckets - 1;
-	x = site = object->buckets;
-	k = object->hasher(key, object->key);
-	i = k & mask;
-
-	if (((object->flags[i >> 4ULL] >> ((i & 15ULL) << 1ULL)) & 2ULL))
-		x = i;
-	else
-	{
-		last = i;
-
-		while (!((object->flags[i >> 4ULL] >> ((i & 15ULL) << 1ULL)) & 2ULL) && (((object->flags[i >> 4ULL] >> ((i & 15ULL) << 1ULL)) & 1ULL) || (object->keys[i] != key)))
-		{
-			if (((object->flags[i >> 4ULL] >> ((i & 15ULL) << 1ULL)) & 1ULL))
-				site = i;
-
-			i = (i + (++step)) & mask;
-
-			if (i == last) 
-			{ 
-				x = site;
-
-				break; 
-			}
-		}
-		if (x == object->buckets)
-		{
-			if (((object->flags[i >> 4ULL] >> ((i & 15ULL) << 1ULL)) & 2ULL) && site != object->buckets)
-				x = site;
-			else x = i;
-		}
-	}
-
-	if (((object->flags[x >> 4ULL] >> ((x & 15ULL) << 1ULL)) & 2ULL)) // Not present.
-	{
-		object->keys[x] = key;
-		object->values[x] = value;
-		object->flags[x >> 4ULL] &= ~(3ULL << ((x & 15ULL) << 1ULL));
-		object->count++; 
-		object->occupied++;
-
-		rc = SM_RC_NO_ERROR;
-	}
-	else if (((object->flags[x >> 4ULL] >> ((x & 15ULL) << 1ULL)) & 1ULL)) // Deleted.
-	{
-		object->keys[x] = key;
-		object->values[x] = value;
-		object->flags[x >> 4ULL] &= ~(3ULL << ((x & 15ULL) << 1ULL));
-		object->count++;
-
-		rc = SM_RC_NO_ERROR;
-	}
-	else rc = SM_RC_NO_ERROR;
-
-	*result = x;
-
-	context->synchronization.leave(&object->mutex);
-
-	return rc;
+	return sm_hash_table_insert__(object, key, value, result);
 }
 
 
 exported sm_rc callconv sm_hash_table_remove_at(sm_hash_table_t *restrict object, sm_hash_table_iterator iterator)
 {
-	if (object == NULL) return SM_RC_OBJECT_NULL;
-
-	sm_context_t* context = object->context;
-
-	if (!context->synchronization.enter(&object->mutex)) return SM_RC_OPERATION_BLOCKED;
-
-	if (iterator != object->buckets && !((object->flags[iterator >> 4ULL] >> ((iterator & 15ULL) << 1ULL)) & 3ULL))
-	{
-		object->flags[iterator >> 4ULL] |= 1ULL << ((iterator & 15ULL) << 1ULL);
-		object->count--;
-	}
-
-	context->synchronization.leave(&object->mutex);
-
-	return SM_RC_NO_ERROR;
+	return sm_hash_table_remove_at__(object, iterator);
 }
 
 
 exported sm_rc callconv sm_hash_table_exists_at(sm_hash_table_t *restrict object, sm_hash_table_iterator iterator, bool* result)
 {
-	if (object == NULL) return SM_RC_OBJECT_NULL;
-	if (result == NULL) return SM_RC_ARGUMENT_NULL;
-
-	*result = false;
-
-	sm_context_t* context = object->context;
-
-	if (!context->synchronization.enter(&object->mutex)) return SM_RC_OPERATION_BLOCKED;
-
-	*result = !((object->flags[iterator >> 4ULL] >> ((iterator & 0xFULL) << 1ULL)) & 3ULL);
-
-	context->synchronization.leave(&object->mutex);
-
-	return SM_RC_NO_ERROR;
+	return sm_hash_table_exists_at__(object, iterator, result);
 }
 
 
@@ -606,7 +821,7 @@ exported sm_rc callconv sm_hash_table_get_key(sm_hash_table_t *restrict object,
 
 	sm_context_t* context = object->context;
 
-	if (!context->synchronization.enter(&object->mutex)) return SM_RC_OPERATION_BLOCKED;
+	if (!sm_hash_table_enter__(object)) return SM_RC_OPERATION_BLOCKED;
 
 	if (object->keys == NULL || object->values == NULL)
 	{
@@ -625,27 +840,7 @@ exported sm_rc callconv sm_hash_table_get_key(sm_hash_table_t *restrict object,
 
 exported sm_rc callconv sm_hash_table_get_value(sm_hash_table_t *restrict object, sm_hash_table_iterator iterator, void** result)
 {
-	if (object == NULL) return SM_RC_OBJECT_NULL;
-	if (result == NULL) return SM_RC_ARGUMENT_NULL;
-
-	*result = NULL;
-
-	sm_context_t* context = object->context;
-
-	if (!context->synchronization.enter(&object->mutex)) return SM_RC_OPERATION_BLOCKED;
-
-	if (object->keys == NULL || object->values == NULL)
-	{
-		context->synchronization.leave(&object->mutex);
-
-		return SM_RC_INTERNAL_REFERENCE_NULL;
-	}
-
-	*result = object->values[iterator];
-
-	context->synchronization.leave(&object->mutex);
-
-	return SM_RC_NO_ERROR;
+	return sm_hash_table_get_value__(object, iterator, result);
 }
 
 
@@ -658,7 +853,7 @@ exported sm_rc callconv sm_hash_table_iterate_begin(sm_hash_table_t *restrict ob
 
 	sm_context_t* context = object->context;
 
-	if (!context->synchronization.enter(&object->mutex)) return SM_RC_OPERATION_BLOCKED;
+	if (!sm_hash_table_enter__(object)) return SM_RC_OPERATION_BLOCKED;
 
 	if (object->keys == NULL || object->values == NULL)
 	{
@@ -667,6 +862,8 @@ exported sm_rc callconv sm_hash_table_iterate_begin(sm_hash_table_t *restrict ob
 		return SM_RC_INTERNAL_REFERENCE_NULL;
 	}
 
+	sm_hash_table_migrate__(object, UINT64_MAX); // Iterators only address the current generation.
+
 	context->synchronization.leave(&object->mutex);
 
 	return SM_RC_NO_ERROR;
@@ -682,7 +879,7 @@ exported sm_rc callconv sm_hash_table_iterate_end(sm_hash_table_t *restrict obje
 
 	sm_context_t* context = object->context;
 
-	if (!context->synchronization.enter(&object->mutex)) return SM_RC_OPERATION_BLOCKED;
+	if (!sm_hash_table_enter__(object)) return SM_RC_OPERATION_BLOCKED;
 
 	*result = (sm_hash_table_iterator)object->buckets;
 
@@ -701,7 +898,7 @@ exported sm_rc callconv sm_hash_table_count(sm_hash_table_t *restrict object, ui
 
 	sm_context_t* context = object->context;
 
-	if (!context->synchronization.enter(&object->mutex)) return SM_RC_OPERATION_BLOCKED;
+	if (!sm_hash_table_enter__(object)) return SM_RC_OPERATION_BLOCKED;
 
 	*result = object->count;
 
@@ -720,7 +917,7 @@ exported sm_rc callconv sm_hash_table_buckets(sm_hash_table_t *restrict object,
 
 	sm_context_t* context = object->context;
 
-	if (!context->synchronization.enter(&object->mutex)) return SM_RC_OPERATION_BLOCKED;
+	if (!sm_hash_table_enter__(object)) return SM_RC_OPERATION_BLOCKED;
 
 	*result = object->buckets;
 
@@ -739,7 +936,7 @@ exported sm_rc callconv sm_hash_table_iterate(sm_hash_table_t *restrict object,
 
 	sm_context_t* ctx = object->context;
 
-	if (!ctx->synchronization.enter(&object->mutex)) return SM_RC_OPERATION_BLOCKED;
+	if (!sm_hash_table_enter__(object)) return SM_RC_OPERATION_BLOCKED;
 
 	if (object->flags == NULL || object->keys == NULL || object->values == NULL)
 	{
@@ -748,11 +945,13 @@ exported sm_rc callconv sm_hash_table_iterate(sm_hash_table_t *restrict object,
 		return SM_RC_INTERNAL_REFERENCE_NULL;
 	}
 
+	sm_hash_table_migrate__(object, UINT64_MAX);
+
 	n = object->buckets;
 
 	for (i = 0; i != n; ++i)
 	{
-		if ((object->flags[i >> 4ULL] >> ((i & 0xFULL) << 1ULL)) & 3ULL) 
+		if (sm_hash_table_is_either(object->flags, i))
 			continue;
 
 		if (!visitor((sm_hash_table_iterator)i, object->keys[i], object->key, &(object->values[i]), context))
@@ -783,14 +982,51 @@ uint64_t sm_hash_table_default_hasher(const void* data, size_t size)
 // Internals
 
 
-inline static bool sm_hash_table_resize__(sm_hash_table_t *restrict object, uint64_t buckets)
+// Migrates up to the given count of buckets from the previous generation into the current one, and releases the
+// previous generation once it has been fully drained. Migrated buckets are only marked deleted, so that probes of the
+// previous generation stay valid until it is released.
+inline static void sm_hash_table_migrate__(sm_hash_table_t *restrict object, uint64_t steps)
 {
-	static const double upper = 0.77;
+	uint64_t j;
+
+	if (!object->migration.buckets) return;
+
+	sm_context_t* context = object->context;
 
-	void *key, *val, *tmp;
-	void **keys, **vals, **ppt;
-	uint32_t* flags = NULL;
-	uint64_t i, j = 1, k, nnb, mask, step = 0;
+	while (steps-- > 0 && object->migration.cursor < object->migration.buckets)
+	{
+		j = object->migration.cursor++;
+
+		if (!sm_hash_table_is_either(object->migration.flags, j))
+		{
+			sm_hash_table_set_deleted(object->migration.flags, j);
+			sm_hash_table_place__(object, sm_hash_table_hash__(object, object->migration.keys[j]), object->migration.keys[j], object->migration.values[j]);
+		}
+	}
+
+	if (object->migration.cursor == object->migration.buckets)
+	{
+		context->memory.release(context->memory.allocator, object->migration.keys);
+		context->memory.release(context->memory.allocator, object->migration.flags);
+		context->memory.release(context->memory.allocator, object->migration.values);
+		context->memory.release(context->memory.allocator, object->migration.probes);
+
+		object->migration.keys = object->migration.values = NULL;
+		object->migration.flags = NULL;
+		object->migration.probes = NULL;
+		object->migration.buckets = object->migration.cursor = 0;
+	}
+}
+
+
+// Allocates a new, empty bucket generation of the given count of buckets (rounded up to a power of two), and retires the
+// current one, if any, to be migrated. No migration may be in progress. Returns false on allocation failure.
+inline static bool sm_hash_table_rebuild__(sm_hash_table_t *restrict object, uint64_t buckets)
+{
+	uint32_t* flags;
+	uint8_t* probes;
+	void **keys, **vals;
+	uint64_t nnb;
 
 	--buckets;
 	buckets |= buckets >> 1ULL;
@@ -798,123 +1034,146 @@ inline static bool sm_hash_table_resize__(sm_hash_table_t *restrict object, uint
 	buckets |= buckets >> 4ULL;
 	buckets |= buckets >> 8ULL;
 	buckets |= buckets >> 16ULL;
+	buckets |= buckets >> 32ULL;
 	++buckets;
 
-	sm_context_t* context = object->context;
-
 	if (buckets < 4) buckets = 4;
 
-	if (object->count >= (uint64_t)(buckets * upper + 0.5))
-		j = 0;
-	else
-	{
-		nnb = (buckets < 16 ? 1 : buckets >> 4ULL);
+	if (sm_hash_table_is_inline(object) && buckets <= SM_HASH_TABLE_INLINE_CAPACITY)
+		return true; // Already fits inline.
 
-		flags = (uint32_t*)context->memory.allocate(context->memory.allocator, nnb * sizeof(uint32_t));
+	if (object->count >= sm_hash_table_upper(buckets))
+		return true; // Requested size is too small.
 
-		if (flags == NULL) return false;
+	sm_context_t* context = object->context;
 
-		register uint8_t* p = (uint8_t*)flags;
-		register size_t n = nnb * sizeof(uint32_t);
-		while (n-- > 0U) *p++ = 0xAA;
+	nnb = (buckets < 16 ? 1 : buckets >> 4ULL);
 
-		if (object->buckets < buckets)
-		{
-			keys = (void**)context->memory.resize(context->memory.allocator, object->keys, buckets * sizeof(void*));
+	flags = (uint32_t*)context->memory.allocate(context->memory.allocator, nnb * sizeof(uint32_t));
 
-			if (keys == NULL)
-			{
-				context->memory.release(context->memory.allocator, flags);
+	if (flags == NULL) return false;
 
-				return false;
-			}
+	probes = (uint8_t*)context->memory.allocate(context->memory.allocator, buckets * sizeof(uint8_t));
 
-			object->keys = keys;
+	if (probes == NULL)
+	{
+		context->memory.release(context->memory.allocator, flags);
 
-			vals = (void**)context->memory.resize(context->memory.allocator, object->values, buckets * sizeof(void*));
+		return false;
+	}
 
-			if (vals == NULL)
-			{
-				context->memory.release(context->memory.allocator, flags);
+	keys = (void**)context->memory.allocate(context->memory.allocator, buckets * sizeof(void*));
 
-				return false;
-			}
+	if (keys == NULL)
+	{
+		context->memory.release(context->memory.allocator, probes);
+		context->memory.release(context->memory.allocator, flags);
 
-			object->values = vals;
-		}
+		return false;
 	}
 
-	if (j) // Re-hash.
+	vals = (void**)context->memory.allocate(context->memory.allocator, buckets * sizeof(void*));
+
+	if (vals == NULL)
 	{
-		for (j = 0; j != object->buckets; ++j)
-		{
-			if (((object->flags[j >> 4ULL] >> ((j & 15ULL) << 1ULL)) & 3ULL) == 0)
-			{
-				key = object->keys[j];
-				mask = buckets - 1;
-				val = object->values[j];
+		context->memory.release(context->memory.allocator, keys);
+		context->memory.release(context->memory.allocator, probes);
+		context->memory.release(context->memory.allocator, flags);
 
-				object->flags[j >> 4ULL] |= 1ULL << ((j & 15ULL) << 1ULL);
+		return false;
+	}
 
-				while (true)
-				{
-					step = 0;
+	register uint8_t* p = (uint8_t*)flags;
+	register size_t n = nnb * sizeof(uint32_t);
+	while (n-- > 0U) *p++ = 0xAA;
 
-					k = object->hasher(key, object->key);
+	if (object->statistics != NULL)
+		object->statistics->resizes++;
 
-					i = k & mask;
+	if (sm_hash_table_is_inline(object)) // Promote; the inline entries are few, so place them now.
+	{
+		uint64_t j;
 
-					while (!((flags[i >> 4ULL] >> ((i & 15ULL) << 1ULL)) & 2ULL))
-						i = (i + (++step)) & mask;
+		object->flags = flags;
+		object->probes = probes;
+		object->keys = keys;
+		object->values = vals;
+		object->buckets = buckets;
+		object->occupied = 0;
+		object->upper = sm_hash_table_upper(object->buckets);
 
-					flags[i >> 4ULL] &= ~(2ULL << ((i & 15ULL) << 1ULL));
+		for (j = 0; j < SM_HASH_TABLE_INLINE_CAPACITY; ++j)
+		{
+			if (object->small.keys[j] == NULL) continue;
 
-					if (i < object->buckets && ((object->flags[i >> 4ULL] >> ((i & 15ULL) << 1ULL)) & 3ULL) == 0)
-					{
-						tmp = object->keys[i];
-						object->keys[i] = key;
-						key = tmp;
+			sm_hash_table_place__(object, sm_hash_table_hash__(object, object->small.keys[j]), object->small.keys[j], object->small.values[j]);
 
-						tmp = object->values[i];
-						object->values[i] = val;
-						val = tmp;
+			object->small.keys[j] = object->small.values[j] = NULL;
+		}
 
-						object->flags[i >> 4ULL] |= 1ULL << ((i & 15ULL) << 1ULL);
-					}
-					else
-					{
-						object->keys[i] = key;
-						object->values[i] = val;
+		object->small.flags = 0xAAAAAAAAUL;
 
-						break;
-					}
-				}
-			}
-		}
+		return true;
+	}
 
-		if (object->buckets > buckets) // Shrink.
-		{
-			ppt = (void**)context->memory.resize(context->memory.allocator, object->keys, buckets * sizeof(void*));
+	if (object->buckets)
+	{
+		object->migration.flags = object->flags;
+		object->migration.probes = object->probes;
+		object->migration.keys = object->keys;
+		object->migration.values = object->values;
+		object->migration.buckets = object->buckets;
+		object->migration.cursor = 0;
+	}
 
-			if (ppt == NULL) return false;
+	object->flags = flags;
+	object->probes = probes;
+	object->keys = keys;
+	object->values = vals;
+	object->buckets = buckets;
+	object->occupied = 0;
+	object->upper = sm_hash_table_upper(object->buckets);
 
-			object->keys = ppt;
+	return true;
+}
 
-			ppt = (void**)context->memory.resize(context->memory.allocator, object->values, buckets * sizeof(void*));
 
-			if (ppt == NULL) return false;
+// Resizes the table to the given count of buckets on behalf of an insert. Small tables, or tables not in incremental mode,
+// are re-hashed in one call. Otherwise the previous bucket generation is drained by subsequent operations, so that no 
+// single insert pays for the whole re-hash.
+inline static bool sm_hash_table_grow__(sm_hash_table_t *restrict object, uint64_t buckets)
+{
+	uint64_t t = (object->statistics != NULL) ? sm_ticks() : 0;
 
-			object->values = ppt;
-		}
+	sm_hash_table_migrate__(object, UINT64_MAX); // Finish any migration in progress first.
 
-		context->memory.release(context->memory.allocator, object->flags);
+	if (!sm_hash_table_rebuild__(object, buckets))
+		return false;
 
-		object->flags = flags;
-		object->buckets = buckets;
-		object->occupied = object->count;
-		object->upper = (uint64_t)(object->buckets * upper + 0.5);
-	}
+	if (!object->incremental || object->migration.buckets < SM_HASH_TABLE_INCREMENTAL_MINIMUM)
+		sm_hash_table_migrate__(object, UINT64_MAX);
+
+	if (object->statistics != NULL)
+		object->statistics->resize_ticks += sm_ticks() - t;
 
 	return true;
 }
 
+
+// Resizes the table to the given count of buckets in one call.
+inline static bool sm_hash_table_resize__(sm_hash_table_t *restrict object, uint64_t buckets)
+{
+	uint64_t t = (object->statistics != NULL) ? sm_ticks() : 0;
+
+	sm_hash_table_migrate__(object, UINT64_MAX);
+
+	if (!sm_hash_table_rebuild__(object, buckets))
+		return false;
+
+	sm_hash_table_migrate__(object, UINT64_MAX);
+
+	if (object->statistics != NULL)
+		object->statistics->resize_ticks += sm_ticks() - t;
+
+	return true;
+}
@@ -15,6 +15,23 @@
 #include "allocator.h"
 
 
+// Tables with fewer buckets than this are always resized in one call.
+#define SM_HASH_TABLE_INCREMENTAL_MINIMUM	1024ULL
+
+// The count of previous-generation buckets migrated by each operation during an incremental resize.
+#define SM_HASH_TABLE_MIGRATION_STEP		16ULL
+
+// An insert that displaces an entry this far from its home bucket forces the table to grow on the next insert, unless
+// an incremental resize is still migrating the previous generation.
+#define SM_HASH_TABLE_PROBE_LIMIT			64ULL
+
+// The count of entries held inline in the table object before the bucket arrays are allocated.
+#define SM_HASH_TABLE_INLINE_CAPACITY		8ULL
+
+// The count of probe-length histogram bins. The last bin counts all longer probes.
+#define SM_HASH_TABLE_HISTOGRAM_BINS		16ULL
+
+
 // Result codes.
 
 #define SM_RC_NO_ERROR					0
@@ -41,18 +58,52 @@ typedef uint64_t (*sm_tab_hash_f)(const void* data, size_t size);
 typedef bool (*sm_tab_visitor_f)(sm_tab_iterator_t iterator, void* key, size_t size, void** data, void* context);
 
 
-// Represents a general-purpose hash table.
-typedef struct sm_hash_table_s 
+// Hash table statistics, collected only while enabled. Durations are in processor ticks.
+typedef struct sm_hash_table_statistics_s
+{
+	uint64_t finds; // The count of finds.
+	uint64_t inserts; // The count of inserts.
+	uint64_t find_probes[SM_HASH_TABLE_HISTOGRAM_BINS]; // Histogram of find probe lengths, where bin i counts probes of i + 1 buckets.
+	uint64_t insert_probes[SM_HASH_TABLE_HISTOGRAM_BINS]; // Histogram of insert probe lengths.
+	uint64_t tombstones; // The count of deleted buckets in the previous generation. Computed by the snapshot.
+	uint64_t resizes; // The count of bucket generations allocated.
+	uint64_t resize_ticks; // Time spent resizing.
+	uint64_t locks; // The count of mutex acquisitions.
+	uint64_t lock_ticks; // Time spent waiting on the mutex.
+	uint64_t hashes; // The count of hasher calls.
+	uint64_t hash_ticks; // Time spent in the hasher.
+}
+sm_hash_table_statistics_t;
+
+
+// Represents a general-purpose hash table. Its configuration comes first, up to the count of buckets, and is what its CRC
+// covers; the buckets and counts that change with use follow.
+typedef struct sm_hash_table_s
 {
 	size_t size; // Size of this.
 	uint8_t initialized; // Initialized flag.
-	uint64_t crc; // 64-bit CRC of this.
+	uint64_t crc; // 64-bit CRC of the configuration of this.
 
 	uint8_t __padding_a[16];
 
 	// Reference to the sm context.
 	void* context;
 
+	// The data hasher, or null to use the keyed hash.
+	sm_tab_hash_f hasher;
+
+	// Secret 128-bit key for the keyed hash, drawn at creation.
+	uint64_t seed[2];
+
+	// The size of a key.
+	size_t key;
+
+	// Whether growth is amortized over subsequent operations rather than done in one call.
+	uint8_t incremental;
+
+	// Statistics, or null if not collected.
+	sm_hash_table_statistics_t* statistics;
+
 	// The count of buckets.
 	uint64_t buckets;
 
@@ -68,11 +119,8 @@ typedef struct sm_hash_table_s
 	// Hash table lookup flags.
 	uint32_t* flags;
 
-	// The default data hasher.
-	sm_tab_hash_f hasher;
-
-	// The size of a key.
-	size_t key;
+	// Probe distance of each bucket's entry from its home bucket, saturated at 0xFF.
+	uint8_t* probes;
 
 	// Vector of pointers to keys.
 	void** keys;
@@ -80,6 +128,27 @@ typedef struct sm_hash_table_s
 	// Vector of pointers to values.
 	void** values;
 
+	// The previous bucket generation, alive while an incremental resize is in progress.
+	struct
+	{
+		uint64_t buckets; // The count of buckets in the previous generation, or zero if not migrating.
+		uint64_t cursor; // The next bucket of the previous generation to be migrated.
+		uint32_t* flags; // Previous lookup flags.
+		uint8_t* probes; // Previous probe distances.
+		void** keys; // Previous keys.
+		void** values; // Previous values.
+	}
+	migration;
+
+	// Inline storage, in use (keys, values and flags point here) until the table outgrows SM_HASH_TABLE_INLINE_CAPACITY.
+	struct
+	{
+		void* keys[SM_HASH_TABLE_INLINE_CAPACITY]; // Inline keys, null where empty.
+		void* values[SM_HASH_TABLE_INLINE_CAPACITY]; // Inline values.
+		uint32_t flags; // Inline lookup flags.
+	}
+	small;
+
 	// Object mutex.
 	sm_mutex_t mutex;
 }
@@ -89,7 +158,8 @@ sm_hash_table_t;
 // Methods
 
 
-// Creates a new hash table with the given key size, hash function. Result is in *object. Returns status.
+// Creates a new hash table with the given key size, hash function. A null hasher, or the default hasher, selects a keyed hash
+// with a random per-table secret. Result is in *object. Returns status.
 sm_rc sec_hash_table_create(sm_t context, sm_hash_table_t** object, size_t size, sm_tab_hash_f hasher);
 
 // Destroys the given hash table in *object. Returns status.
@@ -101,6 +171,16 @@ sm_rc sec_hash_table_clear(sm_hash_table_t *restrict object);
 // Resizes the specified hash table with the given count of buckets. Returns status.
 sm_rc sec_hash_table_resize(sm_hash_table_t *restrict object, uint64_t buckets);
 
+// Enables or disables incremental (amortized) resizing for the given hash table. Disabling it completes any 
+// migration in progress. Returns status.
+sm_rc sm_hash_table_set_incremental(sm_hash_table_t *restrict object, bool enabled);
+
+// Enables or disables statistics collection for the given hash table. Enabling resets the statistics. Returns status.
+sm_rc sm_hash_table_set_statistics(sm_hash_table_t *restrict object, bool enabled);
+
+// Gets a snapshot of the statistics of the given hash table. Result is in *result. Returns status.
+sm_rc sm_hash_table_get_statistics(sm_hash_table_t *restrict object, sm_hash_table_statistics_t* result);
+
 // Retrieves an element by key from the given hash table. Result is an iterator to the found element, or sec_hash_table_iterate_end(object) 
 // if the element is absent. Returns status.
 sm_rc sec_hash_table_find(sm_hash_table_t *restrict object, void* key, sm_tab_iterator_t* result);
@@ -44,6 +44,12 @@
 #define sec_hashing_rotl_64(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
 #define sec_hashing_fmix_64(x, t) ((t) = (x)), ((t) ^= (t) >> 33), ((t) *= UINT64_C(0xFF51AFD7ED558CCD)), ((t) ^= (t) >> 33), ((t) *= UINT64_C(0xC4CEB9FE1A85EC53)), ((t) ^= (t) >> 33), (t)
 
+#define sec_hashing_sip_round(v0, v1, v2, v3) \
+	((v0) += (v1)), ((v1) = sec_hashing_rotl_64((v1), 13)), ((v1) ^= (v0)), ((v0) = sec_hashing_rotl_64((v0), 32)), \
+	((v2) += (v3)), ((v3) = sec_hashing_rotl_64((v3), 16)), ((v3) ^= (v2)), \
+	((v0) += (v3)), ((v3) = sec_hashing_rotl_64((v3), 21)), ((v3) ^= (v0)), \
+	((v2) += (v1)), ((v1) = sec_hashing_rotl_64((v1), 17)), ((v1) ^= (v2)), ((v2) = sec_hashing_rotl_64((v2), 32))
+
 #define sec_hashing_get_block_32(p, i) ((uint32_t)((const uint32_t*)(p))[(i)])
 #define sec_hashing_fmix_32(x) (x) ^= (x) >> 16, (x) *= UINT32_C(0x85EBCA6B), (x) ^= (x) >> 13, (x) *= UINT32_C(0xC2B2AE35), (x) ^= (x) >> 16, (x)
 #define sec_hashing_rotl_32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
@@ -53,7 +59,7 @@
 
 
 // Function to hash an array of up to 8 bytes to an uint64_t value. Based on CityHash, by Geoff Pike and Jyrki Alakuijala of Google.
-uint64_t sec_hashing_city_bytes_64(const void *restrict p, size_t n)
+inline static uint64_t sec_hashing_city_bytes_64(const void *restrict p, size_t n)
 {
 	register const uint8_t* s = (const uint8_t*)&p;
 	register uint64_t t;
@@ -165,6 +171,50 @@ inline static uint64_t sec_hashing_murmur_bytes_64(const void *restrict p, size_
 }
 
 
+// Keyed 64-bit SipHash-1-3, by Jean-Philippe Aumasson and Daniel J. Bernstein, using the 128-bit secret key k. Unlike the
+// unkeyed functions, colliding inputs cannot be chosen without knowledge of the key.
+inline static uint64_t sec_hashing_sip13_bytes_64(const void *restrict p, size_t n, const uint64_t k[2])
+{
+	register const uint8_t* s = (const uint8_t*)p;
+	const uint8_t* e = s + (n & ~(size_t)7);
+	register uint64_t v0 = k[0] ^ UINT64_C(0x736F6D6570736575);
+	register uint64_t v1 = k[1] ^ UINT64_C(0x646F72616E646F6D);
+	register uint64_t v2 = k[0] ^ UINT64_C(0x6C7967656E657261);
+	register uint64_t v3 = k[1] ^ UINT64_C(0x7465646279746573);
+	uint64_t m, t, b = ((uint64_t)n) << 56;
+
+	for (; s != e; s += 8)
+	{
+		m = sec_hashing_get_64(s, t);
+		v3 ^= m;
+		sec_hashing_sip_round(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+
+	switch (n & 7)
+	{
+	case 7: b |= ((uint64_t)s[6]) << 48;
+	case 6: b |= ((uint64_t)s[5]) << 40;
+	case 5: b |= ((uint64_t)s[4]) << 32;
+	case 4: b |= ((uint64_t)s[3]) << 24;
+	case 3: b |= ((uint64_t)s[2]) << 16;
+	case 2: b |= ((uint64_t)s[1]) << 8;
+	case 1: b |= ((uint64_t)s[0]);
+	}
+
+	v3 ^= b;
+	sec_hashing_sip_round(v0, v1, v2, v3);
+	v0 ^= b;
+
+	v2 ^= 0xFF;
+	sec_hashing_sip_round(v0, v1, v2, v3);
+	sec_hashing_sip_round(v0, v1, v2, v3);
+	sec_hashing_sip_round(v0, v1, v2, v3);
+
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+
 // 32-Bit Hashing Functions
 
 
@@ -301,6 +351,9 @@ inline static uint32_t sec_hashing_murmur_bytes_32(const void *restrict p, regis
 // Hash a void pointer value to an uint64_t value using murmur hash.
 #define sec_hashing_murmur_pointer_64(x) (sec_hashing_murmur_bytes_64((void*)(&x), sizeof(void*)))
 
+// Hash a void pointer value to an uint64_t value using SipHash-1-3 with the 128-bit key k.
+#define sec_hashing_sip13_pointer_64(x, k) (sec_hashing_sip13_bytes_64((void*)(&x), sizeof(void*), (k)))
+
 // Hash a void pointer value to an uint32_t value using murmur hash.
 #define sec_hashing_murmur_pointer_32(x) (sec_hashing_murmur_bytes_32((void*)(&x), sizeof(void*)))
 
@@ -0,0 +1,302 @@
+// integrity.c - Selectable integrity values of secure data blocks.
+
+
+#include <string.h>
+
+
+#include "config.h"
+#include "sm.h"
+#include "sm_internal.h"
+#include "checksum.h"
+#include "integrity.h"
+
+
+// Gets a value indicating whether the given algorithm, possibly with SM_INTEGRITY_TREE, is known.
+inline static uint8_t sm_integrity_known(register uint8_t algorithm)
+{
+	if (algorithm == SM_INTEGRITY_NONE) return 1;
+
+	algorithm &= (uint8_t)~SM_INTEGRITY_TREE;
+
+	return algorithm == SM_INTEGRITY_CRC32C || algorithm == SM_INTEGRITY_CRC64;
+}
+
+
+// Gets the value of n bytes at p by the given algorithm, CRC32C or CRC-64, from the given seed.
+inline static uint64_t sm_integrity_value(sm_context_t* context, uint8_t algorithm, uint64_t seed, const void* p, size_t n)
+{
+	if (algorithm == SM_INTEGRITY_CRC64)
+		return context->checking.crc_64(seed, (const uint8_t*)p, n, context->checking.tab_64);
+
+	return sm_crc_32c((uint32_t)seed, (const uint8_t*)p, n);
+}
+
+
+// Gets the value of tree node i: of its chunk for a leaf, or of its two children.
+inline static uint64_t sm_integrity_node(sm_context_t* context, const sm_integrity_tree_t* tree, const uint8_t* data, size_t bytes, size_t i)
+{
+	if (i < tree->leaves - 1) return sm_integrity_value(context, tree->algorithm, i, &tree->nodes[(2 * i) + 1], 2 * sizeof(uint64_t));
+
+	register const size_t j = i - (tree->leaves - 1);
+
+	if (j >= tree->chunks) return 0;
+
+	return sm_integrity_value(context, tree->algorithm, i, data + (j * tree->chunk), sm_min(tree->chunk, bytes - (j * tree->chunk)));
+}
+
+
+// Checks, or with update set recomputes, leaves first to last of the entry's tree and all their ancestors. Returns 1 if
+// every checked node matches, and the root the entry's integrity value.
+static uint8_t sm_integrity_path(sm_context_t* context, const sm_data_entry_t* entry, size_t first, size_t last, uint8_t update)
+{
+	sm_integrity_tree_t* tree = entry->tree;
+	register size_t lo = tree->leaves - 1 + first, hi = tree->leaves - 1 + last, i;
+	register uint64_t v;
+
+	for (;;)
+	{
+		for (i = lo; i <= hi; ++i)
+		{
+			v = sm_integrity_node(context, tree, (const uint8_t*)entry->data, entry->bytes, i);
+
+			if (update) tree->nodes[i] = v;
+			else if (v != tree->nodes[i]) return 0;
+		}
+
+		if (!lo) break;
+
+		lo = (lo - 1) / 2, hi = (hi - 1) / 2;
+	}
+
+	return update || tree->nodes[0] == entry->check;
+}
+
+
+// Releases a tree.
+inline static void sm_integrity_tree_release(sm_context_t* context, sm_integrity_tree_t* tree)
+{
+	if (!tree) return;
+
+	register const size_t size = sizeof(sm_integrity_tree_t) + (((2 * tree->leaves) - 1) * sizeof(uint64_t));
+
+	sm_random_fill(context, tree, size);
+	context->memory.release(context->memory.allocator, tree);
+}
+
+
+// Records the algorithm, value and tree of an entry, releasing any tree it had.
+inline static void sm_integrity_record(sm_context_t* context, sm_data_entry_t* entry, uint8_t algorithm, uint64_t value, sm_integrity_tree_t* tree)
+{
+	sm_integrity_tree_t* old = entry->tree;
+
+	sm_integrity_assign(context, entry, integrity, algorithm);
+	sm_integrity_assign(context, entry, check, value);
+	sm_integrity_assign(context, entry, tree, tree);
+
+	if (old != tree) sm_integrity_tree_release(context, old);
+}
+
+
+// Sets the default integrity algorithm of data entries.
+exported void callconv sm_set_integrity(sm_t sm, uint8_t algorithm)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+
+	if (!context) return;
+
+	if (!sm_integrity_known(algorithm))
+	{
+		if (context->error)
+			context->error(context, SM_ERR_INVALID_ARGUMENT);
+
+		return;
+	}
+
+	sm_context_assign(context, checking.integrity, algorithm);
+}
+
+
+// Computes an integrity value.
+exported uint8_t callconv sm_integrity_compute(sm_t sm, uint8_t algorithm, const void* p, size_t n, uint64_t* value)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+
+	if (!context || !value || (!p && n)) return 0;
+
+	switch (algorithm)
+	{
+	case SM_INTEGRITY_NONE:
+		*value = 0;
+		return 1;
+
+	case SM_INTEGRITY_CRC32C:
+		*value = sm_integrity_value(context, algorithm, 0, p, n);
+		return 1;
+
+	case SM_INTEGRITY_CRC64:
+		if (!context->checking.crc_64) return 0;
+		*value = sm_integrity_value(context, algorithm, 0, p, n);
+		return 1;
+
+	default:
+		return 0;
+	}
+}
+
+
+// Seals a data entry's data.
+exported uint8_t callconv sm_data_entry_seal(sm_t sm, sm_data_entry_t* entry, uint8_t algorithm)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+	uint64_t value;
+
+	if (!context || !entry) return 0;
+
+	if (algorithm == SM_INTEGRITY_DEFAULT) algorithm = context->checking.integrity;
+
+	if (algorithm != SM_INTEGRITY_NONE && (algorithm & SM_INTEGRITY_TREE))
+		return sm_data_entry_seal_tree(sm, entry, algorithm & (uint8_t)~SM_INTEGRITY_TREE, 0);
+
+	if (!sm_integrity_compute(sm, algorithm, entry->data, entry->bytes, &value))
+	{
+		if (context->error)
+			context->error(context, SM_ERR_INVALID_ARGUMENT);
+
+		return 0;
+	}
+
+	sm_integrity_record(context, entry, algorithm, value, NULL);
+
+	return 1;
+}
+
+
+// Seals a data entry's data with a chunk tree.
+exported uint8_t callconv sm_data_entry_seal_tree(sm_t sm, sm_data_entry_t* entry, uint8_t algorithm, size_t chunk)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+
+	if (!context || !entry) return 0;
+
+	if (!chunk) chunk = SM_INTEGRITY_CHUNK;
+
+	if ((algorithm != SM_INTEGRITY_CRC32C && algorithm != SM_INTEGRITY_CRC64) || (algorithm == SM_INTEGRITY_CRC64 && !context->checking.crc_64) ||
+		(!entry->data && entry->bytes))
+	{
+		if (context->error)
+			context->error(context, SM_ERR_INVALID_ARGUMENT);
+
+		return 0;
+	}
+
+	register const size_t chunks = sm_max((entry->bytes + chunk - 1) / chunk, (size_t)1);
+	register size_t leaves = 1;
+
+	while (leaves < chunks) leaves *= 2;
+
+	sm_integrity_tree_t* tree = (sm_integrity_tree_t*)context->memory.allocate(context->memory.allocator, sizeof(sm_integrity_tree_t) + (((2 * leaves) - 1) * sizeof(uint64_t)));
+
+	if (!tree)
+	{
+		if (context->error)
+			context->error(context, SM_ERR_OUT_OF_MEMORY);
+
+		return 0;
+	}
+
+	tree->algorithm = algorithm;
+	tree->chunk = chunk;
+	tree->chunks = chunks;
+	tree->leaves = leaves;
+	tree->nodes = (uint64_t*)(tree + 1);
+
+	register size_t i = (2 * leaves) - 1;
+
+	while (i-- > 0) // Children come after their parents, so are done first.
+		tree->nodes[i] = sm_integrity_node(context, tree, (const uint8_t*)entry->data, entry->bytes, i);
+
+	sm_integrity_record(context, entry, algorithm | SM_INTEGRITY_TREE, tree->nodes[0], tree);
+
+	return 1;
+}
+
+
+// Verifies a data entry's data.
+exported uint8_t callconv sm_data_entry_verify(sm_t sm, const sm_data_entry_t* entry)
+{
+	if (!entry) return 0;
+
+	return sm_data_entry_verify_range(sm, entry, 0, entry->bytes);
+}
+
+
+// Verifies a range of a data entry's data.
+exported uint8_t callconv sm_data_entry_verify_range(sm_t sm, const sm_data_entry_t* entry, size_t offset, size_t bytes)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+	uint64_t value;
+
+	if (!context || !entry) return 0;
+
+	if (entry->integrity == SM_INTEGRITY_NONE) return 1;
+
+	if (entry->tree)
+	{
+		if (offset <= entry->bytes && bytes <= entry->bytes - offset)
+		{
+			if (!bytes) return 1;
+
+			if (sm_integrity_path(context, entry, offset / entry->tree->chunk, (offset + bytes - 1) / entry->tree->chunk, 0)) return 1;
+		}
+	}
+	else if (sm_integrity_compute(sm, entry->integrity, entry->data, entry->bytes, &value) && value == entry->check) return 1;
+
+	if (context->error)
+		context->error(context, SM_ERR_INVALID_CRC);
+
+	return 0;
+}
+
+
+// Writes a range of a data entry's data.
+exported uint8_t callconv sm_data_entry_write(sm_t sm, sm_data_entry_t* entry, size_t offset, const void* value, size_t bytes)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+
+	if (!context || !entry || (!value && bytes)) return 0;
+
+	if (offset > entry->bytes || bytes > entry->bytes - offset)
+	{
+		if (context->error)
+			context->error(context, SM_ERR_INVALID_ARGUMENT);
+
+		return 0;
+	}
+
+	if (!bytes) return 1;
+
+	if (!sm_data_entry_verify_range(sm, entry, offset, bytes)) return 0; // So that a write cannot launder corruption.
+
+	memmove((uint8_t*)entry->data + offset, value, bytes);
+
+	if (entry->integrity == SM_INTEGRITY_NONE) return 1;
+
+	if (!entry->tree) return sm_data_entry_seal(sm, entry, entry->integrity);
+
+	sm_integrity_path(context, entry, offset / entry->tree->chunk, (offset + bytes - 1) / entry->tree->chunk, 1);
+	sm_integrity_assign(context, entry, check, entry->tree->nodes[0]);
+
+	return 1;
+}
+
+
+// Unseals a data entry.
+exported void callconv sm_data_entry_unseal(sm_t sm, sm_data_entry_t* entry)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+	uint64_t zero = 0;
+
+	if (!context || !entry) return;
+
+	sm_integrity_record(context, entry, SM_INTEGRITY_NONE, zero, NULL);
+}
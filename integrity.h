@@ -0,0 +1,50 @@
+// integrity.h - Selectable integrity values of secure data blocks.
+
+
+#include "config.h"
+#include "sm.h"
+#include "sm_internal.h"
+
+
+#ifndef INCLUDE_INTEGRITY_H
+#define INCLUDE_INTEGRITY_H 1
+
+
+// The default chunk size of SM_INTEGRITY_TREE entries.
+#define SM_INTEGRITY_CHUNK 0x1000U
+
+
+// Computes the integrity value of n bytes at p by the given algorithm, SM_INTEGRITY_* other than SM_INTEGRITY_DEFAULT,
+// storing it at value. Returns 1 on success, or 0 if the algorithm is unknown, or is CRC-64 and the context has no CRC-64
+// kernel (as in debug builds).
+exported uint8_t callconv sm_integrity_compute(sm_t sm, uint8_t algorithm, const void* p, size_t n, uint64_t* value);
+
+// Records the given algorithm in the entry, the context's default for SM_INTEGRITY_DEFAULT, with the integrity value of
+// its data. With SM_INTEGRITY_TREE, builds a tree of SM_INTEGRITY_CHUNK chunks, as for sm_data_entry_seal_tree. The
+// entry's own CRC is kept current if it is sealed. Returns 1 on success, or 0 as for sm_integrity_compute, or if the tree
+// cannot be allocated, leaving the entry unchanged.
+exported uint8_t callconv sm_data_entry_seal(sm_t sm, sm_data_entry_t* entry, uint8_t algorithm);
+
+// Seals the entry with a Merkle tree of the given algorithm's values: one leaf per chunk of the given size, zero for
+// SM_INTEGRITY_CHUNK, and each parent the value of its two children. Each value is seeded by its node's position, so
+// that chunks cannot be swapped. The root is stored as the entry's integrity value.
+exported uint8_t callconv sm_data_entry_seal_tree(sm_t sm, sm_data_entry_t* entry, uint8_t algorithm, size_t chunk);
+
+// Checks the entry's data against its integrity value, by the algorithm recorded in it. Returns 1 if they match or the
+// algorithm is SM_INTEGRITY_NONE, or else 0, raising SM_ERR_INVALID_CRC.
+exported uint8_t callconv sm_data_entry_verify(sm_t sm, const sm_data_entry_t* entry);
+
+// Checks the given range of the entry's data as for sm_data_entry_verify. With a tree, only the chunks the range touches
+// and their paths to the root are checked; otherwise, the whole of the data is.
+exported uint8_t callconv sm_data_entry_verify_range(sm_t sm, const sm_data_entry_t* entry, size_t offset, size_t bytes);
+
+// Checks the range of the entry's data, then copies bytes from value over it and brings its integrity value up to date.
+// With a tree, only the chunks written and their paths to the root are checked and updated. Returns 1 on success, or 0
+// if the range is outside the data or fails its check, leaving the data unchanged.
+exported uint8_t callconv sm_data_entry_write(sm_t sm, sm_data_entry_t* entry, size_t offset, const void* value, size_t bytes);
+
+// Releases the entry's tree, if any, and records SM_INTEGRITY_NONE.
+exported void callconv sm_data_entry_unseal(sm_t sm, sm_data_entry_t* entry);
+
+
+#endif // INCLUDE_INTEGRITY_H
@@ -2,6 +2,7 @@
 
 
 #include <time.h>
+#include <string.h>
 #ifdef _DEBUG
 #include <stdio.h>
 #endif
@@ -12,9 +13,65 @@
 #include "sm_internal.h"
 #include "mutex.h"
 #include "bits.h"
+#include "entropy.h"
+#include "vector_rand.h"
+#include "thread.h"
+#include "chacha.h"
+#include "ticks.h"
+#include "fork.h"
 #include "compatibility/gettimeofday.h"
 
 
+// The count of values a thread draws from its stream before re-deriving it from the master.
+#define SM_RANDOM_STREAM_PERIOD UINT64_C(0x100000)
+
+// The count of streams taken from the jump base before the base is re-seeded from the master.
+#define SM_RANDOM_STREAM_JUMPS UINT32_C(0x40)
+
+// Fills of at least this many bytes are served from the stream's vector lanes rather than the stream itself.
+#define SM_RANDOM_FILL_LANES 0x200U
+
+
+// Per-thread random stream state.
+typedef struct sm_random_stream_s
+{
+	sm_context_t* context; // The context the stream was derived from.
+	uint64_t epoch; // The stream epoch of that context at derivation.
+	uint64_t process; // The fork generation at derivation.
+	uint64_t remaining; // The count of values left before re-derivation.
+	uint64_t state[2]; // The Xoroshiro128+ state.
+	uint8_t seeded; // Whether the lanes have been seeded from the state since derivation.
+	sm_vector_rand_t lanes; // Multi-lane engine for bulk fills, long-jumped away from the state.
+}
+sm_random_stream_t;
+
+
+// The count of 64-bit values held by a thread's hardware entropy ring.
+#define SM_RANDOM_RING_SIZE UINT32_C(0x100)
+
+// A ring holding fewer values than this is refilled before the next value is taken.
+#define SM_RANDOM_RING_LOW UINT32_C(0x20)
+
+
+// Per-thread hardware entropy ring state.
+typedef struct sm_random_ring_s
+{
+	sm_context_t* context; // The context the ring was filled for.
+	uint64_t epoch; // The stream epoch of that context at fill.
+	uint64_t process; // The fork generation at fill.
+	uint32_t count; // The count of values left in the ring.
+	uint64_t values[SM_RANDOM_RING_SIZE]; // Buffered RDRAND or RDSEED values.
+}
+sm_random_ring_t;
+
+
+// The calling thread's random stream.
+static tlocal sm_random_stream_t sm_random_stream__;
+
+// The calling thread's hardware entropy ring.
+static tlocal sm_random_ring_t sm_random_ring__;
+
+
 // XorShift1024* 64-bit seed, given state.
 inline static void sm_random_seed(void *restrict s, uint64_t seed)
 {
@@ -42,7 +99,44 @@ inline static uint64_t sm_random_next(void *restrict s)
 }
 
 
-// Initializes the random master. If RDRAND is available, simply sets a flag, otherwise uses a variety of
+// Xoroshiro128+ 64-bit generate next, given state.
+inline static uint64_t sm_random_stream_next(register uint64_t *restrict s)
+{
+	register const uint64_t s0 = s[0];
+	register uint64_t s1 = s[1];
+	const uint64_t r = s0 + s1;
+
+	s1 ^= s0;
+	s[0] = sm_rotl_64(s0, 55) ^ s1 ^ (s1 << 14);
+	s[1] = sm_rotl_64(s1, 36);
+
+	return r;
+}
+
+
+// Xoroshiro128+ 64-bit jump, given state. Equivalent to 2^64 calls to sm_random_stream_next.
+inline static void sm_random_stream_jump(register uint64_t *restrict s)
+{
+	static const uint64_t j[2] = { UINT64_C(0xBEAC0467EBA5FACB), UINT64_C(0xD86B048B86AA9922) };
+	register uint64_t s0 = 0, s1 = 0;
+	register uint8_t i, b;
+
+	for (i = 0; i < 2; ++i)
+	{
+		for (b = 0; b < 64; ++b)
+		{
+			if (j[i] & (UINT64_C(1) << b))
+				s0 ^= s[0], s1 ^= s[1];
+			(void)sm_random_stream_next(s);
+		}
+	}
+
+	s[0] = s0;
+	s[1] = s1;
+}
+
+
+// Initializes the random master. If RDRAND or RDSEED is available, simply selects the ring source, otherwise uses a variety of
 // time, UID, PID, TID and other measures with bit twiddling to seed an XorShift1024* 64-bit state.
 inline static void sm_random_initialize(sm_context_t* context)
 {
@@ -57,8 +151,22 @@ inline static void sm_random_initialize(sm_context_t* context)
 		else context->random.rdrand.available = 0;
 	}
 
-	if (context->random.rdrand.available) // Have RDRAND so no further init is needed.
+	if (context->random.rdseed.available == 0xFF)
+	{
+		if (context->random.rdseed.exists && context->random.rdseed.next)
+			context->random.rdseed.available = (context->random.rdseed.exists() != 0) ? 1 : 0; // Test for RDSEED.
+		else context->random.rdseed.available = 0;
+	}
+
+	if (context->random.rdrand.available) context->random.ring.source = context->random.rdrand.next;
+	else if (context->random.rdseed.available) context->random.ring.source = context->random.rdseed.next;
+	else context->random.ring.source = NULL;
+
+	context->random.process = sm_fork_generation();
+
+	if (context->random.ring.source) // Have RDRAND or RDSEED so no further init is needed.
 	{
+		context->random.streams.epoch = context->random.ring.source() | 1; // New epoch, so stale thread rings are refilled.
 		context->random.initialized = 1; // Set init flag.
 		context->synchronization.leave(&context->random.lock); // Unlock mutex.
 		return;
@@ -83,11 +191,24 @@ inline static void sm_random_initialize(sm_context_t* context)
 
 	sm_random_seed(context->random.state, rs); // Actually seed the RNG.
 
-	uint8_t ix, ns = 16 + ((rs ^ sm_random_next(context->random.state) + 1) % 32); // Get a random count of times up to 16 + [0 .. 32].
+	uint8_t ix, ep[sizeof(uint64_t) * 16];
+
+	(void)sm_entropy_read(ep, sizeof(ep)); // Fold in system entropy from the process pool.
+
+	for (ix = 0; ix < sizeof(ep); ++ix)
+		context->random.state[sizeof(uint32_t) + ix] ^= ep[ix], ep[ix] = 0;
+
+	uint8_t ns = 16 + ((rs ^ sm_random_next(context->random.state) + 1) % 32); // Get a random count of times up to 16 + [0 .. 32].
 
 	for (ix = 0; ix < ns; ++ix) 
 		(void)sm_random_next(context->random.state); // Warm it up.
 
+	context->random.streams.epoch = sm_random_next(context->random.state) | 1; // New epoch, so stale thread streams are re-derived.
+	context->random.streams.jumps = 0;
+
+	context->random.reseed.served = 0;
+	context->random.reseed.last = sm_ticks();
+
 	context->random.initialized = 1; // Set init flag.
 	context->synchronization.leave(&context->random.lock); // Unlock random master mutex.
 }
@@ -116,7 +237,294 @@ inline static uint64_t sm_default_rand(register int (*rf)())
 }
 
 
-// Generates a new 64-bit entropic or quasi-entropic value.
+// Generates the next master value. The caller must hold the random master mutex. Reseeding is left to the reseed
+// policy, so every call costs the same.
+inline static uint64_t sm_random_master(sm_context_t* context)
+{
+	return sm_random_next(context->random.state);
+}
+
+
+// Builds a new XorShift1024* state at s from time measures and the process entropy pool, mixed with the given master
+// value. Takes no lock, so it can run on the reseed thread while the master keeps serving.
+inline static void sm_random_reseed_build(sm_context_t* context, uint64_t mix, uint8_t* s)
+{
+	uint64_t rs = mix ^ sm_shuffle_64(sm_ticks()); // XOR with the shuffled tick count.
+	rs ^= sm_green_64(sm_shuffle_64(context->random.entropy.get_clock())); // XOR with the green of the shuffled clock.
+
+#if defined(SM_OS_WINDOWS)
+	rs ^= sm_yellow_64(sm_shuffle_64(context->random.entropy.get_ticks())); // XOR with yellow shuffle of 64-bit tick count on Windows.
+#else
+	struct timeval tv = { 0, 0 };
+	if (!context->random.entropy.get_time_of_day(&tv, NULL))
+		rs ^= sm_yellow_64(sm_shuffle_64(tv.tv_sec) ^ sm_green_64(tv.tv_usec));
+#endif
+
+	sm_random_seed(s, sm_yellow_64(rs));
+
+	uint8_t ix, ep[sizeof(uint64_t) * 16];
+
+	(void)sm_entropy_read(ep, sizeof(ep)); // Fold in system entropy from the process pool.
+
+	for (ix = 0; ix < sizeof(ep); ++ix)
+		s[sizeof(uint32_t) + ix] ^= ep[ix], ep[ix] = 0;
+
+	for (ix = 0; ix < 32; ++ix) // Warm it up.
+		(void)sm_random_next(s);
+}
+
+
+// Installs the given state as the master and starts a new generation: the jump base is re-seeded on the next derivation,
+// and the new epoch makes every thread re-derive its stream. The caller must hold the random master mutex.
+inline static void sm_random_reseed_install(sm_context_t* context, uint8_t* s)
+{
+	memcpy(context->random.state, s, sizeof(context->random.state));
+	memset(s, 0, sizeof(context->random.state));
+
+	context->random.streams.epoch = sm_random_next(context->random.state) | 1;
+	context->random.streams.jumps = 0;
+
+	context->random.reseed.served = 0;
+	context->random.reseed.last = sm_ticks();
+	context->random.reseed.generations++;
+}
+
+
+// Reseeds the master at once if the process has forked since the master was seeded, so that parent and child never share
+// a sequence. The reseed thread did not survive the fork, and any state it left pending is the parent's, so both are
+// forgotten. The caller must hold the random master mutex.
+inline static void sm_random_fork_check(sm_context_t* context, uint64_t process)
+{
+	if (context->random.process == process) return;
+
+	context->random.process = process;
+
+	memset(context->random.reseed.pending, 0, sizeof(context->random.reseed.pending));
+
+	context->random.reseed.ready = 0;
+	context->random.reseed.requested = 0;
+	context->random.reseed.running = 0;
+	context->random.reseed.stop = 0;
+
+	sm_condition_create(&context->random.reseed.wake); // Its waiter was the parent's reseed thread.
+
+	if (context->random.ring.source) return; // No master state to replace.
+
+	uint8_t s[sizeof(context->random.state)];
+
+	sm_random_reseed_build(context, sm_random_next(context->random.state), s);
+	sm_random_reseed_install(context, s);
+}
+
+
+// Reseed thread. Builds a new state whenever one is requested and leaves it pending for the next derivation to install.
+static void sm_random_reseeder(void* p)
+{
+	sm_context_t* context = (sm_context_t*)p;
+	uint8_t s[sizeof(context->random.state)];
+
+	context->synchronization.enter(&context->random.lock);
+
+	while (!context->random.reseed.stop)
+	{
+		if (!context->random.reseed.requested)
+		{
+			sm_condition_wait(&context->random.reseed.wake, &context->random.lock);
+			continue;
+		}
+
+		register const uint64_t mix = context->random.reseed.mix;
+
+		context->random.reseed.requested = 0;
+		context->random.reseed.mix = 0;
+
+		context->synchronization.leave(&context->random.lock); // Build without holding the master.
+
+		sm_random_reseed_build(context, mix, s);
+
+		context->synchronization.enter(&context->random.lock);
+
+		memcpy(context->random.reseed.pending, s, sizeof(s));
+		memset(s, 0, sizeof(s));
+
+		context->random.reseed.ready = 1;
+	}
+
+	context->synchronization.leave(&context->random.lock);
+}
+
+
+// Stops the reseed thread, if running, and discards any pending state. The caller must not hold the random master mutex.
+inline static void sm_random_reseeder_stop(sm_context_t* context)
+{
+	context->synchronization.enter(&context->random.lock);
+
+	if (context->random.initialized) // A reseed thread inherited across a fork is not there to stop.
+		sm_random_fork_check(context, sm_fork_generation());
+
+	if (!context->random.reseed.running || context->random.reseed.stop) // Not running, or already being stopped.
+	{
+		context->synchronization.leave(&context->random.lock);
+		return;
+	}
+
+	context->random.reseed.stop = 1;
+	sm_condition_wake_all(&context->random.reseed.wake);
+
+	context->synchronization.leave(&context->random.lock);
+
+	sm_thread_join(&context->random.reseed.thread);
+
+	context->synchronization.enter(&context->random.lock);
+
+	memset(context->random.reseed.pending, 0, sizeof(context->random.reseed.pending));
+
+	context->random.reseed.ready = 0;
+	context->random.reseed.requested = 0;
+	context->random.reseed.running = 0;
+	context->random.reseed.stop = 0;
+
+	context->synchronization.leave(&context->random.lock);
+}
+
+
+// Applies the reseed policy as a stream is derived. A pending state is installed at once. Otherwise, once the master is
+// due, the reseed thread is asked for a new state, or without one the state is built inline. The caller must hold the 
+// random master mutex.
+inline static void sm_random_reseed_check(sm_context_t* context)
+{
+	context->random.reseed.served += SM_RANDOM_STREAM_PERIOD;
+
+	if (context->random.reseed.ready)
+	{
+		context->random.reseed.ready = 0;
+		sm_random_reseed_install(context, context->random.reseed.pending);
+		return;
+	}
+
+	if (context->random.reseed.requested) return; // Already being built.
+
+	if (!(context->random.reseed.outputs && context->random.reseed.served >= context->random.reseed.outputs) &&
+		!(context->random.reseed.ticks && sm_ticks() - context->random.reseed.last >= context->random.reseed.ticks))
+		return; // Not due.
+
+	if (context->random.reseed.background && !context->random.reseed.running) // Start the reseed thread on first use.
+		context->random.reseed.running = sm_thread_create(&context->random.reseed.thread, sm_random_reseeder, context);
+
+	if (context->random.reseed.background && context->random.reseed.running && !context->random.reseed.stop)
+	{
+		context->random.reseed.mix = sm_random_next(context->random.state);
+		context->random.reseed.requested = 1;
+		sm_condition_wake(&context->random.reseed.wake);
+		return;
+	}
+
+	uint8_t s[sizeof(context->random.state)];
+
+	sm_random_reseed_build(context, sm_random_next(context->random.state), s);
+	sm_random_reseed_install(context, s);
+}
+
+
+// Derives the calling thread's stream from the master. The stream takes the current jump base, which then jumps 2^64 
+// values ahead, so that streams taken from one base never overlap. The base is re-seeded from the master every
+// SM_RANDOM_STREAM_JUMPS streams, or when the reseed policy installs a new master. This is the only place a thread 
+// touches the master mutex, and where a forked child first reseeds.
+inline static void sm_random_stream_derive(sm_context_t* context, sm_random_stream_t* stream, uint64_t process)
+{
+	context->synchronization.enter(&context->random.lock); // Lock the master rand mutex.
+
+	sm_random_fork_check(context, process);
+	sm_random_reseed_check(context);
+
+	if (context->random.streams.jumps == 0)
+	{
+		context->random.streams.base[0] = sm_random_master(context);
+		context->random.streams.base[1] = sm_random_master(context);
+
+		if (!(context->random.streams.base[0] | context->random.streams.base[1])) // Avoid the all-zero state.
+			context->random.streams.base[1] = UINT64_C(0x9E3779B97F4A7C15);
+	}
+
+	stream->state[0] = context->random.streams.base[0];
+	stream->state[1] = context->random.streams.base[1];
+
+	sm_random_stream_jump(context->random.streams.base);
+
+	context->random.streams.jumps = (context->random.streams.jumps + 1) % SM_RANDOM_STREAM_JUMPS;
+
+	stream->context = context;
+	stream->epoch = context->random.streams.epoch;
+	stream->process = process;
+	stream->remaining = SM_RANDOM_STREAM_PERIOD;
+	stream->seeded = 0;
+
+	context->synchronization.leave(&context->random.lock); // Unlock random master mutex.
+}
+
+
+// Takes the next value from the calling thread's hardware entropy ring. The ring is private to the thread, so no lock is
+// taken; once it holds fewer than SM_RANDOM_RING_LOW values it is topped up in bulk from the context's ring source. A ring
+// filled before a fork is emptied, so that parent and child do not return the same buffered values.
+inline static uint64_t sm_random_ring_next(sm_context_t* context, uint64_t process)
+{
+	register sm_random_ring_t* ring = &sm_random_ring__;
+	register uint32_t i;
+
+	if (ring->context != context || ring->epoch != context->random.streams.epoch || ring->process != process)
+	{
+		ring->context = context;
+		ring->epoch = context->random.streams.epoch;
+		ring->process = process;
+		ring->count = 0;
+	}
+
+	if (ring->count < SM_RANDOM_RING_LOW)
+	{
+		for (i = ring->count; i < SM_RANDOM_RING_SIZE; ++i)
+			ring->values[i] = context->random.ring.source();
+
+		ring->count = SM_RANDOM_RING_SIZE;
+
+		(void)sm_atomic_add_64(&context->random.ring.refills, 1);
+	}
+
+	i = --ring->count;
+
+	register uint64_t v = ring->values[i];
+	ring->values[i] = 0; // Do not leave consumed values behind.
+
+	return v;
+}
+
+
+// Word sources for sm_random_fill.
+
+inline static uint64_t sm_random_fill_default(sm_context_t* context, sm_random_stream_t* stream)
+{
+	return sm_default_rand(rand);
+}
+
+inline static uint64_t sm_random_fill_method(sm_context_t* context, sm_random_stream_t* stream)
+{
+	return context->random.method(context);
+}
+
+inline static uint64_t sm_random_fill_hardware(sm_context_t* context, sm_random_stream_t* stream)
+{
+	return context->random.ring.source();
+}
+
+inline static uint64_t sm_random_fill_stream(sm_context_t* context, sm_random_stream_t* stream)
+{
+	if (stream->remaining) stream->remaining--; // Re-derived on the next call once spent.
+	return sm_random_stream_next(stream->state);
+}
+
+
+// Generates a new 64-bit entropic or quasi-entropic value. With RDRAND or RDSEED, values come from a per-thread ring
+// refilled in bulk, otherwise from a per-thread stream, so that concurrent callers do not contend on the master mutex. 
+// Either is discarded on the first call after a fork, which is detected without a system call.
 exported uint64_t callconv sm_random(sm_t sm)
 {
 	if (!sm) return sm_default_rand(rand);
@@ -126,54 +534,152 @@ exported uint64_t callconv sm_random(sm_t sm)
 	if (!context->random.initialized)
 		sm_random_initialize(context); // Initialize if needed.
 
-	if (context->random.rdrand.available == 1 && context->random.rdrand.next) // Have RDRAND, so just return the next value.
-		return context->random.rdrand.next();
+	register const uint64_t process = sm_fork_generation();
+
+	if (context->random.ring.source) // Have RDRAND or RDSEED, so return the next buffered value.
+		return sm_random_ring_next(context, process);
 
 	// Do it the hard way.
 
-	context->synchronization.enter(&context->random.lock); // Lock the master rand mutex.
+	sm_random_stream_t* stream = &sm_random_stream__;
 
-	uint64_t rv = sm_random_next(context->random.state); // Get the next random value to return.
+	if (stream->context != context || stream->epoch != context->random.streams.epoch || stream->remaining == 0 || stream->process != process)
+		sm_random_stream_derive(context, stream, process);
 
-	// Reseed indicator.
-	uint64_t rs = sm_yellow_64(sm_shuffle_64(context->random.entropy.get_time(NULL))) ^ sm_random_next(context->random.state); // The yellow of the shuffled time and XOR of another random value.
+	stream->remaining--;
 
-	if (!sm || !rs || (rs % 16) == 0) // Every zero or zero modulus 8 of rs, do a re-seed.
+	return sm_random_stream_next(stream->state);
+}
+
+
+// Fills n bytes at d from the given word source, storing whole aligned words.
+inline static void sm_random_fill_with(register uint8_t* d, size_t n, uint64_t (*next)(sm_context_t*, sm_random_stream_t*), sm_context_t* context, sm_random_stream_t* stream)
+{
+	register uint64_t v;
+
+	if (((uintptr_t)d & 7) != 0) // Unaligned head.
 	{
-		rv ^= sm_shuffle_64(context->random.entropy.get_clock()); // XOR with shuffled clock.
+		v = next(context, stream);
+		while (n > 0 && ((uintptr_t)d & 7) != 0) *d++ = (uint8_t)v, v >>= 8, --n;
+	}
 
-#if defined(SM_OS_WINDOWS)
-		rs ^= sm_yellow_64(sm_shuffle_64(context->random.entropy.get_ticks())); // XOR with yellow shuffle of 64-bit tick count on Windows.
-#else
-		struct timeval tv = { 0, 0 };
-		if (!context->random.entropy.get_time of day(&tv, NULL))
-		{
-			if ((rs ^ ~tv.tv_usec) & 1) // Mix it up a bit.
-				rv ^= sm_green_64(sm_green_64(tv.tv_sec) ^ sm_shuffle_64(tv.tv_usec));
-			else rv ^= sm_yellow_64(sm_shuffle_64(tv.tv_sec) ^ sm_green_64(tv.tv_usec));
-		}
-#endif
+	for (; n >= sizeof(uint64_t); n -= sizeof(uint64_t), d += sizeof(uint64_t))
+		*(uint64_t*)d = next(context, stream);
 
-		rs = sm_yellow_64(rv ^ ~rs ^ sm_random_next(context->random.state));
+	if (n > 0) // Tail.
+	{
+		v = next(context, stream);
+		while (n-- > 0) *d++ = (uint8_t)v, v >>= 8;
+	}
+}
 
-		if (rv & 1) // Cyclic shift a variable amount [1 .. 63] bits left or right.
-			rs = sm_rotl_64(rs, 1 + ((1 + rv) % 62));
-		else rs = sm_rotl_64(rs, 1 + ((1 + rv) % 62));
 
-		// Now re-seed.
-		sm_random_seed(context->random.state, rs);
+// Fills n bytes at p with random values, a 64-bit word at a time. With RDRAND or RDSEED, the words are read directly, as
+// buffering a bulk request gains nothing. Otherwise they come from the calling thread's stream, which is derived at most
+// once per call, so the master mutex is taken at most once; large fills come from the stream's vector lanes instead. A
+// context using ChaCha20 is filled from the thread's keystream, and one with another RNG method from that method, one
+// call per word.
+exported void callconv sm_random_fill(sm_t sm, void* p, size_t n)
+{
+	if (!p || !n) return;
 
-		register uint8_t ix, ns = 16 + ((sm_random_next(context->random.state) + 1) % 16); // Get a count of re-warm-up steps.
+	sm_context_t* context = (sm_context_t*)sm;
 
-		for (ix = 0; ix < ns; ++ix) // Re-warm it up a random count of times.
-			sm_random_next(context->random.state);
+	if (!context)
+	{
+		sm_random_fill_with((uint8_t*)p, n, sm_random_fill_default, NULL, NULL);
+		return;
+	}
 
-		rv = sm_random_next(context->random.state); // Get the result value.
+	if (context->random.method == sm_random_chacha)
+	{
+		sm_random_chacha_fill(sm, p, n);
+		return;
 	}
 
-	context->synchronization.leave(&context->random.lock); // Unlock random master mutex.
+	if (context->random.method != sm_random)
+	{
+		sm_random_fill_with((uint8_t*)p, n, sm_random_fill_method, context, NULL);
+		return;
+	}
+
+	if (!context->random.initialized)
+		sm_random_initialize(context); // Initialize if needed.
+
+	if (context->random.ring.source)
+	{
+		sm_random_fill_with((uint8_t*)p, n, sm_random_fill_hardware, context, NULL);
+		return;
+	}
 
-	return rv;
+	register const uint64_t process = sm_fork_generation();
+	sm_random_stream_t* stream = &sm_random_stream__;
+
+	if (stream->context != context || stream->epoch != context->random.streams.epoch || stream->remaining == 0 || stream->process != process)
+		sm_random_stream_derive(context, stream, process);
+
+	if (n < SM_RANDOM_FILL_LANES)
+	{
+		sm_random_fill_with((uint8_t*)p, n, sm_random_fill_stream, context, stream);
+		return;
+	}
+
+	if (!stream->seeded)
+	{
+		sm_vector_rand_seed(&stream->lanes, stream->state);
+		stream->seeded = 1;
+	}
+
+	sm_vector_rand_fill(&stream->lanes, p, n);
+
+	register const uint64_t words = n / sizeof(uint64_t); // The lanes share the stream's period.
+	stream->remaining = (stream->remaining > words) ? stream->remaining - words : 0;
+}
+
+
+// Sets the reseed policy of the given context. Stops the reseed thread if background reseeding is turned off.
+exported void callconv sm_random_set_reseed(sm_t sm, uint64_t outputs, uint64_t ticks, uint8_t background)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+
+	if (!context) return;
+
+	const uint8_t flag = background ? 1 : 0;
+
+	context->synchronization.enter(&context->random.lock);
+
+	sm_context_assign(context, random.reseed.outputs, outputs);
+	sm_context_assign(context, random.reseed.ticks, ticks);
+	sm_context_assign(context, random.reseed.background, flag);
+
+	context->synchronization.leave(&context->random.lock);
+
+	if (!background) sm_random_reseeder_stop(context);
 }
 
 
+// Releases the random master of the given context, stopping the reseed thread. Called as the context is destroyed.
+exported void callconv sm_random_release(sm_t sm)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+
+	if (!context) return;
+
+	sm_random_reseeder_stop(context);
+	sm_condition_destroy(&context->random.reseed.wake);
+}
+
+
+// Sets the RNG method of the given context, such as sm_random_chacha. Null restores the master.
+exported void callconv sm_random_set_method(sm_t sm, uint64_t (*method)(sm_t))
+{
+	sm_context_t* context = (sm_context_t*)sm;
+
+	if (!context) return;
+
+	if (!method) method = sm_random;
+
+	context->synchronization.enter(&context->random.lock);
+	sm_context_assign(context, random.method, method);
+	context->synchronization.leave(&context->random.lock);
+}
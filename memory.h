@@ -5,28 +5,23 @@
 
 #include "config.h"
 #include "random.h"
+#include "sm.h"
 
 
 #ifndef INCLUDE_MEMORY_H
 #define INCLUDE_MEMORY_H 1
 
 
-// Randomizes the specified block of memory p for the count of bytes n using the global random number 
-// generator. Returns p.
-inline static void* sec_memran(void* p, register size_t n)
+// Randomizes the specified block of memory p for the count of bytes n using the master random number 
+// generator of the given context, or the default generator if it is null. Returns p.
+inline static void* sec_memran(sm_t sm, void* p, register size_t n)
 {
-	register uint8_t* t = (uint8_t*)p;
-
-	while (n-- > 0U)
-		*t++ = sec_random_next_byte();
+	sm_random_fill(sm, p, n);
 
 	return p;
 }
 
-#define MEMRAN(P, N) { \
-	register uint8_t* mr_t__ = (uint8_t*)(P); \
-	register size_t mr_n__ = (N); \
-	while (mr_n__-- > 0U) *mr_t__++ = sec_random_next_byte(); }, (P)
+#define MEMRAN(S, P, N) (sm_random_fill((S), (P), (N)), (P))
 
 
 // Performs p = p ^ q, for the given count of bytes. Returns p.
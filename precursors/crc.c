@@ -22,3 +22,83 @@ exported uint64_t callconv crc_64(uint64_t c, register const uint8_t *restrict p
 	return c ^ ~UINT64_C(0);
 }
 
+
+
+// The slice kernels take a table of 16 rows of 256 entries, where row 0 is the byte-wise table and entry i of row k is
+// the CRC of byte i followed by k zero bytes. The 8-byte kernels use rows 0 .. 7 and the 16-byte kernels all 16, and
+// each gives the same result as its byte-wise kernel above.
+
+
+exported uint32_t callconv crc_32_s8(uint32_t c, register const uint8_t *restrict p, uint64_t n, void* t)
+{
+	register const uint32_t (*tab)[256] = t;
+	register uint32_t a, b;
+	c = c ^ ~UINT32_C(0);
+	for (; n >= 8; n -= 8, p += 8)
+	{
+		a = ((const uint32_t*)p)[0] ^ c;
+		b = ((const uint32_t*)p)[1];
+		c = tab[7][a & 0xFF] ^ tab[6][(a >> 8) & 0xFF] ^ tab[5][(a >> 16) & 0xFF] ^ tab[4][a >> 24] ^
+			tab[3][b & 0xFF] ^ tab[2][(b >> 8) & 0xFF] ^ tab[1][(b >> 16) & 0xFF] ^ tab[0][b >> 24];
+	}
+	while (n--)
+		c = tab[0][(c ^ *p++) & UINT32_C(0xFF)] ^ (c >> 8);
+	return c ^ ~UINT32_C(0);
+}
+
+
+exported uint32_t callconv crc_32_s16(uint32_t c, register const uint8_t *restrict p, uint64_t n, void* t)
+{
+	register const uint32_t (*tab)[256] = t;
+	register uint32_t a, b, d, e;
+	c = c ^ ~UINT32_C(0);
+	for (; n >= 16; n -= 16, p += 16)
+	{
+		a = ((const uint32_t*)p)[0] ^ c;
+		b = ((const uint32_t*)p)[1];
+		d = ((const uint32_t*)p)[2];
+		e = ((const uint32_t*)p)[3];
+		c = tab[15][a & 0xFF] ^ tab[14][(a >> 8) & 0xFF] ^ tab[13][(a >> 16) & 0xFF] ^ tab[12][a >> 24] ^
+			tab[11][b & 0xFF] ^ tab[10][(b >> 8) & 0xFF] ^ tab[9][(b >> 16) & 0xFF] ^ tab[8][b >> 24] ^
+			tab[7][d & 0xFF] ^ tab[6][(d >> 8) & 0xFF] ^ tab[5][(d >> 16) & 0xFF] ^ tab[4][d >> 24] ^
+			tab[3][e & 0xFF] ^ tab[2][(e >> 8) & 0xFF] ^ tab[1][(e >> 16) & 0xFF] ^ tab[0][e >> 24];
+	}
+	while (n--)
+		c = tab[0][(c ^ *p++) & UINT32_C(0xFF)] ^ (c >> 8);
+	return c ^ ~UINT32_C(0);
+}
+
+
+exported uint64_t callconv crc_64_s8(uint64_t c, register const uint8_t *restrict p, uint64_t n, void* t)
+{
+	register const uint64_t (*tab)[256] = t;
+	register uint64_t a;
+	for (; n >= 8; n -= 8, p += 8)
+	{
+		a = ((const uint64_t*)p)[0] ^ c;
+		c = tab[7][a & 0xFF] ^ tab[6][(a >> 8) & 0xFF] ^ tab[5][(a >> 16) & 0xFF] ^ tab[4][(a >> 24) & 0xFF] ^
+			tab[3][(a >> 32) & 0xFF] ^ tab[2][(a >> 40) & 0xFF] ^ tab[1][(a >> 48) & 0xFF] ^ tab[0][a >> 56];
+	}
+	while (n--)
+		c = tab[0][(uint8_t)c ^ *p++] ^ (c >> 8);
+	return c ^ ~UINT64_C(0);
+}
+
+
+exported uint64_t callconv crc_64_s16(uint64_t c, register const uint8_t *restrict p, uint64_t n, void* t)
+{
+	register const uint64_t (*tab)[256] = t;
+	register uint64_t a, b;
+	for (; n >= 16; n -= 16, p += 16)
+	{
+		a = ((const uint64_t*)p)[0] ^ c;
+		b = ((const uint64_t*)p)[1];
+		c = tab[15][a & 0xFF] ^ tab[14][(a >> 8) & 0xFF] ^ tab[13][(a >> 16) & 0xFF] ^ tab[12][(a >> 24) & 0xFF] ^
+			tab[11][(a >> 32) & 0xFF] ^ tab[10][(a >> 40) & 0xFF] ^ tab[9][(a >> 48) & 0xFF] ^ tab[8][a >> 56] ^
+			tab[7][b & 0xFF] ^ tab[6][(b >> 8) & 0xFF] ^ tab[5][(b >> 16) & 0xFF] ^ tab[4][(b >> 24) & 0xFF] ^
+			tab[3][(b >> 32) & 0xFF] ^ tab[2][(b >> 40) & 0xFF] ^ tab[1][(b >> 48) & 0xFF] ^ tab[0][b >> 56];
+	}
+	while (n--)
+		c = tab[0][(uint8_t)c ^ *p++] ^ (c >> 8);
+	return c ^ ~UINT64_C(0);
+}
@@ -300,12 +300,13 @@ int main(int argc, char* argv[])
 			continue;
 		}
 
-		char line_buffer[0x4000] = { 0 }, *line;
+		static char line_buffer[0x40000]; // Fits a 32 KB data entity, at four characters a byte.
+		char* line;
 		char comment[1024] = { 0 };
 
 		int kind = 0;
 
-		while (fgets(line_buffer, 0x4000, input))
+		while (fgets(line_buffer, sizeof(line_buffer), input))
 		{
 			line = trim(line_buffer);
 
@@ -339,11 +340,11 @@ int main(int argc, char* argv[])
 				strcpy(entity_name, tok);
 
 				uint32_t entity_code_len = 0;
-				uint8_t entity_bytes[0x4000];
+				static uint8_t entity_bytes[0x10000];
 
 				if (kind < KIND_SIZE)
 				{
-					while ((tok = strtok(NULL, " \t:,=;")) != NULL)
+					while ((tok = strtok(NULL, " \t:,=;")) != NULL && entity_code_len < sizeof(entity_bytes))
 					{
 						char* eptr = NULL;
 						entity_bytes[entity_code_len] = (uint8_t)strtoul(tok, &eptr, 16);
@@ -489,37 +490,51 @@ int main(int argc, char* argv[])
 }
 
 
-void output_crc_tabs()
+// Writes a LUT as a data entity line.
+void output_crc_tab(const char* comment, const char* name, const void* tab, uint64_t ent_code_len)
 {
-	uint64_t ent_code_len = sizeof(crc_64_tab);
-	uint8_t* ent_bytes = (void*)crc_64_tab;
-
+	const uint8_t* ent_bytes = tab;
 	uint64_t j;
 
-	fprintf(stdout, "# CRC 64-Bit LUT.\n");
-	fprintf(stdout, "DA: crc_64_tab = ");
+	fprintf(stdout, "# %s\n", comment);
+	fprintf(stdout, "DA: %s = ", name);
 
 	for (j = 0; j < ent_code_len; ++j)
 	{
 		fprintf(stdout, "%02X", ent_bytes[j]);
-		if (j < (ent_code_len - 1)) fprintf(stdout, " ");
+		if (j < (ent_code_len - 1)) fprintf(stdout, ", ");
 	}
 
 	fprintf(stdout, ";\n\n");
+}
 
-	ent_code_len = sizeof(crc_32_tab);
-	ent_bytes = (void*)crc_32_tab;
 
-	fprintf(stdout, "# CRC 32-Bit LUT.\n");
-	fprintf(stdout, "DA: crc_32_tab = ");
+void output_crc_tabs()
+{
+	static uint64_t slice_64[16][256];
+	static uint32_t slice_32[16][256];
+	uint32_t i, k;
 
-	for (j = 0; j < ent_code_len; ++j)
+	// Row 0 is the byte-wise LUT, and row k runs each entry of row k - 1 through one more zero byte.
+	for (i = 0; i < 256; ++i)
 	{
-		fprintf(stdout, "%02X", ent_bytes[j]);
-		if (j < (ent_code_len - 1)) fprintf(stdout, " ");
+		slice_64[0][i] = crc_64_tab[i];
+		slice_32[0][i] = crc_32_tab[i];
 	}
 
-	fprintf(stdout, ";\n\n");
+	for (k = 1; k < 16; ++k)
+	{
+		for (i = 0; i < 256; ++i)
+		{
+			slice_64[k][i] = (slice_64[k - 1][i] >> 8) ^ crc_64_tab[slice_64[k - 1][i] & 0xFF];
+			slice_32[k][i] = (slice_32[k - 1][i] >> 8) ^ crc_32_tab[slice_32[k - 1][i] & 0xFF];
+		}
+	}
+
+	output_crc_tab("CRC 64-Bit LUT.", "crc_64_tab", crc_64_tab, sizeof(crc_64_tab));
+	output_crc_tab("CRC 32-Bit LUT.", "crc_32_tab", crc_32_tab, sizeof(crc_32_tab));
+	output_crc_tab("CRC 64-Bit slice LUT, 16 rows of 256.", "crc_64_slice", slice_64, sizeof(slice_64));
+	output_crc_tab("CRC 32-Bit slice LUT, 16 rows of 256.", "crc_32_slice", slice_32, sizeof(slice_32));
 }
 
 
@@ -1,10 +1,12 @@
-; rdr.asm - RDRAND Support
+; rdr.asm - RDRAND and RDSEED Support
 
 
 _TEXT SEGMENT
 
 	PUBLIC sm_have_rdrand
     PUBLIC sm_rdrand
+    PUBLIC sm_have_rdseed
+    PUBLIC sm_rdseed
 
 
 ; Tests for the presence of the RDRAND instruction.
@@ -15,8 +17,8 @@ sm_have_rdrand PROC
     cpuid
     bt      ecx, 30
     jnc     FAIL
-DONE:
     mov     rax, 1
+DONE:
     pop     rbx
     ret
 FAIL:
@@ -35,6 +37,36 @@ REDO:
     ret
 sm_rdrand ENDP
 
+
+; Tests for the presence of the RDSEED instruction.
+; uint64_t sm_have_rdseed(void)
+sm_have_rdseed PROC
+    push    rbx
+    mov     eax, 7
+    xor     ecx, ecx
+    cpuid
+    bt      ebx, 18
+    jnc     FAIL
+    mov     rax, 1
+DONE:
+    pop     rbx
+    ret
+FAIL:
+    sub     rax, rax
+    jmp     short DONE
+sm_have_rdseed ENDP
+
+
+; Calls the RDSEED instruction, and returns the resultant 64-bit value.
+; uint64_t sm_rdseed()
+sm_rdseed PROC
+REDO:
+    rdseed  rax
+    ; db    048h, 0Fh, 0C7h, 0F8h
+    jnc     REDO
+    ret
+sm_rdseed ENDP
+
 _TEXT ENDS
 
 END
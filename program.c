@@ -10,6 +10,7 @@
 #include "allocator.h"
 #include "sm.h"
 #include "bits.h"
+#include "benchmark.h"
 
 
 extern uint64_t callconv sm_xorshift_1024_64_rand(void *restrict s);
@@ -36,6 +37,9 @@ char* ltostr(uint64_t x, char* s, size_t n)
 
 int main(int argc, char* argv[])
 {
+	if (argc > 1 && !strcmp(argv[1], "bench")) // program bench [threads]
+		return sm_benchmark_random(stdout, (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 10) : 0) ? 1 : 0;
+
 	void* tmp[8096] = { 0 };
 
 	sm_allocator_internal_t ctx = sm_create(8096);
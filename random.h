@@ -12,7 +12,7 @@
 #include <xmmintrin.h>
 #include <emmintrin.h>
 #include <smmintrin.h>
-#elif 
+#else
 #include <x86intrin.h>
 #include <cpuid.h>
 #endif
@@ -20,6 +20,7 @@
 
 #include "config.h"
 #include "memory.h"
+#include "entropy.h"
 
 #if defined(SM_OS_WINDOWS)
 #define WIN32_LEAN_AND_MEAN 1
@@ -315,108 +316,14 @@ inline static void sec_sha512_hash(const uint8_t* p, size_t n, uint8_t* o /*64*/
 }
 
 
-// Allocates and fills the new buffer with 64 bytes of entropy (SHA-512-hashed down from 4096 bytes).
+// Allocates and fills the new buffer with 64 bytes of entropy from the process-wide entropy pool.
 inline static uint8_t* sec_random_read_entropy()
 {
-	uint64_t* l;
-	uint8_t* e = (uint8_t*)malloc(4096);
-	uint64_t o;
-	uint8_t* r;
-	uint8_t* p;
-
-	if (!e) return 0;
-
-	p = e;
-
-#if defined(SM_OS_WINDOWS)
-
-	uint32_t i;
-	DWORD t = 0, narb = 0, red = 0;
-	FILESYSTEM_STATISTICS s;
-	HANDLE h = CreateFileW(L"\\\\.\\PhysicalDrive0", 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
-	
-	s.SizeOfCompleteStructure = sizeof(FILESYSTEM_STATISTICS);
-
-	if (h != INVALID_HANDLE_VALUE)
-	{
-		DeviceIoControl(h, FSCTL_FILESYSTEM_GET_STATISTICS, NULL, 0, &s, sizeof(FILESYSTEM_STATISTICS), &t, NULL);
-		sec_memcpy(p, &s.UserDiskWrites, sizeof(DWORD));
-
-		p += sizeof(DWORD);
-		red += sizeof(DWORD);
-
-		SetFilePointer(h, sec_reduce_32(sm_rdrand_retry_64(), 0x147AE14), NULL, FILE_BEGIN);
-		ReadFile(h, p, 1024 - red, &t, NULL);
-		
-		CloseHandle(h);
-
-		l = (uint64_t*)e;
-		for (i = 0; i < 512; ++i)
-			l[i] ^= sm_rdrand_retry_64();
-	}
-	else
-	{
-		l = (uint64_t*)e;
-		for (i = 0; i < 512; ++i)
-			l[i] = sm_rdrand_retry_64();
-	}
-
-#else
-
-	FILE* f;
-	bool h = false, d = false, u = false;
-
-	o = UINT64_C(0x80000000) ^ (((uint64_t)rand()) << 32 | (uint64_t)rand());
-	o >>= 16;
-	o = UINT64_C(0x80000000) - sec_reduce_32(o, UINT32_C(0x40000));
-
-	if ((f = fopen("/dev/urandom", "rb")) != 0)
-	{
-		setbuf(f, 0);
-		if (h) fread(e + UINT64_C(2048), 1, UINT64_C(2048), f);
-		else fread(e, 1, UINT64_C(4096), f);
-		fclose(f);
-		d = true;
-	}
-
-	if ((f = fopen("/dev/random", "rb")) != 0)
-	{
-		setbuf(f, 0);
-		if (!h && !d) fread(e, 1, UINT64_C(4096), f);
-		else if (d || h) fread(e + UINT64_C(2048), 1, UINT64_C(2048), f);
-		fclose(f);
-		u = true;
-	}
-
-	if ((f = fopen("/dev/hda", "rb")) != 0)
-	{
-		setbuf(f, 0);
-		fseek(f, 0, SEEK_SET);
-		fread(e, o, UINT64_C(2048), f);
-		fclose(f);
-		h = true;
-	}
-
-	if (!h && !d && !u)
-	{
-		l = (uint64_t*)e;
-		for (i = 0; i < 512; ++i)
-			l[i] = sm_rdrand_retry_64();
-	}
-
-#endif
-
-	r = (uint8_t*)malloc(64);
-
-	if (!r)
-	{
-		free(e);
-		return 0;
-	}
+	uint8_t* r = (uint8_t*)malloc(64);
 
-	sec_sha512_hash(e, UINT64_C(4096), r);
+	if (!r) return 0;
 
-	free(e);
+	(void)sm_entropy_read(r, 64);
 
 	return r;
 }
@@ -437,7 +344,7 @@ inline static uint8_t* sec_random_generate_seed(void)
 #elif defined(SM_OS_LINUX)
 	struct timeval tv;
 	gettimeofday(&tv, 0);
-	s ^= (((uint64_t)tv.tv_sec << 32) ^ ((uint64_t)tv.tv_usec);
+	s ^= (((uint64_t)tv.tv_sec << 32) ^ (uint64_t)tv.tv_usec);
 #endif
 
 	if (sm_have_rdrand())
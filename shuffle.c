@@ -0,0 +1,307 @@
+// shuffle.c - Batched bounded random integers and parallel shuffling.
+
+
+#include <string.h>
+
+
+#if defined(SM_OS_WINDOWS)
+#include <intrin.h>
+#else
+#include <xmmintrin.h>
+#endif
+
+
+#include "config.h"
+#include "sm.h"
+#include "sm_internal.h"
+#include "bits.h"
+#include "thread.h"
+#include "vector_rand.h"
+#include "shuffle.h"
+
+
+// Swap targets are prefetched this many swaps ahead, so that shuffles of arrays beyond the cache overlap their misses.
+#define SM_SHUFFLE_PREFETCH 16U
+
+
+// A random source owned by one shuffle task.
+typedef struct sm_shuffle_source_s
+{
+	sm_vector_rand_t engine; // The task's engine.
+	uint32_t index; // The index of the next unused value.
+	uint64_t values[SM_SHUFFLE_BATCH]; // Buffered engine output.
+}
+sm_shuffle_source_t;
+
+
+// Shared state of a parallel shuffle.
+typedef struct sm_shuffle_run_s
+{
+	uint8_t* a; // The array.
+	uint64_t count; // The count of elements.
+	size_t size; // The size of an element.
+	uint32_t blocks; // The count of blocks, a power of two.
+	uint32_t width; // The count of blocks in each half of the current merge pass.
+	sm_shuffle_source_t* sources; // One source per block.
+}
+sm_shuffle_run_t;
+
+
+// Gets the index of the first element of block B of run R.
+#define sm_shuffle_start(R, B) (((R)->count * (uint64_t)(B)) / (R)->blocks)
+
+
+// Gets the next buffered value of the given source.
+inline static uint64_t sm_shuffle_next(sm_shuffle_source_t* source)
+{
+	if (source->index == SM_SHUFFLE_BATCH)
+	{
+		sm_vector_rand_block(&source->engine, source->values, SM_SHUFFLE_BATCH);
+		source->index = 0;
+	}
+
+	return source->values[source->index++];
+}
+
+
+// Reduces the random value r to [0 .. b) by Lemire's method, redrawing from the given source in the rare case that the
+// value falls in the biased range.
+inline static uint64_t sm_shuffle_bounded(sm_shuffle_source_t* source, register uint64_t b, register uint64_t r)
+{
+	uint64_t h;
+	register uint64_t l = sm_multiply_128(r, b, &h);
+
+	if (l < b)
+	{
+		register const uint64_t t = (0 - b) % b;
+
+		while (l < t)
+			l = sm_multiply_128(sm_shuffle_next(source), b, &h);
+	}
+
+	return h;
+}
+
+
+// Swaps the elements of the given size at p and q.
+inline static void sm_shuffle_swap(uint8_t* p, uint8_t* q, size_t size)
+{
+	if (p == q) return;
+
+	switch (size)
+	{
+	case sizeof(uint64_t):
+	{
+		uint64_t t;
+		memcpy(&t, p, sizeof(t));
+		memcpy(p, q, sizeof(t));
+		memcpy(q, &t, sizeof(t));
+		break;
+	}
+
+	case sizeof(uint32_t):
+	{
+		uint32_t t;
+		memcpy(&t, p, sizeof(t));
+		memcpy(p, q, sizeof(t));
+		memcpy(q, &t, sizeof(t));
+		break;
+	}
+
+	default:
+	{
+		register uint8_t t;
+		register size_t i;
+
+		for (i = 0; i < size; ++i)
+			t = p[i], p[i] = q[i], q[i] = t;
+		break;
+	}
+	}
+}
+
+
+// Fisher-Yates shuffles n elements at a. Swap indices are drawn a batch at a time, so that the swap targets of each
+// batch are known, and prefetched, ahead of the swaps.
+static void sm_shuffle_block(sm_shuffle_source_t* source, uint8_t* a, uint64_t n, size_t size)
+{
+	uint64_t j[SM_SHUFFLE_BATCH];
+	register uint64_t i, k, q;
+
+	for (i = n; i > 1; i -= k)
+	{
+		k = sm_min(i - 1, (uint64_t)SM_SHUFFLE_BATCH); // Elements i - 1 down to i - k swap with [0 .. i - q).
+
+		sm_vector_rand_block(&source->engine, j, (size_t)k);
+
+		for (q = 0; q < k; ++q)
+			j[q] = sm_shuffle_bounded(source, i - q, j[q]);
+
+		for (q = 0; q < k; ++q)
+		{
+			if (q + SM_SHUFFLE_PREFETCH < k)
+				_mm_prefetch((const char*)(a + (j[q + SM_SHUFFLE_PREFETCH] * size)), _MM_HINT_T0);
+
+			sm_shuffle_swap(a + ((i - 1 - q) * size), a + (j[q] * size), size);
+		}
+	}
+}
+
+
+// Merges the uniformly shuffled runs [0 .. m) and [m .. n) at t into one uniformly shuffled run. Elements are taken from
+// either run by coin flips until one is exhausted, and the rest are inserted at random positions.
+static void sm_shuffle_merge(sm_shuffle_source_t* source, uint8_t* t, uint64_t m, uint64_t n, size_t size)
+{
+	register uint64_t u = 0, v = m, bits = 0;
+	register uint32_t left = 0;
+
+	for (;;)
+	{
+		if (!left) bits = sm_shuffle_next(source), left = 64;
+
+		register const uint64_t bit = bits & 1;
+		bits >>= 1, --left;
+
+		if (bit)
+		{
+			if (v == n) break;
+			sm_shuffle_swap(t + (u * size), t + (v * size), size);
+			++v;
+		}
+		else if (u == v) break;
+
+		++u;
+	}
+
+	for (; u < n; ++u)
+		sm_shuffle_swap(t + (sm_shuffle_bounded(source, u + 1, sm_shuffle_next(source)) * size), t + (u * size), size);
+}
+
+
+// Shuffles block b of a parallel shuffle.
+static void sm_shuffle_task_block(void* p, size_t b)
+{
+	sm_shuffle_run_t* run = (sm_shuffle_run_t*)p;
+	register const uint64_t start = sm_shuffle_start(run, b), end = sm_shuffle_start(run, b + 1);
+
+	sm_shuffle_block(&run->sources[b], run->a + (start * run->size), end - start, run->size);
+}
+
+
+// Merges pair g of the current merge pass of a parallel shuffle.
+static void sm_shuffle_task_merge(void* p, size_t g)
+{
+	sm_shuffle_run_t* run = (sm_shuffle_run_t*)p;
+	register const uint32_t b = (uint32_t)g * run->width * 2;
+	register const uint64_t start = sm_shuffle_start(run, b), middle = sm_shuffle_start(run, b + run->width), end = sm_shuffle_start(run, b + (run->width * 2));
+
+	sm_shuffle_merge(&run->sources[b], run->a + (start * run->size), middle - start, end - start, run->size);
+}
+
+
+// Seeds the given source from the context master.
+inline static void sm_shuffle_seed(sm_t sm, sm_shuffle_source_t* source)
+{
+	uint64_t seed[2];
+
+	sm_random_fill(sm, seed, sizeof(seed));
+	sm_vector_rand_seed(&source->engine, seed);
+
+	seed[0] = seed[1] = 0;
+	source->index = SM_SHUFFLE_BATCH;
+}
+
+
+// Fills out with count values uniformly distributed in [0 .. bound).
+exported void callconv sm_random_bounded(sm_vector_rand_t* engine, uint32_t bound, uint32_t* out, size_t count)
+{
+	if (!engine || !out || !count) return;
+
+	if (!bound)
+	{
+		memset(out, 0, count * sizeof(uint32_t));
+		return;
+	}
+
+	uint64_t r[SM_SHUFFLE_BATCH];
+	register const uint32_t* v = (const uint32_t*)r;
+	register uint32_t t = 0, rejects = 0;
+	register size_t q, k;
+	uint64_t x;
+
+	for (; count > 0; count -= k, out += k)
+	{
+		k = sm_min(count, (size_t)SM_SHUFFLE_BATCH * 2); // Two 32-bit values per 64-bit value.
+
+		sm_vector_rand_block(engine, r, (k + 1) / 2);
+
+		for (q = 0; q < k; ++q) // Independent multiplies, left for the compiler to vectorize.
+			out[q] = (uint32_t)(((uint64_t)v[q] * bound) >> 32);
+
+		for (q = 0; q < k; ++q)
+		{
+			register uint32_t l = v[q] * bound;
+
+			if (l >= bound) continue; // Cannot be biased.
+
+			if (!rejects) t = (0 - bound) % bound, rejects = 1; // Threshold, once per call.
+
+			while (l < t)
+			{
+				sm_vector_rand_block(engine, &x, 1);
+				l = (uint32_t)x * bound;
+				out[q] = (uint32_t)(((uint64_t)(uint32_t)x * bound) >> 32);
+			}
+		}
+	}
+
+	memset(r, 0, sizeof(r));
+}
+
+
+// Uniformly shuffles count elements of the given size at a.
+exported uint8_t callconv sm_random_shuffle(sm_t sm, void* a, size_t count, size_t size, uint32_t threads)
+{
+	sm_context_t* context = (sm_context_t*)sm;
+
+	if (!context || !a || !size) return 0;
+	if (count < 2) return 1;
+
+	if (!threads) threads = sm_thread_processors();
+
+	register uint32_t b, blocks = 1;
+
+	if (count >= SM_SHUFFLE_PARALLEL_MINIMUM)
+		while (blocks < threads && blocks * 2 <= SM_THREAD_PARALLEL_MAXIMUM && count / (blocks * 2) >= SM_SHUFFLE_BLOCK_MINIMUM)
+			blocks *= 2;
+
+	if (blocks == 1) // Shuffle on the calling thread.
+	{
+		sm_shuffle_source_t source;
+
+		sm_shuffle_seed(sm, &source);
+		sm_shuffle_block(&source, (uint8_t*)a, count, size);
+		sm_random_fill(sm, &source, sizeof(source));
+
+		return 1;
+	}
+
+	sm_shuffle_run_t run = { (uint8_t*)a, count, size, blocks, 0, NULL };
+
+	run.sources = (sm_shuffle_source_t*)context->memory.allocate(context->memory.allocator, sizeof(sm_shuffle_source_t) * blocks);
+
+	if (!run.sources) return 0;
+
+	for (b = 0; b < blocks; ++b)
+		sm_shuffle_seed(sm, &run.sources[b]);
+
+	sm_thread_parallel(sm_shuffle_task_block, &run, blocks, threads);
+
+	for (run.width = 1; run.width < blocks; run.width *= 2) // Merge pairs of runs until one is left.
+		sm_thread_parallel(sm_shuffle_task_merge, &run, blocks / (run.width * 2), threads);
+
+	sm_random_fill(sm, run.sources, sizeof(sm_shuffle_source_t) * blocks);
+	context->memory.release(context->memory.allocator, run.sources);
+
+	return 1;
+}
@@ -0,0 +1,33 @@
+// shuffle.h - Batched bounded random integers and parallel shuffling.
+
+
+#include "config.h"
+#include "sm.h"
+#include "vector_rand.h"
+
+
+#ifndef INCLUDE_SHUFFLE_H
+#define INCLUDE_SHUFFLE_H 1
+
+
+// The count of random values drawn from an engine at once.
+#define SM_SHUFFLE_BATCH 0x100U
+
+// Arrays with fewer elements than this are always shuffled on the calling thread.
+#define SM_SHUFFLE_PARALLEL_MINIMUM 0x40000U
+
+// The least count of elements each thread shuffles before the merge passes.
+#define SM_SHUFFLE_BLOCK_MINIMUM 0x10000U
+
+
+// Fills out with count values uniformly distributed in [0 .. bound), without bias, from the given engine. The rejection
+// threshold is computed at most once per call rather than once per value. A bound of zero yields zeros.
+exported void callconv sm_random_bounded(sm_vector_rand_t* engine, uint32_t bound, uint32_t* out, size_t count);
+
+// Uniformly shuffles count elements of the given size at a, with randomness from the context master. Large arrays are
+// split into blocks shuffled in parallel, which are then merged pairwise, each merge also in parallel (MergeShuffle). Zero
+// threads uses one per processor. Returns 1 on success, or 0 if the per-thread state could not be allocated.
+exported uint8_t callconv sm_random_shuffle(sm_t sm, void* a, size_t count, size_t size, uint32_t threads);
+
+
+#endif // INCLUDE_SHUFFLE_H
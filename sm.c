@@ -11,11 +11,13 @@
 #include "embedded.h"
 #include "allocator.h"
 #include "mutex.h"
+#include "thread.h"
 #include "sm.h"
 #include "sm_internal.h"
 #include "compatibility/gettimeofday.h"
 #include "compatibility/getuid.h"
 #include "bits.h"
+#include "checksum.h"
 
 
 #if defined(SM_OS_LINUX)
@@ -89,16 +91,11 @@ inline static void* sm_memcpy(void *restrict p, const void *restrict q, size_t n
 
 extern sm_allocator_internal_t callconv sm_allocator_create_context(size_t capacity, uint8_t locked);
 extern uint64_t callconv sm_random(sm_t sm);
+extern void callconv sm_random_fill(sm_t sm, void* p, size_t n);
+extern void callconv sm_random_release(sm_t sm);
 extern void* callconv sm_xor_cross(void *restrict dst, void *restrict src, register size_t bytes, uint64_t key1, uint64_t key2);
 
 
-inline static void sm_mem_rand(sm_context_t* context, register uint8_t* p, register size_t n)
-{
-	if (context) while (n-- > 0U) *p++ = (uint8_t)context->random.method(context);
-	else while (n-- > 0U) *p++ = (uint8_t)sm_random(NULL);
-}
-
-
 inline static uint8_t sm_register_integral_rand(sm_context_t* context, uint8_t* seed_ptr, uint64_t seed_size, uint64_t* seed_key, uint8_t* next_ptr, uint64_t next_size, uint64_t* next_key, uint64_t state_size)
 {
 	if (!context || !seed_ptr || !seed_key || !next_key || !next_key || context->random.integral.count == 0xFF) 
@@ -111,7 +108,7 @@ inline static uint8_t sm_register_integral_rand(sm_context_t* context, uint8_t*
 	*seed_key = seed_key2;
 	if (!sm_make_executable(context, seed_mem, seed_size))
 	{
-		sm_mem_rand(context, seed_mem, seed_size);
+		sm_random_fill(context, seed_mem, seed_size);
 		context->memory.release(context->memory.allocator, seed_mem);
 		return 0;
 	}
@@ -127,9 +124,9 @@ inline static uint8_t sm_register_integral_rand(sm_context_t* context, uint8_t*
 	*next_key = next_key2;
 	if (!sm_make_executable(context, next_mem, next_size))
 	{
-		sm_mem_rand(context, next_mem, next_size);
+		sm_random_fill(context, next_mem, next_size);
 		context->memory.release(context->memory.allocator, next_mem);
-		sm_mem_rand(context, seed_mem, seed_size);
+		sm_random_fill(context, seed_mem, seed_size);
 		context->memory.release(context->memory.allocator, seed_mem);
 		return 0;
 	}
@@ -157,13 +154,13 @@ static void sm_free_integral_rands(sm_context_t* context)
 	{
 		tmp = context->random.integral.table[i].seed_function;
 		context->random.integral.table[i].seed_function = (sm_srs64_f)context->random.method(context);
-		sm_mem_rand(context, tmp, context->random.integral.table[i].seed_size);
+		sm_random_fill(context, tmp, context->random.integral.table[i].seed_size);
 		context->random.integral.table[i].seed_size = context->random.method(context);
 		context->memory.release(context->memory.allocator, tmp);
 
 		tmp = context->random.integral.table[i].next_function;
 		context->random.integral.table[i].next_function = (sm_ran64_f)context->random.method(context);
-		sm_mem_rand(context, tmp, context->random.integral.table[i].next_size);
+		sm_random_fill(context, tmp, context->random.integral.table[i].next_size);
 		context->random.integral.table[i].next_size = context->random.method(context);
 		context->memory.release(context->memory.allocator, tmp);
 
@@ -193,7 +190,7 @@ static void* sm_load_entity(sm_context_t* context, uint8_t executable, void *res
 
 		if (c != *crc)
 		{
-			sm_mem_rand(context, r, bytes);
+			sm_random_fill(context, r, bytes);
 			context->memory.release(context->memory.allocator, r);
 
 			if (context->error)
@@ -210,7 +207,7 @@ static void* sm_load_entity(sm_context_t* context, uint8_t executable, void *res
 
 	if (executable && !sm_make_executable(context, r, bytes))
 	{
-		sm_mem_rand(context, r, bytes);
+		sm_random_fill(context, r, bytes);
 		context->memory.release(context->memory.allocator, r);
 
 		if (context->error)
@@ -223,6 +220,15 @@ static void* sm_load_entity(sm_context_t* context, uint8_t executable, void *res
 }
 
 
+static void sm_free_entity(sm_context_t* context, void** bytes, size_t size)
+{
+	void* tmp = *bytes;
+	*bytes = NULL;
+	sm_random_fill(context, tmp, size);
+	context->memory.release(context->memory.allocator, tmp);
+}
+
+
 #ifdef _DEBUG
 static void sm_default_error_handler(sm_t sm, sm_error_t error)
 {
@@ -258,9 +264,9 @@ exported sm_t callconv sm_create(uint64_t bytes)
 		return NULL;
 	}
 
-	context->random.method = sm_random;
+	sm_random_fill(NULL, (uint8_t*)context, sizeof(sm_context_t));
 
-	sm_mem_rand(NULL, (uint8_t*)context, sizeof(sm_context_t));
+	context->random.method = sm_random;
 
 	context->size = sizeof(sm_context_t);
 	context->initialized = 1;
@@ -281,16 +287,16 @@ exported sm_t callconv sm_create(uint64_t bytes)
 	context->synchronization.enter = sm_mutex_lock;
 	context->synchronization.leave = sm_mutex_unlock;
 
-	if (!context->synchronization.create(&context->synchronization.lock))
+	if (!context->synchronization.create(&context->mutex))
 	{
-		sm_mem_rand(NULL, (uint8_t*)context, sizeof(sm_context_t));
+		sm_random_fill(NULL, (uint8_t*)context, sizeof(sm_context_t));
 		context->initialized = 0;
 		sm_space_free(allocator, context);
 		sm_allocator_destroy_context(allocator);
 		return NULL;
 	}
 
-	context->synchronization.enter(&context->synchronization.lock);
+	context->synchronization.enter(&context->mutex);
 
 #ifdef _DEBUG
 	context->error = sm_default_error_handler;
@@ -301,21 +307,69 @@ exported sm_t callconv sm_create(uint64_t bytes)
 	context->memory.allocator = allocator;
 
 #if !defined(DEBUG) && !defined(_DEBUG)
-	context->checking.tab_64 = sm_load_entity(context, 0, crc_64_tab_data, crc_64_tab_size, &crc_64_tab_key, &crc_64_tab_crc);
-	context->checking.crc_64 = sm_load_entity(context, 1, crc_64_data, crc_64_size, &crc_64_key, &crc_64_crc);
+	// The slice-by-16 kernels, bit-exact with crc_64 and crc_32, so entity CRCs made by mkc still validate.
+	context->checking.tab_64 = sm_load_entity(context, 0, crc_64_slice_data, crc_64_slice_size, &crc_64_slice_key, &crc_64_slice_crc);
+	context->checking.crc_64 = sm_load_entity(context, 1, crc_64_s16_data, crc_64_s16_size, &crc_64_s16_key, &crc_64_s16_crc);
 
-	context->checking.tab_32 = sm_load_entity(context, 0, crc_32_tab_data, crc_32_tab_size, &crc_32_tab_key, &crc_32_tab_crc);
-	context->checking.crc_32 = sm_load_entity(context, 1, crc_32_data, crc_32_size, &crc_32_key, &crc_32_crc);
+	context->checking.tab_32 = sm_load_entity(context, 0, crc_32_slice_data, crc_32_slice_size, &crc_32_slice_key, &crc_32_slice_crc);
+	context->checking.crc_32 = sm_load_entity(context, 1, crc_32_s16_data, crc_32_s16_size, &crc_32_s16_key, &crc_32_s16_crc);
+
+	if (sm_crc_fold_supported()) // Folding kernels, which use the slice tables for short inputs.
+	{
+		if (context->checking.tab_64 && context->checking.crc_64)
+		{
+			sm_free_entity(context, (void**)&context->checking.crc_64, crc_64_s16_size);
+			context->checking.crc_64 = sm_crc_64_fold;
+		}
+
+		if (context->checking.tab_32 && context->checking.crc_32)
+		{
+			sm_free_entity(context, (void**)&context->checking.crc_32, crc_32_s16_size);
+			context->checking.crc_32 = sm_crc_32_fold;
+		}
+	}
 
 	context->random.rdrand.exists = sm_load_entity(context, 1, have_rdrand_data, have_rdrand_size, &have_rdrand_key, &have_rdrand_crc);
 	context->random.rdrand.next = sm_load_entity(context, 1, next_rdrand_data, next_rdrand_size, &next_rdrand_key, &next_rdrand_crc);
+
+	context->random.rdseed.exists = sm_load_entity(context, 1, have_rdseed_data, have_rdseed_size, &have_rdseed_key, &have_rdseed_crc);
+	context->random.rdseed.next = sm_load_entity(context, 1, next_rdseed_data, next_rdseed_size, &next_rdseed_key, &next_rdseed_crc);
+#else
+	context->checking.tab_64 = context->checking.tab_32 = NULL;
+	context->checking.crc_64 = NULL;
+	context->checking.crc_32 = NULL;
+
+	context->random.rdrand.exists = context->random.rdrand.next = NULL;
+	context->random.rdseed.exists = context->random.rdseed.next = NULL;
 #endif
 
+	context->checking.integrity = SM_INTEGRITY_CRC32C;
+
 	context->random.initialized = 0;
+	context->random.process = 0;
+	context->random.streams.epoch = 0;
+	context->random.streams.jumps = 0;
 
 	context->synchronization.create(&context->random.lock);
 
+	context->random.reseed.outputs = SM_RANDOM_RESEED_OUTPUTS;
+	context->random.reseed.ticks = SM_RANDOM_RESEED_TICKS;
+	context->random.reseed.background = 1;
+	context->random.reseed.served = 0;
+	context->random.reseed.last = 0;
+	context->random.reseed.generations = 0;
+	context->random.reseed.mix = 0;
+	context->random.reseed.requested = 0;
+	context->random.reseed.ready = 0;
+	context->random.reseed.running = 0;
+	context->random.reseed.stop = 0;
+
+	sm_condition_create(&context->random.reseed.wake);
+
 	context->random.rdrand.available = 0xFF;
+	context->random.rdseed.available = 0xFF;
+	context->random.ring.source = NULL;
+	context->random.ring.refills = 0;
 
 	context->random.entropy.get_time = time;
 	context->random.entropy.get_time_of_day = gettimeofday;
@@ -333,31 +387,24 @@ exported sm_t callconv sm_create(uint64_t bytes)
 	//sm_register_integral_rand(context, );
 
 	if (context->checking.crc_64)
-		context->crc = context->checking.crc_64(context->size, (uint8_t*)context, context->size, context->checking.tab_64);
+		sm_context_seal(context);
 	else context->crc = UINT64_MAX;
 
-	context->synchronization.leave(&context->synchronization.lock);
+	context->synchronization.leave(&context->mutex);
 
 	return (sm_t)context;
 }
 
 
-static void sm_free_entity(sm_context_t* context, void** bytes, size_t size)
-{
-	void* tmp = *bytes;
-	*bytes = NULL;
-	sm_mem_rand(context, tmp, size);
-	context->memory.release(context->memory.allocator, tmp);
-}
-
-
 exported void callconv sm_destroy(sm_t sm)
 {
 	sm_context_t* context = (sm_context_t*)sm;
 
 	if (!context) return;
 
-	context->synchronization.enter(&context->synchronization.lock);
+	context->synchronization.enter(&context->mutex);
+
+	sm_random_release(context);
 
 	if (context->random.initialized)
 	{
@@ -371,12 +418,14 @@ exported void callconv sm_destroy(sm_t sm)
 	sm_free_integral_rands(context);
 
 #if !defined(DEBUG) && !defined(_DEBUG)
-	sm_free_entity(context, (void**)&context->checking.tab_32, crc_32_tab_size);
-	sm_free_entity(context, (void**)&context->checking.crc_32, crc_32_size);
-	sm_free_entity(context, (void**)&context->checking.tab_64, crc_64_tab_size);
-	sm_free_entity(context, (void**)&context->checking.crc_64, crc_64_size);
+	sm_free_entity(context, (void**)&context->checking.tab_32, crc_32_slice_size);
+	if (context->checking.crc_32 != sm_crc_32_fold) sm_free_entity(context, (void**)&context->checking.crc_32, crc_32_s16_size);
+	sm_free_entity(context, (void**)&context->checking.tab_64, crc_64_slice_size);
+	if (context->checking.crc_64 != sm_crc_64_fold) sm_free_entity(context, (void**)&context->checking.crc_64, crc_64_s16_size);
 	sm_free_entity(context, (void**)&context->random.rdrand.exists, have_rdrand_size);
 	sm_free_entity(context, (void**)&context->random.rdrand.next, next_rdrand_size);
+	sm_free_entity(context, (void**)&context->random.rdseed.exists, have_rdseed_size);
+	sm_free_entity(context, (void**)&context->random.rdseed.next, next_rdseed_size);
 #endif
 
 	sm_allocator_internal_t allocator = context->memory.allocator;
@@ -384,10 +433,10 @@ exported void callconv sm_destroy(sm_t sm)
 	context->crc = 0;
 	context->initialized = 0;
 
-	context->synchronization.leave(&context->synchronization.lock);
-	context->synchronization.destroy(&context->synchronization.lock);
+	context->synchronization.leave(&context->mutex);
+	context->synchronization.destroy(&context->mutex);
 
-	sm_mem_rand(NULL, (uint8_t*)context, sizeof(sm_context_t));
+	sm_random_fill(NULL, (uint8_t*)context, sizeof(sm_context_t));
 
 	sm_space_free(allocator, context);
 	sm_allocator_destroy_context(allocator);
@@ -401,9 +450,9 @@ exported void callconv sm_set_error_handler(sm_t* sm, sm_err_f handler)
 {
 	if (!sm) return;
 	sm_context_t* context = (sm_context_t*)sm;
-	context->synchronization.enter(&context->synchronization.lock);
-	context->error = handler;
-	context->synchronization.leave(&context->synchronization.lock);
+	context->synchronization.enter(&context->mutex);
+	sm_context_assign(context, error, handler);
+	context->synchronization.leave(&context->mutex);
 }
 
 
@@ -68,10 +68,22 @@ typedef uint8_t (*sm_mutex_f)(sm_mutex_t*);
 
 
 // Master entropic/quasi-entropic random number generator. Uses RDRAND if 
-// present, else uses XorShift1024* 64-bit with random intermittent 
-// re-seeding. If sm_t is null, uses default RNG support.
+// present, else uses XorShift1024* 64-bit re-seeded by the context's 
+// reseed policy. If sm_t is null, uses default RNG support.
 extern uint64_t sm_random(sm_t);
 
+// Fills the given count of bytes at the given address with random values from the master, taking any lock at most 
+// once. If sm_t is null, uses default RNG support.
+extern void callconv sm_random_fill(sm_t, void*, size_t);
+
+// Sets the RNG method used by the given context, such as sm_random_chacha (see chacha.h). Null restores the master.
+extern void callconv sm_random_set_method(sm_t, uint64_t (*)(sm_t));
+
+// Sets when the random master is reseeded: once its streams may have served the given count of values, or once the given
+// count of processor ticks has passed, whichever is first. Zero disables either limit. If background is set, new states are
+// built on a reseed thread and swapped in at the next stream derivation, so that no caller pays for the reseed itself.
+extern void callconv sm_random_set_reseed(sm_t, uint64_t outputs, uint64_t ticks, uint8_t background);
+
 // Creates a new context with the initial count of space in bytes.
 extern sm_t callconv sm_create(uint64_t bytes);
 
@@ -84,6 +96,10 @@ extern void callconv sm_set_error_handler(sm_t* sm, sm_err_f handler);
 // Get protected entity.
 extern sm_ref_t callconv sm_get_entity(sm_t* sm, uint16_t op);
 
+// Sets the integrity algorithm used for data entries of the given context that do not name one (see: SM_INTEGRITY_*),
+// which may have the SM_INTEGRITY_TREE flag.
+extern void callconv sm_set_integrity(sm_t, uint8_t algorithm);
+
 
 // Error Codes
 
@@ -97,6 +113,22 @@ extern sm_ref_t callconv sm_get_entity(sm_t* sm, uint16_t op);
 #define SM_ERR_CANNOT_MAKE_EXEC		(1 << 7) // Failed to make memory page executable.
 
 
+// Integrity Algorithms
+
+
+#define SM_INTEGRITY_NONE			(0x00) // No integrity value.
+#define SM_INTEGRITY_CRC32C			(0x01) // CRC32C, by the SSE 4.2 crc32 instruction where present. The default.
+#define SM_INTEGRITY_CRC64			(0x02) // CRC-64, by the context's CRC-64 kernel.
+#define SM_INTEGRITY_TREE			(0x80) // Flag: per-chunk values of the algorithm, in a Merkle tree.
+#define SM_INTEGRITY_DEFAULT		(0xFF) // The context's default algorithm.
+
+// Reseed Defaults
+
+
+#define SM_RANDOM_RESEED_OUTPUTS	UINT64_C(0x4000000) // Values served between reseeds.
+#define SM_RANDOM_RESEED_TICKS		UINT64_C(0x100000000) // Processor ticks between reseeds.
+
+
 // Built-In Opcodes
 
 
@@ -1,13 +1,16 @@
 // sm_internal.h
 
 
+#include <stddef.h>
 #include <time.h>
 
 #include "config.h"
 #include "sm.h"
 #include "allocator.h"
 #include "mutex.h"
+#include "thread.h"
 #include "hash_table.h"
+#include "checksum.h"
 
 
 #ifndef INCLUDE_SM_INTERNAL_H
@@ -27,17 +30,17 @@ talign(1)
 sm_rng_entry_t;
 
 
-// The global context structure.
+// The global context structure. Its configuration comes first, up to SM_CONTEXT_SEALED, and is what its CRC covers; the
+// state that changes with use, from the random master on, follows.
 typedef halign(1) struct sm_context_s
 {
 	size_t size; // Size of this.
 	uint8_t initialized; // Initialized flag.
-	uint64_t crc; // 64-bit CRC of this.
+	uint64_t crc; // 64-bit CRC of the configuration of this.
 
 	// Mutex support.
 	struct
 	{
-		sm_mutex_t lock; // Context/initialization mutex.
 		sm_mutex_f create; // Create mutex.
 		sm_mutex_f destroy; // Destroy mutex.
 		sm_mutex_f enter; // Enter mutex.
@@ -53,58 +56,16 @@ typedef halign(1) struct sm_context_s
 	int (*protect)(void*, size_t, int); // Used to make pages executable.
 #endif
 
-	// Random support.
-	struct
-	{
-		sm_mutex_t lock; // Mutex for the random master.
-		uint8_t initialized; // Initialization flag.
-		uint8_t state[(sizeof(uint32_t) + (sizeof(uint64_t) * 16))]; // The  XorShift1024* state, if needed.
-
-		// RDRAND support.
-		struct
-		{
-			uint8_t available; // RDRAND availability flag, 0xFF if not known yet, otherwise 0 or 1.
-			sm_get64_f exists; // Test for RDRAND function.
-			sm_get64_f next; // Get next RDRAND function.
-		}
-		rdrand;
-
-		// Integral RNGs.
-		struct
-		{
-			uint8_t count; // Count of RNG entries in tab.
-			sm_rng_entry_t table[0xFF]; // Registered RNG entries.
-		}
-		integral;
-
-		// Functions used for seeding entropy, if needed.
-		struct
-		{
-			time_t (*get_time)(void*);
-			int (*get_time_of_day)(void*, void*);
-			clock_t (*get_clock)();
-			pid_t (*get_process_id)();
-			pid_t (*get_thread_id)();
-			uid_t (*get_user_id)();
-			uint64_t (*get_user_name_hash)();
-#if defined(SM_OS_WINDOWS)
-			uint64_t (*get_ticks)();
-#endif
-		}
-		entropy;
-
-		uint64_t (*method)(sm_t); // The RNG method.
-	}
-	random;
-
 	// CRC support.
 	struct
 	{
-		void* tab_32; // The 32-bit CRC LUT.
+		void* tab_32; // The 32-bit CRC LUT, 16 slice rows.
 		sm_crc32_f crc_32; // The 32-bit CRC function.
 
-		void* tab_64; // The 64-bit CRC LUT.
+		void* tab_64; // The 64-bit CRC LUT, 16 slice rows.
 		sm_crc64_f crc_64; // The 64-bit CRC function.
+
+		uint8_t integrity; // The default integrity algorithm of data entries, SM_INTEGRITY_*.
 	}
 	checking;
 
@@ -127,6 +88,100 @@ typedef halign(1) struct sm_context_s
 		sm_hash_table_t* meta; // Meta store.
 	}
 	memory;
+
+	// Random support. The configuration comes first, up to the reseed counters.
+	struct
+	{
+		uint64_t (*method)(sm_t); // The RNG method.
+
+		// Functions used for seeding entropy, if needed.
+		struct
+		{
+			time_t (*get_time)(void*);
+			int (*get_time_of_day)(void*, void*);
+			clock_t (*get_clock)();
+			pid_t (*get_process_id)();
+			pid_t (*get_thread_id)();
+			uid_t (*get_user_id)();
+			uint64_t (*get_user_name_hash)();
+#if defined(SM_OS_WINDOWS)
+			uint64_t (*get_ticks)();
+#endif
+		}
+		entropy;
+
+		// Reseed scheduling support.
+		struct
+		{
+			uint64_t outputs; // The master is reseeded once its streams may have served this many values, or 0 for no limit.
+			uint64_t ticks; // The master is reseeded once this many processor ticks have passed, or 0 for no limit.
+			uint8_t background; // Whether reseed states are built on the reseed thread rather than inline.
+			uint64_t served; // Count of values the streams may have served since the last reseed.
+			uint64_t last; // Processor tick count at the last reseed.
+			uint64_t generations; // Count of reseeds installed.
+			uint64_t mix; // Master value handed to the reseed thread with a request.
+			uint8_t requested; // Whether the reseed thread has been asked for a new state.
+			uint8_t ready; // Whether pending holds a state built by the reseed thread.
+			uint8_t running; // Whether the reseed thread has been started.
+			uint8_t stop; // Whether the reseed thread has been asked to stop.
+			uint8_t pending[(sizeof(uint32_t) + (sizeof(uint64_t) * 16))]; // The state built by the reseed thread.
+			sm_condition_t wake; // Signals the reseed thread.
+			sm_thread_t thread; // The reseed thread.
+		}
+		reseed;
+
+		sm_mutex_t lock; // Mutex for the random master.
+		uint8_t initialized; // Initialization flag.
+		uint64_t process; // The fork generation the master was seeded in, see fork.h.
+		uint8_t state[(sizeof(uint32_t) + (sizeof(uint64_t) * 16))]; // The  XorShift1024* state, if needed.
+
+		// Per-thread stream support.
+		struct
+		{
+			uint64_t epoch; // Identifies this context's streams; a thread stream of another epoch is re-derived.
+			uint32_t jumps; // Count of streams taken from the base since it was last seeded from the master.
+			uint64_t base[2]; // The Xoroshiro128+ state the next thread stream is taken from.
+		}
+		streams;
+
+		// RDRAND support.
+		struct
+		{
+			uint8_t available; // RDRAND availability flag, 0xFF if not known yet, otherwise 0 or 1.
+			sm_get64_f exists; // Test for RDRAND function.
+			sm_get64_f next; // Get next RDRAND function.
+		}
+		rdrand;
+
+		// RDSEED support.
+		struct
+		{
+			uint8_t available; // RDSEED availability flag, 0xFF if not known yet, otherwise 0 or 1.
+			sm_get64_f exists; // Test for RDSEED function.
+			sm_get64_f next; // Get next RDSEED function.
+		}
+		rdseed;
+
+		// Hardware entropy ring support.
+		struct
+		{
+			sm_get64_f source; // The instruction entity refilling thread rings, RDRAND if available, else RDSEED, else null.
+			volatile uint64_t refills; // Count of ring refills, across all threads.
+		}
+		ring;
+
+		// Integral RNGs.
+		struct
+		{
+			uint8_t count; // Count of RNG entries in tab.
+			sm_rng_entry_t table[0xFF]; // Registered RNG entries.
+		}
+		integral;
+	}
+	random;
+
+	// Context/initialization mutex.
+	sm_mutex_t mutex;
 }
 talign(1)
 sm_context_t;
@@ -144,13 +199,29 @@ talign(1)
 sm_key_entry_t;
 
 
+// Chunk integrity tree of a data entry. Nodes are a complete binary tree in one array, with the root at 0, the children
+// of node i at 2i + 1 and 2i + 2, and the value of chunk j at leaves - 1 + j. Leaves past the last chunk are zero.
+typedef struct sm_integrity_tree_s
+{
+	uint8_t algorithm; // The algorithm of every node, SM_INTEGRITY_CRC32C or SM_INTEGRITY_CRC64.
+	size_t chunk; // The size of a chunk.
+	size_t chunks; // The count of chunks.
+	size_t leaves; // The count of leaves, a power of two.
+	uint64_t* nodes; // The 2 * leaves - 1 nodes, following this structure.
+}
+sm_integrity_tree_t;
+
+
 typedef halign(1) struct sm_data_entry_s
 {
 	size_t size; // Size of this.
 	uint8_t initialized; // Initialized flag.
 	uint64_t crc; // 64-bit CRC of this.
-	void* data;
-	uint32_t check; // 32-bit CRC of data ptr.
+	void* data; // The data.
+	size_t bytes; // Size of the data.
+	uint8_t integrity; // Integrity algorithm of check, SM_INTEGRITY_*.
+	uint64_t check; // Integrity value of the data, or root of its tree. A CRC32C is zero-extended.
+	sm_integrity_tree_t* tree; // Chunk integrity tree, with SM_INTEGRITY_TREE, or null.
 }
 talign(1)
 sm_data_entry_t;
@@ -169,5 +240,30 @@ talign(1)
 sm_meta_entry_t;
 
 
+// The sealed extents of the context and of a hash table: their configuration, ahead of the state that changes with use.
+#define SM_CONTEXT_SEALED offsetof(sm_context_t, random.reseed.served)
+#define SM_HASH_TABLE_SEALED offsetof(sm_hash_table_t, buckets)
+
+// Seals, verifies, or assigns field F of, the first N bytes of the context C, a hash table or an entry structure O, all
+// of which begin with size, initialized and crc. V must be an lvalue of the field's type. Fields past N are assigned
+// unchecked.
+#define sm_integrity_seal_extent(C, O, N) sm_crc_seal((sm_t)(C), (O), (N), &(O)->crc)
+#define sm_integrity_verify_extent(C, O, N) sm_crc_verify((sm_t)(C), (O), (N), &(O)->crc)
+#define sm_integrity_assign_extent(C, O, N, F, V) sm_crc_assign((sm_t)(C), (O), (N), &(O)->crc, &(O)->F, &(V), sizeof((O)->F))
+
+// As above, over the whole of an entry structure O, whose every field is sealed.
+#define sm_integrity_seal(C, O) sm_integrity_seal_extent(C, O, (O)->size)
+#define sm_integrity_verify(C, O) sm_integrity_verify_extent(C, O, (O)->size)
+#define sm_integrity_assign(C, O, F, V) sm_integrity_assign_extent(C, O, (O)->size, F, V)
+
+// As above, over the configuration of the context C, or of a hash table O.
+#define sm_context_seal(C) sm_integrity_seal_extent(C, C, SM_CONTEXT_SEALED)
+#define sm_context_verify(C) sm_integrity_verify_extent(C, C, SM_CONTEXT_SEALED)
+#define sm_context_assign(C, F, V) sm_integrity_assign_extent(C, C, SM_CONTEXT_SEALED, F, V)
+#define sm_hash_table_seal(C, O) sm_integrity_seal_extent(C, O, SM_HASH_TABLE_SEALED)
+#define sm_hash_table_verify(C, O) sm_integrity_verify_extent(C, O, SM_HASH_TABLE_SEALED)
+#define sm_hash_table_assign(C, O, F, V) sm_integrity_assign_extent(C, O, SM_HASH_TABLE_SEALED, F, V)
+
+
 #endif // INCLUDE_SM_INTERNAL_H
 
@@ -0,0 +1,387 @@
+// thread.c - Cross-platform threads and conditions.
+
+
+#include "config.h"
+#include "thread.h"
+#include "mutex.h"
+#include "fork.h"
+
+
+#if defined(SM_OS_WINDOWS)
+
+
+#include <process.h>
+
+
+// Runs the entry point of the thread given as argument.
+static unsigned __stdcall sm_thread_start(void* p)
+{
+	sm_thread_t* t = (sm_thread_t*)p;
+	t->function(t->argument);
+	return 0;
+}
+
+
+// Starts a thread running f(argument).
+exported uint8_t callconv sm_thread_create(sm_thread_t* t, sm_thread_f f, void* argument)
+{
+	if (!t || !f) return 0;
+	t->function = f;
+	t->argument = argument;
+	t->handle = (HANDLE)_beginthreadex(NULL, 0, sm_thread_start, t, 0, NULL);
+	return (t->handle != NULL);
+}
+
+
+// Waits for the given thread to finish, and releases it.
+exported uint8_t callconv sm_thread_join(sm_thread_t* t)
+{
+	if (!t || !t->handle) return 0;
+	if (WaitForSingleObject(t->handle, INFINITE) != WAIT_OBJECT_0) return 0;
+	CloseHandle(t->handle);
+	t->handle = NULL;
+	return 1;
+}
+
+
+// Gets the count of logical processors available to the process.
+exported uint32_t callconv sm_thread_processors(void)
+{
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return (si.dwNumberOfProcessors > 0) ? (uint32_t)si.dwNumberOfProcessors : 1;
+}
+
+
+// Initializes the given condition.
+exported uint8_t callconv sm_condition_create(sm_condition_t* c)
+{
+	if (!c) return 0;
+	InitializeConditionVariable(c);
+	return 1;
+}
+
+
+// Destroys the given condition.
+exported uint8_t callconv sm_condition_destroy(sm_condition_t* c)
+{
+	return (c != NULL);
+}
+
+
+// Unlocks the given mutex, waits for the condition, and locks the mutex again.
+exported uint8_t callconv sm_condition_wait(sm_condition_t* c, sm_mutex_t* m)
+{
+	if (!c || !m) return 0;
+	return (SleepConditionVariableCS(c, m, INFINITE) != 0);
+}
+
+
+// Wakes one thread waiting for the given condition.
+exported uint8_t callconv sm_condition_wake(sm_condition_t* c)
+{
+	if (!c) return 0;
+	WakeConditionVariable(c);
+	return 1;
+}
+
+
+// Wakes all threads waiting for the given condition.
+exported uint8_t callconv sm_condition_wake_all(sm_condition_t* c)
+{
+	if (!c) return 0;
+	WakeAllConditionVariable(c);
+	return 1;
+}
+
+
+#elif defined(SM_OS_LINUX)
+
+
+// Runs the entry point of the thread given as argument.
+static void* sm_thread_start(void* p)
+{
+	sm_thread_t* t = (sm_thread_t*)p;
+	t->function(t->argument);
+	return NULL;
+}
+
+
+// Starts a thread running f(argument).
+exported uint8_t callconv sm_thread_create(sm_thread_t* t, sm_thread_f f, void* argument)
+{
+	if (!t || !f) return 0;
+	t->function = f;
+	t->argument = argument;
+	return (pthread_create(&t->handle, NULL, sm_thread_start, t) == 0);
+}
+
+
+// Waits for the given thread to finish, and releases it.
+exported uint8_t callconv sm_thread_join(sm_thread_t* t)
+{
+	if (!t) return 0;
+	return (pthread_join(t->handle, NULL) == 0);
+}
+
+
+// Gets the count of logical processors available to the process.
+exported uint32_t callconv sm_thread_processors(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0) ? (uint32_t)n : 1;
+}
+
+
+// Initializes the given condition.
+exported uint8_t callconv sm_condition_create(sm_condition_t* c)
+{
+	if (!c) return 0;
+	return (pthread_cond_init(c, NULL) == 0);
+}
+
+
+// Destroys the given condition.
+exported uint8_t callconv sm_condition_destroy(sm_condition_t* c)
+{
+	if (!c) return 0;
+	return (pthread_cond_destroy(c) == 0);
+}
+
+
+// Unlocks the given mutex, waits for the condition, and locks the mutex again.
+exported uint8_t callconv sm_condition_wait(sm_condition_t* c, sm_mutex_t* m)
+{
+	if (!c || !m) return 0;
+	return (pthread_cond_wait(c, m) == 0);
+}
+
+
+// Wakes one thread waiting for the given condition.
+exported uint8_t callconv sm_condition_wake(sm_condition_t* c)
+{
+	if (!c) return 0;
+	return (pthread_cond_signal(c) == 0);
+}
+
+
+// Wakes all threads waiting for the given condition.
+exported uint8_t callconv sm_condition_wake_all(sm_condition_t* c)
+{
+	if (!c) return 0;
+	return (pthread_cond_broadcast(c) == 0);
+}
+
+
+#endif // SM_OS_LINUX
+
+
+// Shared state of a parallel run.
+typedef struct sm_thread_parallel_s
+{
+	sm_task_f task; // The task.
+	void* argument; // The task argument.
+	uint64_t count; // The count of work items.
+	volatile uint64_t next; // The next unclaimed work item.
+}
+sm_thread_parallel_t;
+
+
+// Claims and runs work items of the given parallel run until none are left.
+static void sm_thread_parallel_worker(void* p)
+{
+	sm_thread_parallel_t* run = (sm_thread_parallel_t*)p;
+	register uint64_t i;
+
+	while ((i = sm_atomic_add_64(&run->next, 1)) < run->count)
+		run->task(run->argument, (size_t)i);
+}
+
+
+// The worker pool parallel runs are handed to. Workers are started as runs first need them and then wait for the next
+// run, so a run costs a wake-up per worker rather than a thread start and join. One run uses the pool at a time.
+static struct
+{
+	volatile uint64_t state; // 0 until set up, 1 while being set up, 2 once set up, 3 if it could not be. Tested by CAS.
+	uint64_t process; // The fork generation the pool was set up in; its workers are not copied into a child.
+	sm_mutex_t lock; // Guards the pool.
+	sm_condition_t wake; // Signals the workers that a run is posted, or that they should stop.
+	sm_condition_t done; // Signals the poster that the last worker has left its run.
+	sm_thread_t workers[SM_THREAD_PARALLEL_MAXIMUM - 1]; // The workers; the poster of a run is its first worker.
+	uint32_t started; // The count of workers started.
+	uint64_t generation; // The count of runs posted.
+	uint64_t born; // The generation workers being started have already seen.
+	sm_thread_parallel_t* run; // The run posted.
+	uint32_t wanted; // The count of workers the run posted wants.
+	uint32_t joined; // The count of workers that have joined it.
+	uint32_t active; // The count of workers yet to leave it.
+	uint8_t busy; // Whether a run is posted.
+	uint8_t stop; // Whether the workers have been asked to stop.
+}
+sm_thread_pool;
+
+
+// Pool worker. Joins each posted run that still wants a worker, until asked to stop.
+static void sm_thread_pool_worker(void* p)
+{
+	register uint64_t seen;
+	sm_thread_parallel_t* run;
+
+	(void)p;
+
+	sm_mutex_lock(&sm_thread_pool.lock);
+
+	seen = sm_thread_pool.born;
+
+	for (;;)
+	{
+		while (!sm_thread_pool.stop && sm_thread_pool.generation == seen)
+			sm_condition_wait(&sm_thread_pool.wake, &sm_thread_pool.lock);
+
+		if (sm_thread_pool.stop) break;
+
+		seen = sm_thread_pool.generation;
+
+		if (sm_thread_pool.joined >= sm_thread_pool.wanted) continue; // Not needed for this run.
+
+		sm_thread_pool.joined++;
+		run = sm_thread_pool.run;
+
+		sm_mutex_unlock(&sm_thread_pool.lock);
+
+		sm_thread_parallel_worker(run);
+
+		sm_mutex_lock(&sm_thread_pool.lock);
+
+		if (--sm_thread_pool.active == 0) sm_condition_wake(&sm_thread_pool.done);
+	}
+
+	sm_mutex_unlock(&sm_thread_pool.lock);
+}
+
+
+// Sets the pool up on first use, or again in a child process after a fork, then takes it for a run. Returns 0 if it
+// cannot be set up, or another run has it.
+inline static uint8_t sm_thread_pool_enter(void)
+{
+	register const uint64_t process = sm_fork_generation();
+
+	if (sm_atomic_cas_64(&sm_thread_pool.state, 2, 2) && sm_thread_pool.process != process) // Forked: the parent's workers are gone.
+		sm_atomic_cas_64(&sm_thread_pool.state, 2, 0);
+
+	if (sm_atomic_cas_64(&sm_thread_pool.state, 0, 1))
+	{
+		sm_thread_pool.started = 0;
+		sm_thread_pool.busy = 0;
+		sm_thread_pool.stop = 0;
+		sm_thread_pool.process = process;
+
+		register const uint8_t ready = sm_mutex_create(&sm_thread_pool.lock) && sm_condition_create(&sm_thread_pool.wake) && sm_condition_create(&sm_thread_pool.done);
+
+		sm_atomic_cas_64(&sm_thread_pool.state, 1, ready ? 2 : 3);
+	}
+
+	while (sm_atomic_cas_64(&sm_thread_pool.state, 1, 1)); // Being set up by another thread.
+
+	if (!sm_atomic_cas_64(&sm_thread_pool.state, 2, 2)) return 0;
+
+	sm_mutex_lock(&sm_thread_pool.lock);
+
+	if (sm_thread_pool.busy)
+	{
+		sm_mutex_unlock(&sm_thread_pool.lock);
+		return 0;
+	}
+
+	sm_thread_pool.busy = 1;
+
+	return 1;
+}
+
+
+// Runs task(argument, i) for every i in [0 .. count) on up to the given count of threads.
+exported uint8_t callconv sm_thread_parallel(sm_task_f task, void* argument, size_t count, uint32_t threads)
+{
+	if (!task) return 0;
+	if (!count) return 1;
+
+	sm_thread_parallel_t run = { task, argument, count, 0 };
+	register uint32_t i, started = 0;
+
+	if (!threads) threads = sm_thread_processors();
+	if (threads > SM_THREAD_PARALLEL_MAXIMUM) threads = SM_THREAD_PARALLEL_MAXIMUM;
+	if (threads > count) threads = (uint32_t)count;
+
+	if (threads == 1)
+	{
+		sm_thread_parallel_worker(&run);
+		return 1;
+	}
+
+	if (sm_thread_pool_enter())
+	{
+		sm_thread_pool.born = sm_thread_pool.generation;
+
+		while (sm_thread_pool.started < threads - 1) // The calling thread is the first worker.
+		{
+			if (!sm_thread_create(&sm_thread_pool.workers[sm_thread_pool.started], sm_thread_pool_worker, NULL)) break;
+			sm_thread_pool.started++;
+		}
+
+		sm_thread_pool.run = &run;
+		sm_thread_pool.wanted = sm_thread_pool.active = sm_min(threads - 1, sm_thread_pool.started);
+		sm_thread_pool.joined = 0;
+		sm_thread_pool.generation++;
+
+		sm_condition_wake_all(&sm_thread_pool.wake);
+		sm_mutex_unlock(&sm_thread_pool.lock);
+
+		sm_thread_parallel_worker(&run);
+
+		sm_mutex_lock(&sm_thread_pool.lock);
+
+		while (sm_thread_pool.active)
+			sm_condition_wait(&sm_thread_pool.done, &sm_thread_pool.lock);
+
+		sm_thread_pool.run = NULL;
+		sm_thread_pool.busy = 0;
+
+		sm_mutex_unlock(&sm_thread_pool.lock);
+
+		return 1;
+	}
+
+	sm_thread_t workers[SM_THREAD_PARALLEL_MAXIMUM]; // The pool is taken, so this run starts its own threads.
+
+	for (i = 1; i < threads; ++i, ++started) // The calling thread is the first worker.
+		if (!sm_thread_create(&workers[started], sm_thread_parallel_worker, &run)) break;
+
+	sm_thread_parallel_worker(&run);
+
+	for (i = 0; i < started; ++i)
+		sm_thread_join(&workers[i]);
+
+	return 1;
+}
+
+
+// Stops and joins the workers of the pool.
+exported void callconv sm_thread_pool_release(void)
+{
+	register uint32_t i;
+
+	if (!sm_atomic_cas_64(&sm_thread_pool.state, 2, 2) || sm_thread_pool.process != sm_fork_generation()) return;
+
+	sm_mutex_lock(&sm_thread_pool.lock);
+	sm_thread_pool.stop = 1;
+	sm_condition_wake_all(&sm_thread_pool.wake);
+	sm_mutex_unlock(&sm_thread_pool.lock);
+
+	for (i = 0; i < sm_thread_pool.started; ++i)
+		sm_thread_join(&sm_thread_pool.workers[i]);
+
+	sm_mutex_lock(&sm_thread_pool.lock);
+	sm_thread_pool.started = 0;
+	sm_thread_pool.stop = 0;
+	sm_mutex_unlock(&sm_thread_pool.lock);
+}
@@ -0,0 +1,79 @@
+// thread.h - Cross-platform thread and condition declarations.
+
+
+#include "config.h"
+
+
+#ifndef INCLUDE_THREAD_H
+#define INCLUDE_THREAD_H 1
+
+
+// Thread entry point. Receives the argument given to sm_thread_create.
+typedef void (*sm_thread_f)(void*);
+
+// Parallel task. Receives the argument given to sm_thread_parallel and the index of the work item to run.
+typedef void (*sm_task_f)(void*, size_t);
+
+
+// The most threads sm_thread_parallel runs at once, including the caller.
+#define SM_THREAD_PARALLEL_MAXIMUM 64U
+
+
+#if defined(SM_OS_WINDOWS)
+typedef CONDITION_VARIABLE sm_condition_t;
+#else
+typedef pthread_cond_t sm_condition_t;
+#endif
+
+
+// Thread state. Must stay valid until the thread is joined.
+typedef struct sm_thread_s
+{
+#if defined(SM_OS_WINDOWS)
+	HANDLE handle; // The thread handle.
+#else
+	pthread_t handle; // The thread handle.
+#endif
+	sm_thread_f function; // The entry point.
+	void* argument; // The entry point argument.
+}
+sm_thread_t;
+
+
+// Starts a thread running f(argument).
+exported uint8_t callconv sm_thread_create(sm_thread_t* t, sm_thread_f f, void* argument);
+
+// Waits for the given thread to finish, and releases it.
+exported uint8_t callconv sm_thread_join(sm_thread_t* t);
+
+// Gets the count of logical processors available to the process, at least 1.
+exported uint32_t callconv sm_thread_processors(void);
+
+// Runs task(argument, i) for every i in [0 .. count) on up to the given count of threads, including the calling thread,
+// and returns once all have finished. Items are claimed one at a time, so uneven items balance out. Zero threads uses one
+// per processor. The other threads are workers of a process-wide pool, started as runs first need them and kept waiting
+// for the next run. While the pool is running another run, such as from within a task, threads are started for this
+// run alone. If threads cannot be started, the remaining items run on the calling thread.
+exported uint8_t callconv sm_thread_parallel(sm_task_f task, void* argument, size_t count, uint32_t threads);
+
+// Stops and joins the workers of the pool of sm_thread_parallel, such as before the module is unloaded. No run may be in
+// progress. The pool starts again on the next run.
+exported void callconv sm_thread_pool_release(void);
+
+// Initializes the given condition.
+exported uint8_t callconv sm_condition_create(sm_condition_t* c);
+
+// Destroys the given condition.
+exported uint8_t callconv sm_condition_destroy(sm_condition_t* c);
+
+// Atomically unlocks the given locked mutex and waits for the condition, then locks the mutex again. May wake spuriously.
+exported uint8_t callconv sm_condition_wait(sm_condition_t* c, sm_mutex_t* m);
+
+// Wakes one thread waiting for the given condition.
+exported uint8_t callconv sm_condition_wake(sm_condition_t* c);
+
+// Wakes all threads waiting for the given condition.
+exported uint8_t callconv sm_condition_wake_all(sm_condition_t* c);
+
+
+#endif // INCLUDE_THREAD_H
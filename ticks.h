@@ -0,0 +1,26 @@
+// ticks.h - Processor tick counter.
+
+
+#include "config.h"
+
+
+#ifndef INCLUDE_TICKS_H
+#define INCLUDE_TICKS_H 1
+
+
+#if defined(SM_OS_WINDOWS)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+
+// Reads the processor time-stamp counter. Suitable for measuring short intervals on one thread.
+inline static uint64_t sm_ticks()
+{
+	return (uint64_t)__rdtsc();
+}
+
+
+#endif // INCLUDE_TICKS_H
+
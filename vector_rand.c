@@ -0,0 +1,266 @@
+// vector_rand.c - Multi-lane Xoroshiro128+ engine.
+
+
+#include <string.h>
+
+
+#if defined(SM_OS_WINDOWS)
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
+
+
+#include "config.h"
+#include "bits.h"
+#include "cpu.h"
+#include "vector_rand.h"
+
+
+// A kernel advancing all lanes by the given count of steps, storing each step's values at out, XORed with the same bytes
+// at in unless in is null. out and in may be the same buffer, and need not be aligned.
+typedef void (*sm_vector_rand_kernel_f)(sm_vector_rand_t* engine, uint8_t* out, const uint8_t* in, size_t steps);
+
+
+// Xoroshiro128+ 64-bit generate next, given state.
+inline static uint64_t sm_vector_rand_next(register uint64_t *restrict s)
+{
+	register const uint64_t s0 = s[0];
+	register uint64_t s1 = s[1];
+	const uint64_t r = s0 + s1;
+
+	s1 ^= s0;
+	s[0] = sm_rotl_64(s0, 55) ^ s1 ^ (s1 << 14);
+	s[1] = sm_rotl_64(s1, 36);
+
+	return r;
+}
+
+
+// Xoroshiro128+ 64-bit long jump, given state. Equivalent to 2^96 calls to sm_vector_rand_next.
+inline static void sm_vector_rand_long_jump(register uint64_t *restrict s)
+{
+	static const uint64_t j[2] = { UINT64_C(0x18F7C399CCEBDA8D), UINT64_C(0xF2DEAC28BEF3BB07) };
+	register uint64_t s0 = 0, s1 = 0;
+	register uint8_t i, b;
+
+	for (i = 0; i < 2; ++i)
+	{
+		for (b = 0; b < 64; ++b)
+		{
+			if (j[i] & (UINT64_C(1) << b))
+				s0 ^= s[0], s1 ^= s[1];
+			(void)sm_vector_rand_next(s);
+		}
+	}
+
+	s[0] = s0;
+	s[1] = s1;
+}
+
+
+// Portable kernel. Lanes are independent, so the inner loop is left for the compiler to vectorize where it can.
+static void sm_vector_rand_steps_scalar(sm_vector_rand_t* engine, uint8_t* out, const uint8_t* in, size_t steps)
+{
+	register uint32_t l;
+	uint64_t r[SM_VECTOR_RAND_LANES], x[SM_VECTOR_RAND_LANES];
+
+	for (; steps > 0; --steps, out += SM_VECTOR_RAND_STEP)
+	{
+		for (l = 0; l < SM_VECTOR_RAND_LANES; ++l)
+		{
+			register const uint64_t s0 = engine->s0[l];
+			register uint64_t s1 = engine->s1[l];
+
+			r[l] = s0 + s1;
+			s1 ^= s0;
+			engine->s0[l] = sm_rotl_64(s0, 55) ^ s1 ^ (s1 << 14);
+			engine->s1[l] = sm_rotl_64(s1, 36);
+		}
+
+		if (in)
+		{
+			memcpy(x, in, SM_VECTOR_RAND_STEP);
+			in += SM_VECTOR_RAND_STEP;
+
+			for (l = 0; l < SM_VECTOR_RAND_LANES; ++l)
+				r[l] ^= x[l];
+		}
+
+		memcpy(out, r, SM_VECTOR_RAND_STEP);
+	}
+}
+
+
+#if defined(SM_CPU_AMD) || defined(SM_CPU_INTEL)
+
+
+// Rotates each 64-bit element of X left by K bits.
+#define sm_vector_rand_rotl_256(X, K) _mm256_or_si256(_mm256_slli_epi64((X), (K)), _mm256_srli_epi64((X), 64 - (K)))
+
+
+// AVX2 kernel. Lanes 0-3 and 4-7 are held in two register pairs, which also hides the latency of each step.
+sm_target("avx2") static void sm_vector_rand_steps_avx2(sm_vector_rand_t* engine, uint8_t* out, const uint8_t* in, size_t steps)
+{
+	__m256i a0 = _mm256_loadu_si256((const __m256i*)&engine->s0[0]);
+	__m256i b0 = _mm256_loadu_si256((const __m256i*)&engine->s0[4]);
+	__m256i a1 = _mm256_loadu_si256((const __m256i*)&engine->s1[0]);
+	__m256i b1 = _mm256_loadu_si256((const __m256i*)&engine->s1[4]);
+	__m256i ra, rb;
+
+	for (; steps > 0; --steps, out += SM_VECTOR_RAND_STEP)
+	{
+		ra = _mm256_add_epi64(a0, a1);
+		rb = _mm256_add_epi64(b0, b1);
+
+		a1 = _mm256_xor_si256(a1, a0);
+		b1 = _mm256_xor_si256(b1, b0);
+
+		a0 = _mm256_xor_si256(_mm256_xor_si256(sm_vector_rand_rotl_256(a0, 55), a1), _mm256_slli_epi64(a1, 14));
+		b0 = _mm256_xor_si256(_mm256_xor_si256(sm_vector_rand_rotl_256(b0, 55), b1), _mm256_slli_epi64(b1, 14));
+
+		a1 = sm_vector_rand_rotl_256(a1, 36);
+		b1 = sm_vector_rand_rotl_256(b1, 36);
+
+		if (in)
+		{
+			ra = _mm256_xor_si256(ra, _mm256_loadu_si256((const __m256i*)in));
+			rb = _mm256_xor_si256(rb, _mm256_loadu_si256((const __m256i*)(in + 32)));
+			in += SM_VECTOR_RAND_STEP;
+		}
+
+		_mm256_storeu_si256((__m256i*)out, ra);
+		_mm256_storeu_si256((__m256i*)(out + 32), rb);
+	}
+
+	_mm256_storeu_si256((__m256i*)&engine->s0[0], a0);
+	_mm256_storeu_si256((__m256i*)&engine->s0[4], b0);
+	_mm256_storeu_si256((__m256i*)&engine->s1[0], a1);
+	_mm256_storeu_si256((__m256i*)&engine->s1[4], b1);
+}
+
+
+// AVX-512 kernel. All lanes are held in one register pair, using the native rotate.
+sm_target("avx512f") static void sm_vector_rand_steps_avx512(sm_vector_rand_t* engine, uint8_t* out, const uint8_t* in, size_t steps)
+{
+	__m512i s0 = _mm512_loadu_si512((const void*)engine->s0);
+	__m512i s1 = _mm512_loadu_si512((const void*)engine->s1);
+	__m512i r;
+
+	for (; steps > 0; --steps, out += SM_VECTOR_RAND_STEP)
+	{
+		r = _mm512_add_epi64(s0, s1);
+		s1 = _mm512_xor_si512(s1, s0);
+		s0 = _mm512_xor_si512(_mm512_xor_si512(_mm512_rol_epi64(s0, 55), s1), _mm512_slli_epi64(s1, 14));
+		s1 = _mm512_rol_epi64(s1, 36);
+
+		if (in)
+		{
+			r = _mm512_xor_si512(r, _mm512_loadu_si512((const void*)in));
+			in += SM_VECTOR_RAND_STEP;
+		}
+
+		_mm512_storeu_si512((void*)out, r);
+	}
+
+	_mm512_storeu_si512((void*)engine->s0, s0);
+	_mm512_storeu_si512((void*)engine->s1, s1);
+}
+
+
+#endif
+
+
+// Selects the widest kernel the processor supports, on the first call. All kernels produce the same output.
+inline static sm_vector_rand_kernel_f sm_vector_rand_kernel()
+{
+	static volatile sm_vector_rand_kernel_f kernel = NULL;
+
+	if (kernel) return kernel;
+
+#if defined(SM_CPU_AMD) || defined(SM_CPU_INTEL)
+	register const uint32_t f = sm_cpu_features();
+
+	if (f & SM_CPU_AVX512F) return kernel = sm_vector_rand_steps_avx512;
+	if (f & SM_CPU_AVX2) return kernel = sm_vector_rand_steps_avx2;
+#endif
+
+	return kernel = sm_vector_rand_steps_scalar;
+}
+
+
+// Writes n bytes of the engine's output at p, XORed with the same bytes at in unless in is null.
+inline static void sm_vector_rand_apply(sm_vector_rand_t* engine, uint8_t* p, const uint8_t* in, size_t n)
+{
+	register const sm_vector_rand_kernel_f kernel = sm_vector_rand_kernel();
+	register const size_t steps = n / SM_VECTOR_RAND_STEP;
+	register size_t i;
+
+	if (steps)
+	{
+		kernel(engine, p, in, steps);
+
+		p += steps * SM_VECTOR_RAND_STEP;
+		if (in) in += steps * SM_VECTOR_RAND_STEP;
+		n -= steps * SM_VECTOR_RAND_STEP;
+	}
+
+	if (!n) return;
+
+	uint8_t t[SM_VECTOR_RAND_STEP];
+
+	kernel(engine, t, NULL, 1); // Partial step.
+
+	for (i = 0; i < n; ++i)
+		p[i] = in ? (uint8_t)(in[i] ^ t[i]) : t[i];
+
+	register volatile uint8_t* v = t; // Do not leave the unused values behind.
+	for (i = 0; i < SM_VECTOR_RAND_STEP; ++i) v[i] = 0;
+}
+
+
+// Seeds the engine from the given Xoroshiro128+ state, long-jumping once more for each lane.
+exported void callconv sm_vector_rand_seed(sm_vector_rand_t* engine, const uint64_t seed[2])
+{
+	if (!engine || !seed) return;
+
+	uint64_t s[2] = { seed[0], seed[1] };
+	register uint32_t l;
+
+	if (!(s[0] | s[1])) // Avoid the all-zero state.
+		s[1] = UINT64_C(0x9E3779B97F4A7C15);
+
+	for (l = 0; l < SM_VECTOR_RAND_LANES; ++l)
+	{
+		sm_vector_rand_long_jump(s);
+
+		engine->s0[l] = s[0];
+		engine->s1[l] = s[1];
+	}
+
+	s[0] = s[1] = 0;
+}
+
+
+// Generates count 64-bit values at out.
+exported void callconv sm_vector_rand_block(sm_vector_rand_t* engine, uint64_t* out, size_t count)
+{
+	if (!engine || !out || !count) return;
+	sm_vector_rand_apply(engine, (uint8_t*)out, NULL, count * sizeof(uint64_t));
+}
+
+
+// Fills n bytes at p with random values.
+exported void callconv sm_vector_rand_fill(sm_vector_rand_t* engine, void* p, size_t n)
+{
+	if (!engine || !p || !n) return;
+	sm_vector_rand_apply(engine, (uint8_t*)p, NULL, n);
+}
+
+
+// XORs n bytes at p with the engine's keystream.
+exported void callconv sm_vector_rand_xor(sm_vector_rand_t* engine, void* p, size_t n)
+{
+	if (!engine || !p || !n) return;
+	sm_vector_rand_apply(engine, (uint8_t*)p, (const uint8_t*)p, n);
+}
@@ -0,0 +1,41 @@
+// vector_rand.h - Multi-lane Xoroshiro128+ engine.
+
+
+#include "config.h"
+
+
+#ifndef INCLUDE_VECTOR_RAND_H
+#define INCLUDE_VECTOR_RAND_H 1
+
+
+// The count of independent streams the engine advances per step.
+#define SM_VECTOR_RAND_LANES 8U
+
+// The count of bytes the engine produces per step.
+#define SM_VECTOR_RAND_STEP (SM_VECTOR_RAND_LANES * sizeof(uint64_t))
+
+
+// Multi-lane Xoroshiro128+ state. Lane l is held in s0[l] and s1[l], so that a step maps directly onto vector registers.
+typedef struct sm_vector_rand_s
+{
+	uint64_t s0[SM_VECTOR_RAND_LANES];
+	uint64_t s1[SM_VECTOR_RAND_LANES];
+}
+sm_vector_rand_t;
+
+
+// Seeds the engine from the given Xoroshiro128+ state. Lane l starts (l + 1) * 2^96 values ahead of it, so the lanes do not
+// overlap the seed stream, each other, or the lanes of any seed less than 2^96 values away.
+exported void callconv sm_vector_rand_seed(sm_vector_rand_t* engine, const uint64_t seed[2]);
+
+// Generates count 64-bit values at out. Each step yields one value per lane, in lane order; a partial step is discarded.
+exported void callconv sm_vector_rand_block(sm_vector_rand_t* engine, uint64_t* out, size_t count);
+
+// Fills n bytes at p with random values. The output is the same as for sm_vector_rand_block over the same bytes.
+exported void callconv sm_vector_rand_fill(sm_vector_rand_t* engine, void* p, size_t n);
+
+// XORs n bytes at p with the engine's keystream. Applying the same keystream again restores the input.
+exported void callconv sm_vector_rand_xor(sm_vector_rand_t* engine, void* p, size_t n);
+
+
+#endif // INCLUDE_VECTOR_RAND_H